@@ -1,12 +1,19 @@
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <unordered_map>
+#include <mutex>
 
 #include <sys/eventfd.h>
 #include <libaio.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventHandler.h>
+#include <folly/io/async/AsyncTimeout.h>
 
 #include "AsyncIO.h"
+#include "io_arena.h"
 
 using namespace folly;
 
@@ -15,13 +22,17 @@ enum class IOType {
 	WRITE,
 };
 
-class io {
+class io : public TimerWheel::Entry {
 public:
 	uint64_t      offset_;
 	size_t        size_;
 	int           fd_;
 	ManagedBuffer bufp_;
 	IOType        type_;
+	uint64_t      submitNs_ = 0;
+	bool          warned_   = false; /* by the watchdog */
+	uint32_t      context_  = 0;     /* index of the AIO context */
+	struct iocb   cb_;      /* must live till the IO completes */
 private:
 	AsyncIO  *asynciop_;
 public:
@@ -34,18 +45,106 @@ public:
 	}
 };
 
-AsyncIO::AsyncIO(uint16_t capacity) :
+/*
+ * Layout of the completion ring the kernel maps at the address of an
+ * io_context_t (fs/aio.c). Only this thread consumes events, so reaping is a
+ * load of tail, copying the events and a store of head.
+ */
+struct aio_ring {
+	unsigned id;
+	unsigned nr;
+	unsigned head;
+	unsigned tail;
+	unsigned magic;
+	unsigned compat_features;
+	unsigned incompat_features;
+	unsigned header_length;
+	struct io_event io_events[0];
+};
+
+static const unsigned AIO_RING_MAGIC = 0xa10a10a1;
+
+/* sparse memory image, chunks are allocated on first write */
+class RamImage {
+private:
+	static const uint64_t CHUNK_SHIFT = 20;
+	static const uint64_t CHUNK_SIZE  = 1ull << CHUNK_SHIFT;
+
+	/*
+	 * Shared by the AsyncIOs of every submitter thread. Only finding and
+	 * adding chunks is locked, chunks are never freed while in use.
+	 */
+	mutable std::mutex lock_;
+	std::unordered_map<uint64_t, unique_ptr<char[]>> chunks_;
+
+	char *chunk(uint64_t offset) const {
+		std::lock_guard<std::mutex> l(lock_);
+		auto it = chunks_.find(offset >> CHUNK_SHIFT);
+		return it == chunks_.end() ? nullptr : it->second.get();
+	}
+
+public:
+	void write(const char *bufp, size_t size, uint64_t offset) {
+		while (size) {
+			auto co = offset & (CHUNK_SIZE - 1);
+			auto c  = std::min<uint64_t>(CHUNK_SIZE - co, size);
+			char *cp;
+			{
+				std::lock_guard<std::mutex> l(lock_);
+				auto &up = chunks_[offset >> CHUNK_SHIFT];
+				if (!up) {
+					up.reset(new char[CHUNK_SIZE]());
+				}
+				cp = up.get();
+			}
+			std::memcpy(cp + co, bufp, c);
+			bufp   += c;
+			offset += c;
+			size   -= c;
+		}
+	}
+
+	void read(char *bufp, size_t size, uint64_t offset) const {
+		while (size) {
+			auto co = offset & (CHUNK_SIZE - 1);
+			auto c  = std::min<uint64_t>(CHUNK_SIZE - co, size);
+			auto cp = chunk(offset);
+			if (!cp) {
+				std::memset(bufp, 0, c);
+			} else {
+				std::memcpy(bufp, cp + co, c);
+			}
+			bufp   += c;
+			offset += c;
+			size   -= c;
+		}
+	}
+};
+
+AsyncIO::AsyncIO(uint32_t capacity, IOEngine engine) : engine_(engine),
 			capacity_(capacity), eventfd_(-1), handlerp_(nullptr), initialized_(false) {
-	std::memset(&context_, 0, sizeof(context_));
-	auto rc = io_setup(capacity_, &context_);
-	assert(rc == 0);
+	if (engine_ == IOEngine::AIO) {
+		setContexts(0);
+	} else {
+		done_.reserve(capacity_);
+		if (engine_ == IOEngine::RAM) {
+			ram_ = std::make_shared<RamImage>();
+		}
+	}
 
+	events_.resize(capacity_);
 	nsubmitted  = 0;
 	ncompleted  = 0;
 	nreads      = 0;
 	nwrites     = 0;
 	nbytesRead  = 0;
 	nbytesWrote = 0;
+	nsyscalls   = 0;
+	nringReaped = 0;
+	nbatches    = 0;
+	nbatched    = 0;
+	npartial    = 0;
+	neagain     = 0;
 }
 
 AsyncIO::~AsyncIO() {
@@ -55,7 +154,59 @@ AsyncIO::~AsyncIO() {
 	if (handlerp_) {
 		delete(handlerp_);
 	}
-	io_destroy(context_);
+	for (auto &c : contexts_) {
+		io_destroy(c.ctx);
+	}
+	for (auto &fb : freeBuffers_) {
+		for (auto bp : fb.second) {
+			free(bp);
+		}
+	}
+}
+
+void AsyncIO::setContexts(uint32_t n) {
+	assert(!initialized_);
+	if (engine_ != IOEngine::AIO) {
+		return;
+	}
+	if (n == 0) {
+		n = (capacity_ + CONTEXT_DEPTH - 1) / CONTEXT_DEPTH;
+	}
+	n = std::max<uint32_t>(1, std::min(n, capacity_));
+
+	for (auto &c : contexts_) {
+		io_destroy(c.ctx);
+	}
+	contexts_.clear();
+	contexts_.resize(n);
+
+	/* a ring reap is only safe if every context's ring has the known layout */
+	bool usable = n > 0;
+	for (uint32_t i = 0; i < n; i++) {
+		auto &c = contexts_[i];
+		c.depth = capacity_ / n + (i < capacity_ % n);
+		std::memset(&c.ctx, 0, sizeof(c.ctx));
+		auto rc = io_setup(c.depth, &c.ctx);
+		if (rc == -EAGAIN) {
+			/*
+			 * The kernel reserves twice max(depth, 4 * possible CPUs) events of
+			 * fs.aio-max-nr per context, shared by every process on the system.
+			 */
+			contexts_.resize(i);
+			throw std::runtime_error("io_setup failed, fs.aio-max-nr is too low "
+				"for a context of " + std::to_string(c.depth) + " IOs: the kernel "
+				"reserves twice the depth (at least 8 per CPU) per context");
+		} else if (rc < 0) {
+			contexts_.resize(i);
+			throw std::runtime_error("io_setup failed " + std::string(strerror(-rc)));
+		}
+
+		auto ringp = reinterpret_cast<struct aio_ring *>(c.ctx);
+		usable = usable && ringp->magic == AIO_RING_MAGIC && ringp->incompat_features == 0;
+	}
+	ringUsable_  = usable && ringReap_;
+	nextSubmit_  = 0;
+	nextReap_    = 0;
 }
 
 void AsyncIO::init(EventBase *basep) {
@@ -63,7 +214,15 @@ void AsyncIO::init(EventBase *basep) {
 	assert(eventfd_ >= 0);
 	handlerp_ = new EventFDHandler(this, basep, eventfd_);
 	assert(handlerp_);
-	handlerp_->registerHandler(EventHandler::READ | EventHandler::PERSIST);
+	if (!polling_) {
+		handlerp_->registerHandler(EventHandler::READ | EventHandler::PERSIST);
+	}
+	submitTimeout_ = std::make_unique<SubmitTimeout>(this, basep);
+	if (watchTickNs_) {
+		watchStartNs_    = monotonicNs();
+		watchdogTimeout_ = std::make_unique<WatchdogTimeout>(this, basep);
+		watchdogTimeout_->scheduleTimeout(watchTickNs_ / 1000000);
+	}
 	initialized_ = true;
 }
 
@@ -77,15 +236,180 @@ ssize_t AsyncIO::ioResult(struct io_event *ep) {
 	return ((ssize_t)(((uint64_t)ep->res2 << 32) | ep->res));
 }
 
+void AsyncIO::setRingReap(bool enable) {
+	ringReap_ = enable;
+	if (!enable) {
+		ringUsable_ = false;
+	}
+}
+
+/* copy up to max events from the completion ring, no syscalls */
+int AsyncIO::ringReap(AIOContext &c, struct io_event *events, int max) {
+	auto ringp = reinterpret_cast<struct aio_ring *>(c.ctx);
+	auto head  = ringp->head;
+	auto tail  = __atomic_load_n(&ringp->tail, __ATOMIC_ACQUIRE);
+
+	int n = 0;
+	while (head != tail && n < max) {
+		events[n++] = ringp->io_events[head];
+		head = (head + 1) % ringp->nr;
+	}
+	__atomic_store_n(&ringp->head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+bool AsyncIO::ringEmpty() {
+	for (auto &c : contexts_) {
+		auto ringp = reinterpret_cast<struct aio_ring *>(c.ctx);
+		if (ringp->head != __atomic_load_n(&ringp->tail, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Take up to max completions without waiting, from every context in turn.
+ * The context reaped first rotates, so with more completions than max a
+ * busy context can not starve the others.
+ */
+int AsyncIO::contextsReap(struct io_event *events, int max) {
+	int  n  = 0;
+	auto nc = contexts_.size();
+	for (size_t i = 0; i < nc && n < max; i++) {
+		auto &c = contexts_[(nextReap_ + i) % nc];
+		int  r;
+		if (ringUsable_) {
+			r = ringReap(c, events + n, max - n);
+			nringReaped += r;
+		} else {
+			struct timespec ts = {0, 0};
+			r = io_getevents(c.ctx, 0, max - n, events + n, &ts);
+			nsyscalls++;
+			assert(r >= 0);
+		}
+		c.nreaped += r;
+		n         += r;
+	}
+	nextReap_ = (nextReap_ + 1) % nc;
+	return n;
+}
+
+/* get exactly nevents completions */
+void AsyncIO::reap(struct io_event *events, int nevents) {
+	if (engine_ != IOEngine::AIO) {
+		assert(done_.size() >= (size_t) nevents);
+		std::copy(done_.begin(), done_.begin() + nevents, events);
+		done_.erase(done_.begin(), done_.begin() + nevents);
+		return;
+	}
+
+	/*
+	 * Completions are in the rings before the eventfd is signalled, the
+	 * contexts hold all nevents already.
+	 */
+	int n = 0;
+	while (n < nevents) {
+		n += contextsReap(events + n, nevents - n);
+	}
+}
+
+void AsyncIO::complete(struct io_event *events, int nevents) {
+	auto now    = monotonicNs();
+	auto clears = slowClears_.load(std::memory_order_relaxed);
+	auto seq    = slowSeq_.load(std::memory_order_relaxed);
+	if (clears != slowCleared_) {
+		slowSeq_.store(++seq, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slow_.clear();
+		slowSeq_.store(++seq, std::memory_order_release);
+		slowCleared_ = clears;
+	}
+	for (auto ep = events; ep < events + nevents; ep++) {
+		auto *iop = reinterpret_cast<io*>(ep->data);
+		bool read = iop->type_ == IOType::READ;
+		auto ns   = now - iop->submitNs_;
+		latency_[polling_][read].record(ns);
+		if (slow_.isSlow(ns)) {
+			slowSeq_.store(++seq, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slow_.add({iop->offset_, iop->size_, iop->submitNs_, ns,
+				(uint32_t) getInflight(), read});
+			slowSeq_.store(++seq, std::memory_order_release);
+		}
+	}
+	for (auto ep = events; ep < events + nevents; ep++) {
+		auto *iop   = reinterpret_cast<io*>(ep->data);
+		auto result = ioResult(ep);
+		bool read   = iop->type_ == IOType::READ;
+		if (read) {
+			this->nbytesRead  += iop->size_;
+		} else {
+			this->nbytesWrote += iop->size_;
+		}
+		if (!contexts_.empty()) {
+			contexts_[iop->context_].inflight--;
+		}
+		if (watchTickNs_) {
+			wheel_.remove(iop);
+		}
+		iocbp_(cbdatap_, std::move(iop->bufp_), iop->size_, iop->offset_, result, read);
+		delete iop;
+	}
+}
+
+void AsyncIO::setPolling(bool polling) {
+	assert(getPending() == 0);
+	if (polling == polling_) {
+		return;
+	}
+
+	polling_ = polling;
+	if (!initialized_) {
+		return;
+	}
+	if (polling_) {
+		handlerp_->unregisterHandler();
+	} else {
+		handlerp_->registerHandler(EventHandler::READ | EventHandler::PERSIST);
+	}
+}
+
+int AsyncIO::poll() {
+	assert(polling_ && iocbp_);
+
+	int n;
+	if (engine_ != IOEngine::AIO) {
+		n = std::min(done_.size(), events_.size());
+		std::copy(done_.begin(), done_.begin() + n, events_.begin());
+		done_.erase(done_.begin(), done_.begin() + n);
+	} else {
+		n = contextsReap(events_.data(), events_.size());
+	}
+	if (n <= 0) {
+		submit();
+		return 0;
+	}
+
+	complete(events_.data(), n);
+	this->ncompleted += n;
+	if (niocbp_) {
+		niocbp_(cbdatap_, n);
+	}
+	submit();
+	return n;
+}
+
 void AsyncIO::iosCompleted() {
 	assert(iocbp_ && eventfd_ >= 0);
 
 	eventfd_t nevents;
-	uint16_t  completed = 0;
+	uint32_t  completed = 0;
 
 	while (1) {
 		nevents = 0;
 		int rc  = eventfd_read(eventfd_, &nevents);
+		nsyscalls++;
 		if (rc < 0 || nevents == 0) {
 			if (rc < 0 && errno != EAGAIN) {
 				assert(0);
@@ -96,79 +420,310 @@ void AsyncIO::iosCompleted() {
 		}
 
 		assert(nevents > 0);
-		struct io_event events[nevents];
-		rc = io_getevents(context_, nevents, nevents, events, NULL);
-		assert(rc == nevents);
-
-		for (auto ep = events; ep < events + nevents; ep++) {
-			auto *iop   = reinterpret_cast<io*>(ep->data);
-			auto result = ioResult(ep);
-			bool read   = iop->type_ == IOType::READ;
-			if (read) {
-				this->nbytesRead  += iop->size_;
-			} else {
-				this->nbytesWrote += iop->size_;
-			}
-			iocbp_(cbdatap_, std::move(iop->bufp_), iop->size_, iop->offset_, result, read);
-			delete iop;
+		for (auto left = nevents; left; ) {
+			auto c = std::min<eventfd_t>(left, events_.size());
+			reap(events_.data(), c);
+			complete(events_.data(), c);
+			left -= c;
 		}
 		completed += nevents;
+
+		/*
+		 * Completions are added to the ring before the eventfd is signalled,
+		 * an empty ring means the eventfd has nothing more for us - save the
+		 * read which would fail with EAGAIN.
+		 */
+		if ((ringUsable_ && ringEmpty()) ||
+				(engine_ != IOEngine::AIO && done_.empty())) {
+			break;
+		}
 	}
 
 	this->ncompleted += completed;
 	if (niocbp_) {
 		niocbp_(cbdatap_, completed);
 	}
+	submit();
 }
 
 uint64_t AsyncIO::getPending() {
 	return this->nsubmitted - this->ncompleted;
 }
 
-void AsyncIO::pwritePrepare(struct iocb *iocbp, int fd, ManagedBuffer bufp, size_t size, uint64_t offset) {
-	assert(initialized_ && iocbp && bufp && fd >= 0);
-	std::memset(iocbp, 0, sizeof(*iocbp));
+void AsyncIO::queue(int fd, ManagedBuffer bufp, size_t size, uint64_t offset, IOType type) {
+	assert(initialized_ && bufp && (fd >= 0 || engine_ != IOEngine::AIO));
 
-	char *b = bufp.get();
-	io_prep_pwrite(iocbp, fd, b, size, offset);
-	io_set_eventfd(iocbp, eventfd_);
-	auto iop  = new io(this, fd, std::move(bufp), size, offset, IOType::WRITE);
-	iocbp->data = reinterpret_cast<void *>(iop);
+	char *b  = bufp.get();
+	auto iop = new io(this, fd, std::move(bufp), size, offset, type);
 	assert(iop);
+
+	auto cbp = &iop->cb_;
+	std::memset(cbp, 0, sizeof(*cbp));
+	if (type == IOType::WRITE) {
+		io_prep_pwrite(cbp, fd, b, size, offset);
+		this->nwrites++;
+	} else {
+		io_prep_pread(cbp, fd, b, size, offset);
+		this->nreads++;
+	}
+	if (!polling_) {
+		io_set_eventfd(cbp, eventfd_);
+	}
+	cbp->data = reinterpret_cast<void *>(iop);
+
+	if (queued_.empty()) {
+		queuedNs_ = monotonicNs();
+	}
+	queued_.push_back(cbp);
+	this->nsubmitted++;
 }
 
-int AsyncIO::pwrite(struct iocb **iocbpp, int nwrites) {
-	assert(initialized_ && iocbpp && nwrites);
-	this->nwrites    += nwrites;
-	this->nsubmitted += nwrites;
-	return io_submit(context_, nwrites, iocbpp);
+void AsyncIO::pwriteQueue(int fd, ManagedBuffer bufp, size_t size, uint64_t offset) {
+	queue(fd, std::move(bufp), size, offset, IOType::WRITE);
 }
 
-void AsyncIO::preadPrepare(struct iocb *iocbp, int fd, ManagedBuffer bufp, size_t size, uint64_t offset) {
-	assert(initialized_ && iocbp && bufp && fd >= 0);
-	std::memset(iocbp, 0, sizeof(*iocbp));
+void AsyncIO::preadQueue(int fd, ManagedBuffer bufp, size_t size, uint64_t offset) {
+	queue(fd, std::move(bufp), size, offset, IOType::READ);
+}
 
-	char *b = bufp.get();
-	io_prep_pread(iocbp, fd, b, size, offset);
-	io_set_eventfd(iocbp, eventfd_);
-	auto iop  = new io(this, fd, std::move(bufp), size, offset, IOType::READ);
-	iocbp->data = reinterpret_cast<void *>(iop);
-	assert(iop);
+void AsyncIO::setBatch(uint32_t batch, uint64_t deadlineUs) {
+	batch_      = std::max<uint32_t>(1, std::min(batch, capacity_));
+	deadlineNs_ = deadlineUs * 1000;
+}
+
+uint64_t AsyncIO::getInflight() const {
+	return nsubmitted - ncompleted - queued_.size();
+}
+
+/*
+ * Submit queued IOs once a batch is full, the oldest has waited the deadline
+ * or nothing is in flight (no completion would come to submit them).
+ */
+int AsyncIO::submit() {
+	if (queued_.empty()) {
+		return 0;
+	}
+
+	if (queued_.size() >= batch_ || getInflight() == 0 ||
+			monotonicNs() - queuedNs_ >= deadlineNs_) {
+		return flush();
+	}
+
+	scheduleSubmit();
+	return 0;
 }
 
-int AsyncIO::pread(struct iocb **iocbpp, int nreads) {
-	assert(initialized_ && iocbpp && nreads);
-	this->nreads     += nreads;
-	this->nsubmitted += nreads;
-	return io_submit(context_, nreads, iocbpp);
+/* next context round robin with room for an IO, -1 if all are full */
+int AsyncIO::pickContext() {
+	auto nc = contexts_.size();
+	for (size_t i = 0; i < nc; i++) {
+		auto k = (nextSubmit_ + i) % nc;
+		if (contexts_[k].inflight < contexts_[k].depth) {
+			nextSubmit_ = (k + 1) % nc;
+			return k;
+		}
+	}
+	return -1;
+}
+
+int AsyncIO::flush() {
+	size_t n = 0;
+	while (n < queued_.size()) {
+		size_t c  = queued_.size() - n;
+		auto   cp = queued_.data() + n;
+
+		int rc;
+		if (engine_ != IOEngine::AIO) {
+			submitted(cp, c);
+			rc = memSubmit(cp, c);
+		} else {
+			auto k = pickContext();
+			if (k < 0) {
+				/* every context full, retry when something completes */
+				break;
+			}
+			auto &ctx = contexts_[k];
+			c = std::min<size_t>(c, ctx.depth - ctx.inflight);
+			for (size_t i = 0; i < c; i++) {
+				reinterpret_cast<io *>(cp[i]->data)->context_ = k;
+			}
+			submitted(cp, c);
+			rc = io_submit(ctx.ctx, c, cp);
+			nsyscalls++;
+			if (rc > 0) {
+				ctx.inflight    += rc;
+				ctx.nsubmitted  += rc;
+				ctx.maxInflight  = std::max(ctx.maxInflight, ctx.inflight);
+			}
+		}
+
+		if (rc == -EAGAIN || rc == 0) {
+			/* device backpressure - retry when something completes */
+			neagain++;
+			break;
+		} else if (rc < 0) {
+			throw std::runtime_error("io_submit failed " + std::string(strerror(-rc)));
+		}
+
+		nbatches++;
+		nbatched += rc;
+		if ((size_t) rc < c) {
+			npartial++;
+		}
+		n += rc;
+	}
+
+	queued_.erase(queued_.begin(), queued_.begin() + n);
+	if (!queued_.empty()) {
+		queuedNs_ = monotonicNs();
+		scheduleSubmit();
+	}
+	return n;
+}
+
+void AsyncIO::scheduleSubmit() {
+	if (polling_ || submitTimeout_->isScheduled()) {
+		/* poll() submits */
+		return;
+	}
+	auto ms = (deadlineNs_ + 999999) / 1000000;
+	submitTimeout_->scheduleTimeout(ms ? ms : 1);
+}
+
+void AsyncIO::submitExpired() {
+	if (!queued_.empty()) {
+		flush();
+	}
+}
+
+void AsyncIO::submitted(struct iocb **iocbpp, int nios) {
+	auto now = monotonicNs();
+	for (auto i = 0; i < nios; i++) {
+		reinterpret_cast<io *>(iocbpp[i]->data)->submitNs_ = now;
+	}
+	if (watchTickNs_) {
+		auto expiry = watchTick(now + watchWarnNs_) + 1;
+		for (auto i = 0; i < nios; i++) {
+			/* IOs io_submit did not take come back here when retried */
+			auto iop = reinterpret_cast<io *>(iocbpp[i]->data);
+			wheel_.remove(iop);
+			iop->warned_ = false;
+			wheel_.insert(iop, expiry);
+		}
+	}
+}
+
+/* hung IO watchdog */
+void AsyncIO::setWatchdog(uint64_t warnMs, uint64_t critMs, HungIOCB cb, void *cbdata) {
+	assert(!initialized_ && warnMs && critMs >= warnMs);
+	watchWarnNs_ = warnMs * 1000000;
+	watchCritNs_ = critMs * 1000000;
+	/* deadlines are late by at most a tick */
+	watchTickNs_ = std::max<uint64_t>(warnMs / 8, 1) * 1000000;
+	hungcbp_     = cb;
+	hungcbdatap_ = cbdata;
+}
+
+/* ticks run by ns, deadlines expire the tick after theirs */
+uint64_t AsyncIO::watchTick(uint64_t ns) const {
+	return (ns - watchStartNs_) / watchTickNs_;
+}
+
+void AsyncIO::hungExpired(void *cbdatap, TimerWheel::Entry *ep) {
+	auto asynciop = reinterpret_cast<AsyncIO *>(cbdatap);
+	auto iop      = static_cast<io *>(ep);
+	auto now      = monotonicNs();
+	SlowIO s = {iop->offset_, iop->size_, iop->submitNs_, now - iop->submitNs_,
+		(uint32_t) asynciop->getInflight(), iop->type_ == IOType::READ};
+
+	if (!iop->warned_) {
+		iop->warned_ = true;
+		asynciop->nhungWarned_++;
+		asynciop->wheel_.insert(iop, asynciop->watchTick(iop->submitNs_ +
+			asynciop->watchCritNs_) + 1);
+		asynciop->hungcbp_(asynciop->hungcbdatap_, s, false);
+	} else {
+		/* reported once critical, it stays off the wheel */
+		asynciop->nhungCritical_++;
+		asynciop->hungcbp_(asynciop->hungcbdatap_, s, true);
+	}
+}
+
+void AsyncIO::watchdogExpired() {
+	wheel_.advance(watchTick(monotonicNs()), hungExpired, this);
+	watchdogTimeout_->scheduleTimeout(watchTickNs_ / 1000000);
+}
+
+int AsyncIO::memSubmit(struct iocb **iocbpp, int nios) {
+	for (auto i = 0; i < nios; i++) {
+		auto iop = reinterpret_cast<io *>(iocbpp[i]->data);
+		if (ram_ && iop->type_ == IOType::WRITE) {
+			ram_->write(iop->bufp_.get(), iop->size_, iop->offset_);
+		} else if (ram_) {
+			ram_->read(iop->bufp_.get(), iop->size_, iop->offset_);
+		}
+
+		struct io_event e;
+		e.data = iop;
+		e.obj  = iocbpp[i];
+		e.res  = iop->size_;
+		e.res2 = 0;
+		done_.push_back(e);
+	}
+
+	if (!polling_) {
+		auto rc = eventfd_write(eventfd_, nios);
+		nsyscalls++;
+		assert(rc == 0);
+	}
+	return nios;
 }
 
 #define PAGE_SIZE 4096
 #define DEFAULT_ALIGNMENT PAGE_SIZE
 
 ManagedBuffer AsyncIO::getIOBuffer(size_t size) {
+	/* the arena is the pool when there is one */
+	auto ap = IOArena::get();
+	if (ap) {
+		auto bp = ap->alloc(size);
+		if (bp) {
+			return ManagedBuffer(bp, ioBufferFree);
+		}
+	}
+
+	auto it = freeBuffers_.find(size);
+	if (it != freeBuffers_.end() && !it->second.empty()) {
+		auto bp = it->second.back();
+		it->second.pop_back();
+		freeBytes_ -= size;
+		return ManagedBuffer(bp, ioBufferFree);
+	}
+
 	void *bufp{};
 	auto rc = posix_memalign(&bufp, DEFAULT_ALIGNMENT, size);
 	assert(rc == 0 && bufp);
-	return ManagedBuffer(reinterpret_cast<char *>(bufp), free);
-}
\ No newline at end of file
+	return ManagedBuffer(reinterpret_cast<char *>(bufp), ioBufferFree);
+}
+
+void AsyncIO::putIOBuffer(ManagedBuffer bufp, size_t size) {
+	auto ap = IOArena::get();
+	if (!bufp || freeBytes_ + size > MAX_FREE_BYTES ||
+			(ap && ap->contains(bufp.get()))) {
+		return;
+	}
+	freeBuffers_[size].push_back(bufp.release());
+	freeBytes_ += size;
+}
+
+std::vector<void *> AsyncIO::getFreeBufferPages() const {
+	std::vector<void *> pages;
+	for (auto &fb : freeBuffers_) {
+		for (auto bp : fb.second) {
+			for (size_t o = 0; o < fb.first; o += PAGE_SIZE) {
+				pages.push_back(bp + o);
+			}
+		}
+	}
+	return pages;
+}
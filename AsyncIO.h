@@ -1,24 +1,67 @@
 #ifndef __ASYNCIO_H__
 #define __ASYNCIO_H__
 
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+
 #include <libaio.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventHandler.h>
+#include <folly/io/async/AsyncTimeout.h>
+
+#include "latency.h"
+#include "timer_wheel.h"
 
 using namespace folly;
 using std::unique_ptr;
 using std::shared_ptr;
 
 typedef unique_ptr<char, void(*)(void*)> ManagedBuffer;
+
+/*
+ * AIO submits to the kernel. RAM and NULLIO complete every IO at submission,
+ * from a sparse memory image or without moving any data, and signal the
+ * eventfd so completions are delivered through the usual iosCompleted path.
+ */
+enum class IOEngine {
+	AIO,
+	RAM,
+	NULLIO,
+};
+
+class RamImage;
+enum class IOType;
 typedef std::function<void(void *cbdata, ManagedBuffer bufp, size_t size, uint64_t offset, ssize_t result, bool read)> IOCompleteCB;
-typedef std::function<void(void *cbdata, uint16_t nios)> NIOSCompleteCB;
+typedef std::function<void(void *cbdata, uint32_t nios)> NIOSCompleteCB;
+typedef std::function<void(void *cbdata, const SlowIO &io, bool critical)> HungIOCB;
+
+/* a kernel AIO context and the IOs submitted through it */
+struct AIOContext {
+	io_context_t ctx;
+	uint32_t     depth;            /* IOs it was set up for */
+	uint32_t     inflight    = 0;
+	uint32_t     maxInflight = 0;
+	uint64_t     nsubmitted  = 0;
+	uint64_t     nreaped     = 0;
+};
 
 class AsyncIO {
+public:
+	/* IOs per AIO context when their number is picked automatically */
+	static const uint32_t CONTEXT_DEPTH = 512;
+
 private:
-	io_context_t   context_;
+	IOEngine       engine_;
+	std::vector<AIOContext> contexts_; /* AIO engine only */
+	uint32_t       nextSubmit_ = 0;    /* context for the next batch */
+	uint32_t       nextReap_   = 0;    /* context reaped first next time */
 	int            eventfd_;
-	uint16_t       capacity_;
+	uint32_t       capacity_;
 	bool           initialized_;
+	bool           ringUsable_ = false;
+	bool           ringReap_   = true;  /* unless setRingReap(false) */
+	bool           polling_    = false;
 
 	uint64_t       nsubmitted;
 	uint64_t       ncompleted;
@@ -26,13 +69,73 @@ private:
 	uint64_t       nreads;
 	uint64_t       nbytesRead;
 	uint64_t       nbytesWrote;
+	uint64_t       nsyscalls;   /* submit, eventfd and getevents calls */
+	uint64_t       nringReaped; /* completions reaped from the ring */
+	uint64_t       nbatches;    /* io_submit calls submitting IOs */
+	uint64_t       nbatched;    /* IOs submitted by them */
+	uint64_t       npartial;    /* io_submit calls submitting only some IOs */
+	uint64_t       neagain;     /* io_submit calls refused with EAGAIN */
 private:
 	NIOSCompleteCB niocbp_;
 	IOCompleteCB   iocbp_;
 	void           *cbdatap_;
 
+	/* completions of RAM and NULLIO engines, not yet reaped */
+	std::vector<struct io_event> done_;
+	shared_ptr<RamImage>         ram_;
+	std::vector<struct io_event> events_;
+
+	/* IO buffers for reuse, by size */
+	static const size_t MAX_FREE_BYTES = 64ull << 20;
+	std::unordered_map<size_t, std::vector<char *>> freeBuffers_;
+	size_t                       freeBytes_ = 0;
+
+	/* IOs prepared but not yet given to io_submit */
+	std::vector<struct iocb *>   queued_;
+	uint64_t                     queuedNs_   = 0; /* oldest queued IO */
+	uint32_t                     batch_      = 1;
+	uint64_t                     deadlineNs_ = 0;
+
+	/*
+	 * completion latency, indexed by [polling][read], and the slowest IOs.
+	 * Only complete() writes them, without a lock: reports on other threads
+	 * merge the histograms live and copy slow_ under the slowSeq_ seqlock.
+	 * A clearSlowIOs() bumps slowClears_ for complete() to act on.
+	 */
+	LatencyHistogram             latency_[2][2];
+	SlowIOs                      slow_;
+	std::atomic<uint64_t>        slowSeq_{0};
+	std::atomic<uint64_t>        slowClears_{0};
+	uint64_t                     slowCleared_ = 0;
+
+	/*
+	 * Watchdog: every IO in flight sits on a timer wheel, ticking every
+	 * watchTickNs_, due at its warning and then at its critical deadline.
+	 */
+	TimerWheel                   wheel_;
+	uint64_t                     watchTickNs_   = 0; /* 0 no watchdog */
+	uint64_t                     watchStartNs_  = 0;
+	uint64_t                     watchWarnNs_   = 0;
+	uint64_t                     watchCritNs_   = 0;
+	HungIOCB                     hungcbp_;
+	void                         *hungcbdatap_  = nullptr;
+	uint64_t                     nhungWarned_   = 0;
+	uint64_t                     nhungCritical_ = 0;
+
 private:
 	ssize_t ioResult(struct io_event *ep);
+	int memSubmit(struct iocb **iocbpp, int nios);
+	int ringReap(AIOContext &c, struct io_event *events, int max);
+	int contextsReap(struct io_event *events, int max);
+	bool ringEmpty();
+	int pickContext();
+	void reap(struct io_event *events, int nevents);
+	void complete(struct io_event *events, int nevents);
+	void submitted(struct iocb **iocbpp, int nios);
+	void queue(int fd, ManagedBuffer bufp, size_t size, uint64_t offset, IOType type);
+	void scheduleSubmit();
+	uint64_t watchTick(uint64_t ns) const;
+	static void hungExpired(void *cbdatap, TimerWheel::Entry *ep);
 
 public:
 	class EventFDHandler : public EventHandler {
@@ -54,19 +157,62 @@ public:
 		}
 	};
 
-	AsyncIO(uint16_t capcity);
+	AsyncIO(uint32_t capcity, IOEngine engine = IOEngine::AIO);
 	~AsyncIO();
 
+	/*
+	 * Spread IOs over n AIO contexts, batches go to them round robin and
+	 * completions are reaped from all of them. 0 picks one context per
+	 * CONTEXT_DEPTH IOs of capacity, the default. Set before init().
+	 */
+	void setContexts(uint32_t n);
+	/* RAM engine: read and write other's memory image rather than our own */
+	void shareRamImage(const AsyncIO &other) {
+		ram_ = other.ram_;
+	}
+
 	void init(EventBase *basep);
 	void registerCallback(IOCompleteCB iocb, NIOSCompleteCB niocb, void *cbdata);
+	/* reap completions from the mmapped ring when the kernel's layout is known */
+	void setRingReap(bool enable);
 	void iosCompleted();
-	void pwritePrepare(struct iocb *cbp, int fd, ManagedBuffer bufp, size_t size, uint64_t offset);
-	int  pwrite(struct iocb **iocbpp, int nwrites);
-	void preadPrepare(struct iocb *cbp, int fd, ManagedBuffer bufp, size_t size, uint64_t offset);
-	int  pread(struct iocb **iocbpp, int nwrites);
+
+	/*
+	 * Polling mode: IOs do not signal the eventfd and completions are only
+	 * reaped by poll(), which returns the number of IOs completed. Switch
+	 * only with no IOs in flight.
+	 */
+	void setPolling(bool polling);
+	int  poll();
+
+	/*
+	 * IOs are queued and handed to the kernel by submit() in batches of
+	 * setBatch() IOs, or earlier once the oldest queued IO waited deadlineUs
+	 * or nothing is in flight. IOs io_submit did not take (partial submit or
+	 * EAGAIN) stay queued and are retried. Queued IOs count as pending.
+	 */
+	void pwriteQueue(int fd, ManagedBuffer bufp, size_t size, uint64_t offset);
+	void preadQueue(int fd, ManagedBuffer bufp, size_t size, uint64_t offset);
+	void setBatch(uint32_t batch, uint64_t deadlineUs);
+	int  submit();
+	int  flush();
+	void submitExpired();
+	uint64_t getInflight() const;
 	ManagedBuffer getIOBuffer(size_t size);
+	/* return a buffer of getIOBuffer(size) for reuse */
+	void putIOBuffer(ManagedBuffer bufp, size_t size);
+	/* first address of every page of the buffers kept for reuse */
+	std::vector<void *> getFreeBufferPages() const;
 	uint64_t getPending();
 
+	IOEngine getEngine() const {
+		return engine_;
+	}
+
+	const std::vector<AIOContext> &getContexts() const {
+		return contexts_;
+	}
+
 	uint64_t getNWrites() const {
 		return nwrites ;
 	}
@@ -82,8 +228,124 @@ public:
 	uint64_t getBytesWrote() const {
 		return nbytesWrote;
 	}
+
+	uint64_t getNSyscalls() const {
+		return nsyscalls;
+	}
+
+	uint64_t getNRingReaped() const {
+		return nringReaped;
+	}
+
+	bool getRingReap() const {
+		return ringUsable_;
+	}
+
+	bool getPolling() const {
+		return polling_;
+	}
+
+	uint64_t getNBatches() const {
+		return nbatches;
+	}
+
+	double getAvgBatch() const {
+		return nbatches ? (double) nbatched / nbatches : 0.0;
+	}
+
+	uint64_t getNPartial() const {
+		return npartial;
+	}
+
+	uint64_t getNEagain() const {
+		return neagain;
+	}
+
+	/* add the latencies into h, from any thread */
+	void mergeLatency(LatencyHistogram &h, bool polling, bool read) const {
+		h.mergeLive(latency_[polling][read]);
+	}
+
+	/*
+	 * track the n slowest IOs completed since clearSlowIOs(), 0 none. Set
+	 * before init().
+	 */
+	void setSlowIOs(size_t n) {
+		slow_.setMax(n);
+	}
+
+	size_t getNSlowIOs() const {
+		return slow_.getMax();
+	}
+
+	/* slowest first, from any thread */
+	std::vector<SlowIO> getSlowIOs() const {
+		std::vector<SlowIO> v;
+		while (1) {
+			auto s1 = slowSeq_.load(std::memory_order_acquire);
+			if (s1 & 1) {
+				continue;
+			}
+			v = slow_.unsorted();
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slowSeq_.load(std::memory_order_relaxed) == s1) {
+				break;
+			}
+		}
+		SlowIOs::sort(v);
+		return v;
+	}
+
+	/* from any thread, takes effect on the next completion */
+	void clearSlowIOs() {
+		slowClears_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+	 * Report IOs in flight for longer than warnMs, and once more past critMs,
+	 * to cb from the event base's thread. Set before init().
+	 */
+	void setWatchdog(uint64_t warnMs, uint64_t critMs, HungIOCB cb, void *cbdata);
+	void watchdogExpired();
+
+	uint64_t getNHungWarned() const {
+		return nhungWarned_;
+	}
+
+	uint64_t getNHungCritical() const {
+		return nhungCritical_;
+	}
+
+	class SubmitTimeout : public AsyncTimeout {
+	private:
+		AsyncIO *asynciop_;
+	public:
+		SubmitTimeout(AsyncIO *asynciop, EventBase *basep) :
+				AsyncTimeout(basep), asynciop_(asynciop) {
+		}
+
+		void timeoutExpired() noexcept {
+			asynciop_->submitExpired();
+		}
+	};
+
+	class WatchdogTimeout : public AsyncTimeout {
+	private:
+		AsyncIO *asynciop_;
+	public:
+		WatchdogTimeout(AsyncIO *asynciop, EventBase *basep) :
+				AsyncTimeout(basep), asynciop_(asynciop) {
+		}
+
+		void timeoutExpired() noexcept {
+			asynciop_->watchdogExpired();
+		}
+	};
+
 private:
 	EventFDHandler *handlerp_;
+	unique_ptr<SubmitTimeout> submitTimeout_;
+	unique_ptr<WatchdogTimeout> watchdogTimeout_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,240 @@
+#ifndef __ACCESS_PATTERN_H__
+#define __ACCESS_PATTERN_H__
+
+#include <string>
+#include <cstdint>
+#include <cassert>
+#include <cmath>
+
+#include "zipf.h"
+
+using std::string;
+
+/* one generated I/O */
+struct io_desc {
+	uint64_t sector;
+	uint64_t nsectors;
+};
+
+/* access pattern selection and its parameters */
+struct pattern_config {
+	string   name           = "zipf";
+	double   zipf_theta     = 0.9;
+	double   pareto_h       = 0.2;
+	uint64_t stride         = 2048; /* in sectors */
+	double   hot_percent    = 10.0; /* percent of region that is hot */
+	double   hot_io_percent = 90.0; /* percent of IOs to the hot region */
+};
+
+/*
+ * Access patterns pick the start of each IO within [0, nitems). They are
+ * used as template arguments of pattern_io_generator, so next() and fill()
+ * are inlined into the generator's batch loop. fill() expects nsectors of
+ * every descriptor to be set already.
+ */
+class sequential_pattern {
+private:
+	uint64_t nitems;
+	uint64_t cursor;
+
+public:
+	sequential_pattern(const pattern_config &cfg, uint64_t nitems, uint32_t seed) :
+			nitems(nitems), cursor(0) {
+	}
+
+	inline uint64_t next(uint64_t nsectors) {
+		auto s  = cursor;
+		cursor += nsectors;
+		if (cursor >= nitems) {
+			cursor = 0;
+		}
+		return s;
+	}
+
+	void fill(io_desc *descs, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			descs[i].sector = next(descs[i].nsectors);
+		}
+	}
+};
+
+class strided_pattern {
+private:
+	uint64_t nitems;
+	uint64_t stride;
+	uint64_t cursor;
+	uint64_t start; /* start of current pass */
+	uint64_t first; /* nsectors of the first IO of current pass */
+
+public:
+	strided_pattern(const pattern_config &cfg, uint64_t nitems, uint32_t seed) :
+			nitems(nitems), stride(cfg.stride), cursor(0), start(0), first(0) {
+		assert(stride > 0);
+	}
+
+	inline uint64_t next(uint64_t nsectors) {
+		auto s  = cursor;
+		if (s == start) {
+			first = nsectors;
+		}
+		cursor += stride;
+		if (cursor >= nitems) {
+			/* next pass starts right after the first IO of this one */
+			start += first;
+			if (start >= stride || start >= nitems) {
+				start = 0;
+			}
+			cursor = start;
+		}
+		return s;
+	}
+
+	void fill(io_desc *descs, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			descs[i].sector = next(descs[i].nsectors);
+		}
+	}
+};
+
+class uniform_pattern {
+private:
+	uint64_t nitems;
+	crand    crand_;
+
+public:
+	uniform_pattern(const pattern_config &cfg, uint64_t nitems, uint32_t seed) :
+			nitems(nitems), crand_(seed) {
+	}
+
+	inline uint64_t next(uint64_t nsectors) {
+		return crand::bound(crand_.next(), nitems);
+	}
+
+	void fill(io_desc *descs, size_t n) {
+		uint64_t r[64];
+		while (n) {
+			auto c = n < 64 ? n : 64;
+			crand_.fill(r, c);
+			for (size_t i = 0; i < c; i++) {
+				descs[i].sector = crand::bound(r[i], nitems);
+			}
+			descs += c;
+			n     -= c;
+		}
+	}
+};
+
+class zipf_pattern {
+private:
+	zipf  z;
+	crand crand_;
+
+public:
+	zipf_pattern(const pattern_config &cfg, uint64_t nitems, uint32_t seed) :
+			z(cfg.zipf_theta, nitems, seed), crand_(seed) {
+	}
+
+	inline uint64_t next(uint64_t nsectors) {
+		return z.next();
+	}
+
+	void fill(io_desc *descs, size_t n) {
+		uint64_t r[64];
+		while (n) {
+			auto c = n < 64 ? n : 64;
+			crand_.fill(r, c);
+			for (size_t i = 0; i < c; i++) {
+				descs[i].sector = z.transform(crand::unit(r[i]));
+			}
+			descs += c;
+			n     -= c;
+		}
+	}
+};
+
+/* same as fio: h is the fraction of items getting (1 - h) of the IOs */
+class pareto_pattern {
+private:
+	const uint64_t GR_PRIME_64 = 0x9e37fffffffc0001ULL;
+	uint64_t nitems;
+	double   pareto_pow;
+	uint64_t rand_off;
+	crand    crand_;
+
+public:
+	pareto_pattern(const pattern_config &cfg, uint64_t nitems, uint32_t seed) :
+			nitems(nitems), crand_(seed) {
+		assert(cfg.pareto_h > 0.0 && cfg.pareto_h < 1.0);
+		pareto_pow = log(cfg.pareto_h) / log(1.0 - cfg.pareto_h);
+		rand_off   = crand_.next();
+	}
+
+	inline uint64_t transform(uint64_t r) const {
+		auto val = (uint64_t) ((nitems - 1) * pow(crand::unit(r), pareto_pow));
+		return (val * GR_PRIME_64 + rand_off) % nitems;
+	}
+
+	inline uint64_t next(uint64_t nsectors) {
+		return transform(crand_.next());
+	}
+
+	void fill(io_desc *descs, size_t n) {
+		uint64_t r[64];
+		while (n) {
+			auto c = n < 64 ? n : 64;
+			crand_.fill(r, c);
+			for (size_t i = 0; i < c; i++) {
+				descs[i].sector = transform(r[i]);
+			}
+			descs += c;
+			n     -= c;
+		}
+	}
+};
+
+/* uniform within a hot zone at the start of the region and the cold rest */
+class hotcold_pattern {
+private:
+	uint64_t hot;       /* number of hot items */
+	uint64_t cold;      /* number of cold items */
+	uint64_t threshold; /* IO goes to hot zone if random < threshold */
+	crand    crand_;
+
+public:
+	hotcold_pattern(const pattern_config &cfg, uint64_t nitems, uint32_t seed) :
+			crand_(seed) {
+		assert(cfg.hot_percent > 0 && cfg.hot_percent < 100);
+		assert(cfg.hot_io_percent >= 0 && cfg.hot_io_percent <= 100);
+		hot       = (uint64_t) (nitems * cfg.hot_percent / 100);
+		hot       = hot ? hot : 1;
+		cold      = nitems - hot;
+		threshold = (uint64_t) ((1ull << 32) * cfg.hot_io_percent / 100);
+	}
+
+	inline uint64_t transform(uint64_t r) const {
+		/* low half chooses the zone, high half the item */
+		if ((r & 0xffffffffull) < threshold) {
+			return crand::bound(r, hot);
+		}
+		return hot + crand::bound(r, cold);
+	}
+
+	inline uint64_t next(uint64_t nsectors) {
+		return transform(crand_.next());
+	}
+
+	void fill(io_desc *descs, size_t n) {
+		uint64_t r[64];
+		while (n) {
+			auto c = n < 64 ? n : 64;
+			crand_.fill(r, c);
+			for (size_t i = 0; i < c; i++) {
+				descs[i].sector = transform(r[i]);
+			}
+			descs += c;
+			n     -= c;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,464 @@
+/*
+ * Microbenchmarks for the IO generation and verification hot paths.
+ *
+ * make bench && ./bench [--json] [--large] [name-filter]
+ *
+ * --json prints results in google benchmark's JSON format, benchmark names
+ * and their order are kept stable so results of releases can be compared.
+ * --large adds expected state maps of 100M fragments (needs ~16GB).
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <time.h>
+
+#include "io_generator.h"
+#include "disk_io.h"
+#include "block_trace.h"
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::cout;
+using std::endl;
+
+using BenchFN = std::function<void(uint64_t iters)>;
+
+struct Bench {
+	string   name;
+	uint64_t items; /* items processed per iteration */
+	BenchFN  fn;
+	std::function<void()> setup    = nullptr; /* before the first run */
+	std::function<void()> teardown = nullptr; /* after the last run */
+	std::function<void()> reset    = nullptr; /* untimed, before every run */
+};
+
+struct BenchResult {
+	string   name;
+	uint64_t iters;
+	double   ns;    /* per iteration */
+	double   cpuNs; /* process CPU time per iteration */
+	double   items; /* per second */
+};
+
+template <typename T>
+static inline void doNotOptimize(T const &v) {
+	asm volatile("" : : "r,m"(v) : "memory");
+}
+
+static const uint64_t BENCH_SECTORS = 1ull << 31; /* 1 TiB */
+
+static inline uint64_t sectorBytes(uint64_t sectors) {
+	return sectors << io_generator::SECTOR_SHIFT;
+}
+
+static vector<pair<uint32_t, double>> benchSizes() {
+	vector<pair<uint32_t, double>> sizes = {{8, 40}, {16, 40}};
+
+	/* remainder spread over all sizes like --blocksize_remainder=uniform */
+	for (uint32_t ns = 1; ns <= io_generator::MAX_SECTORS; ns++) {
+		sizes.push_back(std::make_pair(ns, 20.0 / io_generator::MAX_SECTORS));
+	}
+	return sizes;
+}
+
+static void benchNextIO(uint64_t iters, const string &name) {
+	pattern_config cfg;
+	cfg.name = name;
+
+	auto sizes = benchSizes();
+	auto gen   = make_io_generator(0, BENCH_SECTORS, sizes, cfg);
+	uint64_t s;
+	uint64_t ns;
+
+	while (iters--) {
+		gen->next_io(&s, &ns);
+		doNotOptimize(s);
+		doNotOptimize(ns);
+	}
+}
+
+static const size_t BATCH = 64;
+
+static void benchNextIOs(uint64_t iters, const string &name) {
+	pattern_config cfg;
+	cfg.name = name;
+
+	auto sizes = benchSizes();
+	auto gen   = make_io_generator(0, BENCH_SECTORS, sizes, cfg);
+	io_desc descs[BATCH];
+
+	while (iters--) {
+		gen->next_ios(descs, BATCH);
+		doNotOptimize(descs);
+	}
+}
+
+static void benchZipfNext(uint64_t iters) {
+	zipf z(0.9, BENCH_SECTORS, 1);
+	while (iters--) {
+		doNotOptimize(z.next());
+	}
+}
+
+static void benchZipfFill(uint64_t iters) {
+	zipf z(0.9, BENCH_SECTORS, 1);
+	uint64_t vals[BATCH];
+	while (iters--) {
+		z.fill(vals, BATCH);
+		doNotOptimize(vals);
+	}
+}
+
+static void benchUniformFill(uint64_t iters) {
+	uniform u(1, 1, 2048);
+	uint64_t vals[BATCH];
+	while (iters--) {
+		u.fill(vals, BATCH);
+		doNotOptimize(vals);
+	}
+}
+
+/* expected state map of nfragments 8 sector fragments, 8 sectors apart */
+class DiskBench : public disk {
+public:
+	static const uint64_t FRAGMENT_NSECTORS = 8;
+	static const uint64_t FRAGMENT_STRIDE   = 16;
+
+	static const size_t   QUEUE_BATCH       = 32;
+
+	uint64_t nfragments_;
+
+	/* with nthreads, the map is sharded as for submitter threads */
+	DiskBench(uint64_t nfragments, uint32_t nthreads = 0) :
+			disk("null", 100, benchSizes(), 32, 0, pattern_config(),
+				sectorBytes(nfragments * FRAGMENT_STRIDE + io_generator::MAX_SECTORS)),
+			nfragments_(nfragments) {
+		setSubmitThreads(nthreads);
+		for (uint64_t i = 0; i < nfragments; i++) {
+			fragmentWrite(i * FRAGMENT_STRIDE, FRAGMENT_NSECTORS);
+		}
+	}
+
+	void fragmentWrite(uint64_t s, uint16_t ns) {
+		string p;
+		patternCreate(s, ns, p);
+		writeDone(s, ns, p, 0);
+	}
+
+	/* random 8 sector overwrites, splitting existing fragments */
+	void benchWriteDone(uint64_t iters) {
+		crand r(1);
+		auto  n = nfragments_ * FRAGMENT_STRIDE;
+		while (iters--) {
+			fragmentWrite(crand::bound(r.next(), n), FRAGMENT_NSECTORS);
+		}
+	}
+
+	/*
+	 * What a submitter thread does with the map per completion batch: the
+	 * writes of a batch of random 8 sector overwrites, then the snapshots of
+	 * a batch of reads.
+	 */
+	void queueBatches(uint64_t iters, uint32_t id) {
+		crand r(id + 1);
+		auto  n = nfragments_ * FRAGMENT_STRIDE;
+
+		/* only told apart by their address */
+		vector<ManagedBuffer> bufs;
+		for (size_t i = 0; i < QUEUE_BATCH; i++) {
+			bufs.emplace_back(static_cast<char *>(malloc(1)), free);
+		}
+		vector<range>      ios(QUEUE_BATCH, range(0, FRAGMENT_NSECTORS));
+		vector<vector<IO>> expected(QUEUE_BATCH);
+		while (iters--) {
+			for (size_t i = 0; i < QUEUE_BATCH; i++) {
+				ios[i].sector = crand::bound(r.next(), n);
+				queueWriteSubmitted(ios[i].sector, FRAGMENT_NSECTORS, bufs[i].get());
+			}
+			queueWritesDone(ios, bufs);
+
+			for (size_t i = 0; i < QUEUE_BATCH; i++) {
+				ios[i].sector = crand::bound(r.next(), n);
+				queueReadSubmitted(ios[i].sector, FRAGMENT_NSECTORS, bufs[i].get());
+			}
+			queueSnapshots(ios, bufs, expected);
+			for (auto &e : expected) {
+				e.clear();
+			}
+		}
+	}
+
+	/* queueBatches() on nthreads threads at once */
+	void benchQueues(uint64_t iters, uint32_t nthreads) {
+		vector<std::thread> threads;
+		for (uint32_t t = 0; t < nthreads; t++) {
+			threads.emplace_back([this, iters, t] () {
+				queueBatches(iters, t);
+			});
+		}
+		for (auto &t : threads) {
+			t.join();
+		}
+	}
+
+	/* read back nsectors starting at fragment f, as a disk would return them */
+	ManagedBuffer readBuffer(uint64_t f, uint16_t nsectors) {
+		auto bufp = getIOBuffer(sectorBytes(nsectors));
+		std::memset(bufp.get(), 0, sectorBytes(nsectors));
+		for (uint16_t i = 0; i < nsectors; i += FRAGMENT_STRIDE) {
+			string p;
+			auto s = (f * FRAGMENT_STRIDE) + i;
+			patternCreate(s, FRAGMENT_NSECTORS, p);
+			auto fp = prepareIOBuffer(sectorBytes(FRAGMENT_NSECTORS), p);
+			std::memcpy(bufp.get() + sectorBytes(i), fp.get(),
+				sectorBytes(FRAGMENT_NSECTORS));
+		}
+		return bufp;
+	}
+
+	/* read of nsectors spanning nsectors / 16 fragments with gaps between */
+	void benchReadDataVerify(uint64_t iters, uint16_t nsectors) {
+		auto f    = nfragments_ / 2;
+		auto bufp = readBuffer(f, nsectors);
+		while (iters--) {
+			readDataVerify(bufp.get(), f * FRAGMENT_STRIDE, nsectors);
+		}
+	}
+
+	/* read of nsectors written by a single IO */
+	void benchReadDataVerifyOne(uint64_t iters, uint16_t nsectors) {
+		string p;
+		patternCreate(0, nsectors, p);
+		writeDone(0, nsectors, p, 0);
+
+		auto bufp = prepareIOBuffer(sectorBytes(nsectors), p);
+		while (iters--) {
+			readDataVerify(bufp.get(), 0, nsectors);
+		}
+	}
+
+	void benchPatternCompare(uint64_t iters, uint16_t nsectors) {
+		string p;
+		patternCreate(12345678, nsectors, p);
+
+		auto size = sectorBytes(nsectors);
+		auto bufp = prepareIOBuffer(size, p);
+		while (iters--) {
+			doNotOptimize(patternCompare(12345678, nsectors, bufp.get(), size, p, 0));
+		}
+	}
+
+	void benchPrepareIOBuffer(uint64_t iters, uint16_t nsectors) {
+		string p;
+		patternCreate(12345678, nsectors, p);
+
+		auto size = sectorBytes(nsectors);
+		while (iters--) {
+			auto bufp = prepareIOBuffer(size, p);
+			doNotOptimize(bufp.get()[size - 1]);
+		}
+	}
+};
+
+static void benchTraceLog(uint64_t iters) {
+	const string path = "/tmp/dv_bench_trace.dat";
+	{
+		TraceLog log(path);
+		for (uint64_t i = 0; i < iters; i++) {
+			log.addTraceLog(i << 3, 8, i & 1);
+		}
+	}
+	unlink(path.c_str());
+}
+
+static vector<Bench> diskBenchmarks(bool large) {
+	vector<Bench> benchmarks;
+
+	/* map independent benchmarks share one small map */
+	auto dp = std::make_shared<std::unique_ptr<DiskBench>>();
+	auto setup = [dp] () {
+		*dp = std::make_unique<DiskBench>(1000);
+	};
+	auto teardown = [dp] () {
+		dp->reset();
+	};
+	for (uint16_t ns : {8, 256, 2048}) {
+		auto sz = std::to_string(sectorBytes(ns) >> 10) + "K";
+		benchmarks.push_back({"disk/prepareIOBuffer/" + sz, sectorBytes(ns),
+			[dp, ns] (uint64_t iters) { (*dp)->benchPrepareIOBuffer(iters, ns); },
+			setup, teardown});
+		benchmarks.push_back({"disk/patternCompare/" + sz, sectorBytes(ns),
+			[dp, ns] (uint64_t iters) { (*dp)->benchPatternCompare(iters, ns); },
+			setup, teardown});
+		benchmarks.push_back({"disk/readDataVerify/single/" + sz, sectorBytes(ns),
+			[dp, ns] (uint64_t iters) { (*dp)->benchReadDataVerifyOne(iters, ns); },
+			setup, teardown});
+	}
+
+	vector<uint64_t> nfragments = {1000, 100000, 10000000};
+	if (large) {
+		nfragments.push_back(100000000);
+	}
+	for (auto n : nfragments) {
+		auto mp = std::make_shared<std::unique_ptr<DiskBench>>();
+		auto setup = [mp, n] () {
+			*mp = std::make_unique<DiskBench>(n);
+		};
+		auto teardown = [mp] () {
+			mp->reset();
+		};
+
+		auto sn = std::to_string(n);
+		/* writeDone() changes the map it is measured on, every run gets a new one */
+		benchmarks.push_back({"disk/writeDone/" + sn, 1,
+			[mp] (uint64_t iters) { (*mp)->benchWriteDone(iters); },
+			nullptr, teardown, setup});
+		benchmarks.push_back({"disk/readDataVerify/fragmented/" + sn + "/128K",
+			sectorBytes(256),
+			[mp] (uint64_t iters) { (*mp)->benchReadDataVerify(iters, 256); },
+			setup, teardown});
+	}
+
+	benchmarks.push_back({"trace_log/addTraceLog", 1, benchTraceLog});
+
+	/* map updates of submitter threads, items are IOs of all threads */
+	for (uint32_t n : {1, 2, 4, 8}) {
+		auto mp = std::make_shared<std::unique_ptr<DiskBench>>();
+		auto setup = [mp, n] () {
+			*mp = std::make_unique<DiskBench>(100000, n);
+		};
+		auto teardown = [mp] () {
+			mp->reset();
+		};
+		benchmarks.push_back({"queue/writesDone+snapshots/threads/" +
+			std::to_string(n), 2 * DiskBench::QUEUE_BATCH * n,
+			[mp, n] (uint64_t iters) { (*mp)->benchQueues(iters, n); },
+			nullptr, teardown, setup});
+	}
+	return benchmarks;
+}
+
+static double cpuSecs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static BenchResult benchRun(const Bench &b) {
+	using namespace std::chrono;
+
+	uint64_t iters = 1;
+	double   secs;
+	double   cpu;
+	while (1) {
+		if (b.reset) {
+			b.reset();
+		}
+		auto t0 = steady_clock::now();
+		auto c0 = cpuSecs();
+		b.fn(iters);
+		cpu  = cpuSecs() - c0;
+		secs = duration<double>(steady_clock::now() - t0).count();
+		if (secs >= 0.5 || iters >= (1ull << 32)) {
+			break;
+		}
+		iters *= secs < 0.05 ? 10 : 2;
+	}
+
+	return {b.name, iters, secs * 1e9 / iters, cpu * 1e9 / iters,
+		b.items * iters / secs};
+}
+
+static void printJSON(const vector<BenchResult> &results) {
+	printf("{\n");
+	printf("  \"context\": {\n");
+	printf("    \"executable\": \"bench\",\n");
+	printf("    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+	printf("    \"library_build_type\": \"release\"\n");
+	printf("  },\n");
+	printf("  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		auto &r = results[i];
+		printf("    {\n");
+		printf("      \"name\": \"%s\",\n", r.name.c_str());
+		printf("      \"run_type\": \"iteration\",\n");
+		printf("      \"iterations\": %lu,\n", r.iters);
+		printf("      \"real_time\": %.3f,\n", r.ns);
+		printf("      \"cpu_time\": %.3f,\n", r.cpuNs);
+		printf("      \"time_unit\": \"ns\",\n");
+		printf("      \"items_per_second\": %.0f\n", r.items);
+		printf("    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n");
+	printf("}\n");
+}
+
+int main(int argc, char *argv[]) {
+	vector<Bench> benchmarks = {
+		{"zipf/next",             1,     benchZipfNext},
+		{"zipf/fill",             BATCH, benchZipfFill},
+		{"uniform/fill",          BATCH, benchUniformFill},
+	};
+
+	for (auto p : {"zipf", "uniform", "sequential", "strided", "pareto", "hotcold"}) {
+		string name(p);
+		benchmarks.push_back({"io_generator/next_io/" + name, 1,
+			[name] (uint64_t iters) { benchNextIO(iters, name); }});
+		benchmarks.push_back({"io_generator/next_ios/" + name, BATCH,
+			[name] (uint64_t iters) { benchNextIOs(iters, name); }});
+	}
+
+	string filter;
+	bool   json  = false;
+	bool   large = false;
+	for (int i = 1; i < argc; i++) {
+		string a(argv[i]);
+		if (a == "--json") {
+			json = true;
+		} else if (a == "--large") {
+			large = true;
+		} else {
+			filter = a;
+		}
+	}
+
+	auto db = diskBenchmarks(large);
+	benchmarks.insert(benchmarks.end(), db.begin(), db.end());
+
+	vector<BenchResult> results;
+	for (auto &b : benchmarks) {
+		if (b.name.find(filter) == string::npos) {
+			continue;
+		}
+		if (b.setup) {
+			b.setup();
+		}
+		auto r = benchRun(b);
+		if (b.teardown) {
+			b.teardown();
+		}
+
+		results.push_back(r);
+		if (!json) {
+			printf("%-48s %12lu iters %12.1f ns/iter %14.0f items/s\n",
+				r.name.c_str(), r.iters, r.ns, r.items);
+		}
+	}
+
+	if (json) {
+		printJSON(results);
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+#include <map>
+#include <stdexcept>
+
+#include "corruption_report.h"
+#include "io_generator.h"
+#include "latency.h"
+
+CorruptionReporter::CorruptionReporter(const string &path) :
+			log_(path, std::ios::out | std::ios::app), startNs_(monotonicNs()) {
+	if (!log_.is_open()) {
+		throw std::runtime_error("Could not open corruption report " + path);
+	}
+	thread_ = std::thread([this] () {
+		reporterLoop();
+	});
+}
+
+CorruptionReporter::~CorruptionReporter() {
+	{
+		std::lock_guard<std::mutex> l(lock_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	thread_.join();
+}
+
+void CorruptionReporter::report(CorruptionEvent &&e) {
+	{
+		std::lock_guard<std::mutex> l(lock_);
+		if (queuedBytes_ + e.data.size() > MAX_QUEUED_BYTES) {
+			ndropped_++;
+			return;
+		}
+		e.ns          = monotonicNs();
+		queuedBytes_ += e.data.size();
+		queue_.push_back(std::move(e));
+	}
+	cv_.notify_all();
+}
+
+void CorruptionReporter::flush() {
+	std::unique_lock<std::mutex> l(lock_);
+	cv_.wait(l, [this] () {
+		return queue_.empty() && !busy_;
+	});
+}
+
+void CorruptionReporter::reporterLoop() {
+	std::unique_lock<std::mutex> l(lock_);
+	while (1) {
+		cv_.wait(l, [this] () {
+			return stop_ || !queue_.empty();
+		});
+		if (queue_.empty()) {
+			/* stop_, everything reported */
+			break;
+		}
+
+		auto e = std::move(queue_.front());
+		queue_.pop_front();
+		queuedBytes_ -= e.data.size();
+		busy_         = true;
+
+		l.unlock();
+		analyse(e);
+		l.lock();
+
+		busy_ = false;
+		cv_.notify_all();
+	}
+}
+
+void CorruptionReporter::analyse(const CorruptionEvent &e) {
+	auto extents = disk::corruptExtents(e.data.data(), e.sector, e.nsectors,
+		e.expected);
+	if (extents.empty()) {
+		/* only the verifier saw a difference, report the part as a whole */
+		extents.emplace_back(e.sector, e.nsectors);
+	}
+	for (auto &x : extents) {
+		analyseExtent(e, x);
+	}
+}
+
+void CorruptionReporter::analyseExtent(const CorruptionEvent &e, const range &r) {
+	const size_t SECTOR = 1ull << io_generator::SECTOR_SHIFT;
+
+	uint64_t counts[(int) SectorState::MAX] = {};
+	uint64_t first = 0;
+	uint64_t last  = 0;
+	bool     bad   = false;
+
+	/* writes whose pattern was found, by sectors holding it */
+	std::map<pair<uint64_t, uint32_t>, uint64_t> found;
+	auto x = e.expected.begin();
+	for (auto s = r.start_sector(); s <= r.end_sector(); s++) {
+		auto i = s - e.sector;
+		while (x != e.expected.end() && x->r.end_sector() < s) {
+			x++;
+		}
+		if (x == e.expected.end() || x->r.start_sector() > s || x->pattern.empty()) {
+			/* nothing expected */
+			continue;
+		}
+
+		auto     ps  = ((s - x->r.start_sector()) * SECTOR + x->pattern_start) %
+			x->pattern.length();
+		uint64_t fs  = 0;
+		uint32_t fns = 0;
+		auto st = disk::sectorClassify(e.data.data() + i * SECTOR,
+			s, x->pattern, ps, &fs, &fns);
+		counts[(int) st]++;
+		if (st == SectorState::MATCH) {
+			continue;
+		}
+		if (!bad) {
+			first = s;
+		}
+		last = s;
+		bad  = true;
+		if (st == SectorState::STALE || st == SectorState::MISDIRECTED) {
+			found[std::make_pair(fs, fns)]++;
+		}
+	}
+
+	log_ << "CORRUPTION t=" << (e.ns - startNs_) / 1000000 << "ms sector " <<
+		r.sector << " nsectors " << r.nsectors << " expected ";
+	auto sep = "";
+	for (auto &io : e.expected) {
+		if (io.r.end_sector() < r.start_sector() ||
+				io.r.start_sector() > r.end_sector()) {
+			continue;
+		}
+		log_ << sep << io.pattern;
+		sep = ",";
+	}
+	if (bad) {
+		log_ << " bad " << first << "-" << last;
+	}
+	for (int i = 0; i < (int) SectorState::MAX; i++) {
+		if (counts[i]) {
+			log_ << " " << sectorStateName((SectorState) i) << "=" << counts[i];
+		}
+	}
+	for (auto &f : found) {
+		string p;
+		disk::patternCreate(f.first.first, f.first.second, p);
+		log_ << " found " << p << "x" << f.second;
+	}
+	log_ << std::endl;
+	for (auto &slow : e.slow) {
+		log_ << "  slow " << disk::slowIOString(slow, startNs_) << std::endl;
+	}
+
+	std::lock_guard<std::mutex> l(lock_);
+	nevents_++;
+	for (int i = 0; i < (int) SectorState::MAX; i++) {
+		sectors_[i] += counts[i];
+	}
+}
+
+uint64_t CorruptionReporter::getNEvents() const {
+	std::lock_guard<std::mutex> l(lock_);
+	return nevents_;
+}
+
+uint64_t CorruptionReporter::getNDropped() const {
+	std::lock_guard<std::mutex> l(lock_);
+	return ndropped_;
+}
+
+uint64_t CorruptionReporter::getNSectors(SectorState state) const {
+	std::lock_guard<std::mutex> l(lock_);
+	return sectors_[(int) state];
+}
@@ -0,0 +1,76 @@
+#ifndef __CORRUPTION_REPORT_H__
+#define __CORRUPTION_REPORT_H__
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <condition_variable>
+
+#include "disk_io.h"
+
+using std::string;
+
+/* a corrupt part of a read, with what the verifier expected in it */
+struct CorruptionEvent {
+	uint64_t   sector;
+	uint16_t   nsectors;
+	vector<IO> expected; /* ranges covering the part, in sector order */
+	string     data;     /* read data of the part */
+	uint64_t ns = 0;   /* monotonicNs() when found */
+	vector<SlowIO> slow; /* slowest IOs of the report interval */
+};
+
+/*
+ * Analyses corruptions off the IO thread. The IO thread only copies the
+ * corrupt part of a read and queues it; the reporter classifies every sector
+ * of it (stale, misdirected, torn or garbage), splits it into extents of
+ * adjacent bad sectors, decodes which write's pattern was actually found and
+ * appends a line per extent to the report file.
+ *
+ * Events beyond MAX_QUEUED_BYTES of unreported data are counted and dropped
+ * rather than slow down the IO thread.
+ */
+class CorruptionReporter {
+private:
+	static const size_t MAX_QUEUED_BYTES = 64ull << 20;
+
+	std::ofstream               log_;
+	uint64_t                    startNs_;
+
+	mutable std::mutex          lock_;
+	std::condition_variable     cv_;
+	std::deque<CorruptionEvent> queue_;
+	size_t                      queuedBytes_ = 0;
+	bool                        busy_        = false;
+	bool                        stop_        = false;
+
+	/* updated under lock_ */
+	uint64_t nevents_  = 0;
+	uint64_t ndropped_ = 0;
+	uint64_t sectors_[(int) SectorState::MAX] = {};
+
+	std::thread thread_;
+
+private:
+	void reporterLoop();
+	void analyse(const CorruptionEvent &e);
+	void analyseExtent(const CorruptionEvent &e, const range &x);
+
+public:
+	CorruptionReporter(const string &path);
+	~CorruptionReporter();
+
+	/* called from the IO thread, never blocks on the report file */
+	void report(CorruptionEvent &&e);
+	/* wait until every queued event is reported */
+	void flush();
+
+	uint64_t getNEvents() const;
+	uint64_t getNDropped() const;
+	uint64_t getNSectors(SectorState state) const;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <string>
 #include <memory>
 #include <future>
+#include <sstream>
 #include <set>
 #include <vector>
 #include <atomic>
@@ -27,6 +28,11 @@
 #include <folly/io/async/AsyncTimeout.h>
 
 #include "disk_io.h"
+#include "verify_pool.h"
+#include "topology.h"
+#include "corruption_report.h"
+#include "live_stats.h"
+#include "submit_queue.h"
 
 using std::string;
 using std::unique_ptr;
@@ -46,6 +52,8 @@ static inline uint64_t bytes_to_sector(uint64_t bytes) {
 	return bytes >> 9;
 }
 
+static const uint64_t MAX_IO_SECTORS = bytes_to_sector(1ull << 20);
+
 IO::IO(uint64_t sect, uint32_t nsec, const string &pattern, int16_t pattern_start):
 			r(sect, nsec) {
 	this->pattern       = pattern;
@@ -60,22 +68,69 @@ uint64_t IO::offset() {
 	return sector_to_byte(r.sector);
 }
 
-disk::disk(string path, uint16_t percent, vector<pair<uint32_t, uint8_t>> sizes,
-			uint16_t iodepth, uint64_t runtime) :
-				asyncio(iodepth), path_(path), percent_(percent), iodepth_(iodepth),
-				runtime_(runtime), modeSwitched_(false), fd(-1),
-				trace_("/tmp/log.dat") {
+/* "ram" and "null" are memory engines, anything else is a device or file */
+static IOEngine pathEngine(const string &path) {
+	if (path == "ram") {
+		return IOEngine::RAM;
+	} else if (path == "null") {
+		return IOEngine::NULLIO;
+	}
+	return IOEngine::AIO;
+}
+
+disk::disk(string path, uint16_t percent, const vector<pair<uint32_t, double>> &sizes,
+			uint32_t iodepth, uint64_t runtime, const pattern_config &pattern,
+			uint64_t size) :
+				asyncio(iodepth, pathEngine(path)), path_(path), percent_(percent),
+				iodepth_(iodepth), runtime_(runtime), modeSwitched_(false), fd(-1),
+				sizes_(sizes), pattern_(pattern), trace_("/tmp/log.dat") {
+	uint64_t sz = size;
+	if (asyncio.getEngine() == IOEngine::AIO) {
+		sz = openDevice(path, size);
+	} else if (sz == 0) {
+		throw runtime_error("size is required for " + path + " engine");
+	}
+
+	if (bytes_to_sector(sz) == 0) {
+		throw runtime_error(path + " is too small");
+	}
+
+	this->size     = sz;
+	this->sectors_ = bytes_to_sector(sz);
+	auto ns        = this->sectors_ * percent / 100;
+	this->iogen    = make_io_generator(0, ns, sizes, pattern);
+	inflight_      = std::make_unique<InflightRanges>(sectors_);
+	shards_.push_back(std::make_unique<MapShard>());
+}
+
+/*
+ * Open a block device or a regular file, a missing file is created and a
+ * file smaller than size is extended with fallocate. Returns usable size.
+ */
+uint64_t disk::openDevice(const string &path, uint64_t size) {
 	fd = open(path.c_str(), O_RDWR | O_DIRECT);
+	if (fd < 0 && errno == ENOENT && size) {
+		fd = open(path.c_str(), O_RDWR | O_DIRECT | O_CREAT, 0644);
+	}
 	if (fd < 0) {
 		throw runtime_error("Could not open file " + path);
 	}
 
 	struct stat sb;
 	auto rc = fstat(fd, &sb);
-	if (rc < 0 || !S_ISBLK(sb.st_mode)) {\
-		throw runtime_error(path + " is not a block device.");
+	if (rc < 0 || !(S_ISBLK(sb.st_mode) || S_ISREG(sb.st_mode))) {
+		throw runtime_error(path + " is not a block device or regular file.");
+	}
+
+	if (S_ISREG(sb.st_mode)) {
+		if (size > (uint64_t) sb.st_size) {
+			rc = fallocate(fd, 0, 0, size);
+			if (rc < 0) {
+				throw runtime_error("unable to fallocate " + path);
+			}
+		}
+		return size ? size : sb.st_size;
 	}
-	assert(rc >= 0 && S_ISBLK(sb.st_mode));
 
 	uint64_t sz;
 	rc = ioctl(fd, BLKGETSIZE64, &sz);
@@ -83,14 +138,12 @@ disk::disk(string path, uint16_t percent, vector<pair<uint32_t, uint8_t>> sizes,
 		throw runtime_error("unable to find size of device " + path);
 	}
 	assert(sz != 0);
-
-	this->size     = sz;
-	this->sectors_ = bytes_to_sector(sz);
-	auto ns        = this->sectors_ * percent / 100;
-	this->iogen    = std::make_unique<io_generator>(0, ns, sizes);
+	return size && size < sz ? size : sz;
 }
 
 disk::~disk() {
+	/* queues use fd and the memory image */
+	queues_.clear();
 	if (this->fd > 0) {
 		close(this->fd);
 	}
@@ -100,13 +153,13 @@ void disk::patternCreate(uint64_t sect, uint16_t nsec, string &pattern) {
 	pattern = "<" + std::to_string(sect) + "," + std::to_string(nsec) + ">";
 }
 
-ManagedBuffer disk::prepareIOBuffer(size_t size, const string &pattern) {
-	auto bufp = asyncio.getIOBuffer(size);
-	assert(bufp);
-
-	char *bp = bufp.get();
+bool disk::patternDecode(const string &pattern, uint64_t &sect, uint32_t &nsec) {
+	char c;
+	auto rc = sscanf(pattern.c_str(), "<%lu,%u%c", &sect, &nsec, &c);
+	return rc == 3 && c == '>';
+}
 
-	/* fill pattern in the buffer */
+void disk::patternFill(char *bp, size_t size, const string &pattern) {
 	const char *const p = pattern.c_str();
 	auto len = pattern.length();
 	auto i   = size / len;
@@ -118,6 +171,14 @@ ManagedBuffer disk::prepareIOBuffer(size_t size, const string &pattern) {
 
 	i = size - ((size/len) * len);
 	std::memcpy(bp, p, i);
+}
+
+ManagedBuffer disk::prepareIOBuffer(size_t size, const string &pattern) {
+	auto bufp = asyncio.getIOBuffer(size);
+	assert(bufp);
+
+	/* fill pattern in the buffer */
+	patternFill(bufp.get(), size, pattern);
 	return std::move(bufp);
 }
 
@@ -125,53 +186,38 @@ ManagedBuffer disk::getIOBuffer(size_t size) {
 	return asyncio.getIOBuffer(size);
 }
 
-void disk::addWriteIORange(uint64_t sector, uint16_t nsectors) {
-	range nr(sector, nsectors);
-	bool  c = true;
-
-	for (auto &it : writeIOsSubmitted) {
-		if (nr < it.first || it.first < nr) {
-			/* not equal */
-			continue;
-		}
-		c         = false;
-		it.second = false;
-	}
+void disk::addWriteIORange(uint64_t sector, uint16_t nsectors, const void *io) {
+	inflight_->add(range(sector, nsectors), io);
+}
 
-	pair<range, bool> p(nr, c);
-	writeIOsSubmitted.push_back(p);
+pair<range, bool> disk::removeWriteIORange(uint64_t sector, uint16_t nsectors,
+		const void *io) {
+	return inflight_->remove(range(sector, nsectors), io);
 }
 
-pair<range, bool> disk::removeWriteIORange(uint64_t sector, uint16_t nsectors) {
-	range             nr(sector, nsectors);
-	pair<range, bool> res;
-	bool              found = false;
+void disk::addReadIORange(uint64_t sector, uint16_t nsectors, const void *io) {
+	inflight_->addRead(range(sector, nsectors), io);
+}
 
-	auto it = writeIOsSubmitted.begin();
-	while (it != writeIOsSubmitted.end()) {
-		if (it->first.sector == sector && it->first.nsectors == nsectors) {
-			res = *it;
-			writeIOsSubmitted.erase(it);
-			found = true;
-			break;
-		}
-		it++;
-	}
-	assert(found == true);
-	return res;
+pair<range, bool> disk::removeReadIORange(uint64_t sector, uint16_t nsectors,
+		const void *io) {
+	return inflight_->removeRead(range(sector, nsectors), io);
 }
 
 int disk::writesSubmit(uint64_t nwrites) {
-	struct iocb *ios[nwrites];
-	struct iocb cbs[nwrites];
-	struct iocb *cbp;
+	io_desc     descs[nwrites];
 	uint64_t    s;
 	uint64_t    ns;
 	size_t      sz;
 	uint64_t    o;
 
+	vector<HeldWrite> held;
+
+	markStateDirty();
+	iogen->next_ios(descs, nwrites);
 	for (auto i = 0; i < nwrites; i++) {
-		iogen->next_io(&s, &ns);
+		s  = descs[i].sector;
+		ns = descs[i].nsectors;
 		assert(ns >= 1 && s <= sectors_ && s+ns <= sectors_);
 
 		// cout << "W " << s << " " << ns << endl;
@@ -182,73 +228,267 @@ int disk::writesSubmit(uint64_t nwrites) {
 		sz        = sector_to_byte(ns);
 		o         = sector_to_byte(s);
 		auto bufp = prepareIOBuffer(sz, p);
-		cbp       = &cbs[i];
-		ios[i]    = cbp;
-		asyncio.pwritePrepare(cbp, fd, std::move(bufp), sz, o);
-		addWriteIORange(s, ns);
 		trace_.addTraceLog(s, ns, false);
+		if (journal_) {
+			journal_->append(s, ns, JournalOp::INTENT);
+			held.push_back({std::move(bufp), sz, s, (uint16_t) ns});
+			continue;
+		}
+		addWriteIORange(s, ns, bufp.get());
+		asyncio.pwriteQueue(fd, std::move(bufp), sz, o);
 	}
 
-	auto rc = asyncio.pwrite(ios, nwrites);
-	assert(rc == nwrites);
-	if (rc < 0) {
-		throw runtime_error("io_submit failed " + string(strerror(-rc)));
+	if (journal_) {
+		journalSubmit(std::move(held));
+		return 0;
 	}
+	asyncio.submit();
 	return 0;
 }
 
 int disk::readsSubmit(uint64_t nreads) {
-	struct iocb *ios[nreads];
-	struct iocb cbs[nreads];
-	struct iocb *cbp;
+	io_desc     descs[nreads];
 	uint64_t    s;
 	uint64_t    ns;
 	size_t      sz;
 	uint64_t    o;
-	
+
+	iogen->next_ios(descs, nreads);
 	for (auto i = 0; i < nreads; i++) {
-		iogen->next_io(&s, &ns);
+		s  = descs[i].sector;
+		ns = descs[i].nsectors;
 		assert(ns >= 1 && s <= sectors_ && s+ns <= sectors_);
 
 		// cout << "R " << s << " " << ns << endl;
 		sz        = sector_to_byte(ns);
 		o         = sector_to_byte(s);
 		auto bufp = getIOBuffer(sz);
-		cbp       = &cbs[i];
-		ios[i]    = cbp;
-		asyncio.preadPrepare(cbp, fd, std::move(bufp), sz, o);
+		asyncio.preadQueue(fd, std::move(bufp), sz, o);
+		trace_.addTraceLog(s, ns, true);
+	}
+
+	asyncio.submit();
+	return 0;
+}
+
+int disk::replaySubmit(uint64_t nios) {
+	uint64_t    s;
+	uint64_t    ns;
+	bool        read;
+	size_t      sz;
+	uint64_t    o;
+	vector<HeldWrite> held;
+
+	for (auto i = 0; i < nios; i++) {
+		replay_->next_io(&s, &ns, &read);
+		assert(ns >= 1 && s <= sectors_ && s+ns <= sectors_);
+
+		sz  = sector_to_byte(ns);
+		o   = sector_to_byte(s);
+		if (read) {
+			auto bufp = getIOBuffer(sz);
+			addReadIORange(s, ns, bufp.get());
+			asyncio.preadQueue(fd, std::move(bufp), sz, o);
+		} else {
+			string p;
+			patternCreate(s, ns, p);
+
+			markStateDirty();
+			auto bufp = prepareIOBuffer(sz, p);
+			if (journal_) {
+				journal_->append(s, ns, JournalOp::INTENT);
+				held.push_back({std::move(bufp), sz, s, (uint16_t) ns});
+			} else {
+				addWriteIORange(s, ns, bufp.get());
+				asyncio.pwriteQueue(fd, std::move(bufp), sz, o);
+			}
+		}
+		trace_.addTraceLog(s, ns, read);
+	}
+
+	/* reads go now, writes once their intents are durable */
+	asyncio.submit();
+	if (!held.empty()) {
+		journalSubmit(std::move(held));
+	}
+	return 0;
+}
+
+/*
+ * Intents must be durable before the writes can reach the device. The
+ * journal's writer thread commits them, batches appended meanwhile together,
+ * and the batch is submitted on the event base once it did: a slow or hung
+ * journal never blocks the loop and its timers.
+ */
+void disk::journalSubmit(vector<HeldWrite> &&batch) {
+	journalHeldIOs_ += batch.size();
+	journalHeld_.push_back(std::move(batch));
+	journal_->flushAsync([this] (const string &error) {
+		base.runInEventBaseThread([this, error] () {
+			journalHeldSubmit(error);
+		});
+	});
+}
+
+/* callbacks run in flushAsync() order, the oldest batch is the durable one */
+void disk::journalHeldSubmit(const string &error) {
+	if (!error.empty()) {
+		throw runtime_error(error);
+	}
+
+	assert(!journalHeld_.empty());
+	auto batch = std::move(journalHeld_.front());
+	journalHeld_.pop_front();
+	journalHeldIOs_ -= batch.size();
+	for (auto &w : batch) {
+		addWriteIORange(w.sector, w.nsectors, w.bufp.get());
+		asyncio.pwriteQueue(fd, std::move(w.bufp), w.size,
+			sector_to_byte(w.sector));
+	}
+	asyncio.submit();
+}
+
+uint64_t disk::pendingIOs() {
+	return asyncio.getPending() + journalHeldIOs_;
+}
+
+/* read back every range of the expected state map in sector order */
+int disk::sweepSubmit(uint64_t nios) {
+	uint64_t    n = 0;
+	size_t      sz;
+	uint64_t    o;
+
+	while (n < nios) {
+		auto &ios = shardMap(sweepCursor_);
+		auto it   = ios.lower_bound(range(sweepCursor_, 1));
+		if (it == ios.end()) {
+			if (shardEnd(sweepCursor_) == UINT64_MAX) {
+				break;
+			}
+			sweepCursor_ = shardEnd(sweepCursor_) + 1;
+			continue;
+		} else if ((*it)->pattern.empty()) {
+			sweepCursor_ = (*it)->r.end_sector() + 1;
+			continue;
+		}
+
+		auto s  = std::max(sweepCursor_, (*it)->r.start_sector());
+		auto ns = MIN((*it)->r.end_sector() - s + 1, MAX_IO_SECTORS);
+		sweepCursor_ = s + ns;
+
+		sz        = sector_to_byte(ns);
+		o         = sector_to_byte(s);
+		auto bufp = getIOBuffer(sz);
+		asyncio.preadQueue(fd, std::move(bufp), sz, o);
 		trace_.addTraceLog(s, ns, true);
+		n++;
 	}
 
-	auto rc = asyncio.pread(ios, nreads);
-	assert(rc == nreads);
-	if (rc < 0) {
-		throw runtime_error("io_submit failed " + string(strerror(-rc)));
+	if (n == 0) {
+		/* every range has been read */
+		runtimeComplete_ = true;
+		if (asyncio.getPending() == 0) {
+			terminateLoop();
+		}
+		return 0;
 	}
+
+	asyncio.submit();
 	return 0;
 }
 
+/* returns false once every fill write completed */
+bool disk::fillSubmit(uint64_t nios) {
+	auto     end = ioNSectors();
+	uint64_t n   = 0;
+	if (fillStartNs_ == 0) {
+		fillStartNs_ = monotonicNs();
+	}
+	for (; n < nios && fillCursor_ < end; n++) {
+		auto s  = fillCursor_;
+		auto ns = MIN(end - s, MAX_IO_SECTORS);
+		fillCursor_ += ns;
+
+		string p;
+		patternCreate(s, ns, p);
+
+		auto sz   = sector_to_byte(ns);
+		auto bufp = prepareIOBuffer(sz, p);
+		asyncio.pwriteQueue(fd, std::move(bufp), sz, sector_to_byte(s));
+		trace_.addTraceLog(s, ns, false);
+	}
+
+	if (n) {
+		asyncio.submit();
+		return true;
+	} else if (asyncio.getPending() != 0) {
+		return true;
+	}
+
+	auto secs = (monotonicNs() - fillStartNs_) / 1e9;
+	cout << "Prefilled " << end << " sectors in " << secs << "s (" <<
+		sector_to_byte(end) / secs / (1 << 20) << " MB/s)" << endl;
+	filling_     = false;
+	baseSectors_ = end;
+	saveState();
+	return false;
+}
+
 int disk::iosSubmit(uint64_t nios) {
 	int rc;
 
-	if (modeSwitched_ == true) {
+	if (getNRanges() > evictSize_ && mapBudget_) {
+		mapEvict();
+	}
+	if (verifyPool_) {
+		verifyCollect();
+	}
+
+	if (completionSwitch_ == true) {
+		/* verify() switches to polling once all submitted IOs are complete */
+		if (pendingIOs() == 0) {
+			terminateLoop();
+		}
+		return 0;
+	}
+
+	if (modeSwitched_ == true || checkpoint_ == true) {
 		/* wait till all submitted IOs are complete */
-		if (asyncio.getPending() != 0) {
+		if (pendingIOs() != 0) {
 			return 0;
 		}
 
+		/* no IOs in flight - good point to checkpoint expected state */
+		saveState();
+
 		nios = iodepth_;
 		modeSwitched_ = false;
+		checkpoint_   = false;
 	}
 
 	if (runtimeComplete_ == true) {
-		if (asyncio.getPending() == 0) {
-			base.terminateLoopSoon();
+		if (pendingIOs() == 0) {
+			terminateLoop();
 		}
 		return 0;
 	}
 
 	assert(modeSwitched_ == false);
+	if (filling_) {
+		if (fillSubmit(nios)) {
+			return 0;
+		}
+		/* fill complete and no IOs in flight */
+		nios = iodepth_;
+	}
+
+	if (verifyOnly_) {
+		return sweepSubmit(nios);
+	} else if (replay_) {
+		/* trace decides between reads and writes */
+		return replaySubmit(nios);
+	}
+
 	switch (mode_) {
 	case IOMode::WRITE:
 		rc = writesSubmit(nios);
@@ -263,6 +503,7 @@ int disk::iosSubmit(uint64_t nios) {
 bool disk::patternCompare(uint64_t sector, uint16_t nsectors,
 			const char *const bufp, size_t size, const string &pattern,
 			int16_t start) {
+	const auto pstart = start;
 
 	assert(bufp && pattern.length() && pattern.length() >= start &&
 			size > pattern.length() && size >= 512 && pattern.length() < 512);
@@ -282,30 +523,182 @@ bool disk::patternCompare(uint64_t sector, uint16_t nsectors,
 			for (auto x = 0; x < cl; x++) {
 				r += *(bp + x);
 			}
-			throw Corruption(sector, nsectors, r, pattern);
+			throw Corruption(sector, nsectors, r, pattern, pstart);
 			return true;
 		}
 		bp    += cl;
 		start  = 0;
 	}
 
-	i = size - ((size/len) * len);
-	auto rc = std::memcmp(bp, p, i);
-	if (rc != 0) {
-		/* corruption */
-		string r(bp);
-		throw Corruption(sector, nsectors, r, pattern);
-		return true;
+	/* tail - including the start bytes skipped by the first compare */
+	const char *const ep = bufp + size;
+	while (bp < ep) {
+		auto cl = MIN(len, (size_t) (ep - bp));
+		auto rc = std::memcmp(bp, p, cl);
+		if (rc != 0) {
+			/* corruption */
+			string r(bp, cl);
+			throw Corruption(sector, nsectors, r, pattern, pstart);
+			return true;
+		}
+		bp += cl;
 	}
 	return false;
 }
 
-bool disk::readDataVerify(const char *const data, uint64_t sector, uint16_t nsectors) {
+/* number of leading bytes of bufp matching pattern repeated from start */
+static size_t patternMatchLen(const char *bufp, size_t size, const string &pattern,
+			size_t start) {
+	const char *const p = pattern.c_str();
+	const auto len = pattern.length();
+	size_t m = 0;
+
+	while (m < size) {
+		auto cl = MIN(len - start, size - m);
+		if (std::memcmp(bufp + m, p + start, cl) != 0) {
+			while (bufp[m] == p[start]) {
+				m++;
+				start++;
+			}
+			return m;
+		}
+		m    += cl;
+		start = 0;
+	}
+	return m;
+}
+
+/* cheap check for misdirected and torn writes, looks at sector edges only */
+void disk::patternCompareEdges(uint64_t sector, uint16_t nsectors,
+			const char *const bufp, const string &pattern, int16_t start) {
+	const size_t SECTOR = sector_to_byte(1);
+
+	auto len = pattern.length();
+	for (uint16_t i = 0; i < nsectors; i++) {
+		auto sp = bufp + sector_to_byte(i);
+		auto hs = (start + sector_to_byte(i)) % len;
+		auto ts = (hs + SECTOR - EDGE_BYTES) % len;
+		if (patternMatchLen(sp, EDGE_BYTES, pattern, hs) != EDGE_BYTES) {
+			throw Corruption(sector, nsectors, string(sp, EDGE_BYTES), pattern,
+				start);
+		} else if (patternMatchLen(sp + SECTOR - EDGE_BYTES, EDGE_BYTES, pattern,
+				ts) != EDGE_BYTES) {
+			throw Corruption(sector, nsectors,
+				string(sp + SECTOR - EDGE_BYTES, EDGE_BYTES), pattern, start);
+		}
+	}
+}
+
+/* compare <s, ns> to depth, returns number of bytes compared */
+uint64_t disk::patternVerify(uint64_t s, uint16_t ns, const char *const bufp,
+			const string &pattern, int16_t start, VerifyDepth depth) {
+	switch (depth) {
+	case VerifyDepth::EDGES:
+		patternCompareEdges(s, ns, bufp, pattern, start);
+		return (uint64_t) ns * 2 * EDGE_BYTES;
+	case VerifyDepth::FULL:
+		break;
+	}
+	patternCompare(s, ns, bufp, sector_to_byte(ns), pattern, start);
+	return sector_to_byte(ns);
+}
+
+const char *sectorStateName(SectorState state) {
+	switch (state) {
+	case SectorState::MATCH:
+		return "match";
+	case SectorState::STALE:
+		return "stale";
+	case SectorState::MISDIRECTED:
+		return "misdirected";
+	case SectorState::TORN:
+		return "torn";
+	case SectorState::GARBAGE:
+		break;
+	}
+	return "garbage";
+}
+
+/*
+ * Classify one sector read back against the pattern expected in it, start is
+ * the offset within the pattern of the sector's first byte. If the sector
+ * holds some other write's pattern, <*fsp,*fnsp> identify that write.
+ */
+SectorState disk::sectorClassify(const char *const sp, uint64_t sector,
+			const string &pattern, int16_t start, uint64_t *fsp, uint32_t *fnsp) {
+	const size_t SECTOR = sector_to_byte(1);
+
+	auto len = pattern.length();
+	auto m   = patternMatchLen(sp, SECTOR, pattern, start);
+	if (m == SECTOR) {
+		return SectorState::MATCH;
+	}
+
+	/* decode the first complete pattern in the sector */
+	for (size_t i = 0; i < SECTOR && i < 32; i++) {
+		if (sp[i] != '<') {
+			continue;
+		}
+
+		char t[33];
+		auto n = MIN(sizeof(t) - 1, SECTOR - i);
+		std::memcpy(t, sp + i, n);
+		t[n] = 0;
+
+		uint64_t fs;
+		uint32_t fns;
+		string   q(t);
+		auto e = q.find('>');
+		if (e == string::npos || !patternDecode(q.substr(0, e + 1), fs, fns)) {
+			break;
+		}
+		patternCreate(fs, fns, q);
+
+		/* whole sector must be that pattern */
+		auto phase = (q.length() - i) % q.length();
+		if (patternMatchLen(sp, SECTOR, q, phase) != SECTOR) {
+			break;
+		}
+
+		*fsp  = fs;
+		*fnsp = fns;
+		if (sector >= fs && sector < fs + fns &&
+				sector_to_byte(sector - fs) % q.length() == phase) {
+			/* an older write of this sector */
+			return SectorState::STALE;
+		}
+		return SectorState::MISDIRECTED;
+	}
+
+	/*
+	 * expected data at the start or the end of the sector, a tail of the
+	 * size the EDGES depth compares
+	 */
+	const size_t TAIL = EDGE_BYTES;
+	auto ts = (start + SECTOR - TAIL) % len;
+	if (m >= len || patternMatchLen(sp + SECTOR - TAIL, TAIL, pattern, ts) == TAIL) {
+		return SectorState::TORN;
+	}
+	return SectorState::GARBAGE;
+}
+
+void disk::readDataVerify(const char *const data, uint64_t sector, uint16_t nsectors) {
 	range r(sector, nsectors);
-	auto  io = ios.find(r);
+	auto  se = shardEnd(sector);
+	if (r.end_sector() > se) {
+		/* no range crosses shards, each shard's part on its own */
+		auto ns = se - sector + 1;
+		readDataVerify(data, sector, ns);
+		readDataVerify(data + sector_to_byte(ns), se + 1, nsectors - ns);
+		return;
+	}
+
+	auto &ios = shardMap(sector);
+	auto io   = ios.find(r);
 	if (io == ios.end()) {
 		/* case 0: <sector, nsector> are never written before */
-		return false;
+		baseVerify(data, sector, nsectors);
+		return;
 	}
 
 	auto rios = r.start_sector();
@@ -320,16 +713,12 @@ bool disk::readDataVerify(const char *const data, uint64_t sector, uint16_t nsec
 		/*
 		 * CASE 1:
 		 *
-		 * Read IOs start sector is before found IOs start sector. Since this
-		 * part is not part of IOS set, it should never have data corruption.
+		 * Read IOs start sector is before found IOs start sector. This part
+		 * is not in the map, only the base layer (if any) is verified.
 		 */
 		auto s  = rios;
 		auto ns = oios - s;
-		auto c  = readDataVerify(vbufp, s, ns);
-		if (c == true) {
-			/* corruption */
-			assert(0);
-		}
+		readDataVerify(vbufp, s, ns);
 		assert(vnsec > ns);
 
 		vbufp += sector_to_byte(ns);
@@ -347,15 +736,15 @@ bool disk::readDataVerify(const char *const data, uint64_t sector, uint16_t nsec
 	auto ns   = vend - s + 1;
 	assert(ns <= vnsec);
 	auto d    = vssec - oios;
-	auto ps   = (sector_to_byte(d) + (*io)->pattern_start) % (*io)->pattern.length();
-	auto c    = patternCompare(s, ns, vbufp, sector_to_byte(ns), (*io)->pattern, ps);
-	if (c == true) {
-		/* corruption */
-		assert(0);
-	} else if (vnsec <= ns) {
+	if (!(*io)->pattern.empty()) {
+		auto ps = (sector_to_byte(d) + (*io)->pattern_start) % (*io)->pattern.length();
+		nbytesCompared_ += patternVerify(s, ns, vbufp, (*io)->pattern, ps, verifyDepth_);
+		(*io)->lastUse   = useClock_;
+	}
+	if (vnsec <= ns) {
 		/* data has been verified - no corruption */
 		assert(vnsec - ns == 0);
-		return false;
+		return;
 	}
 
 	/* CASE 3: */
@@ -363,81 +752,875 @@ bool disk::readDataVerify(const char *const data, uint64_t sector, uint16_t nsec
 	vnsec -= ns;
 	vbufp += sector_to_byte(ns);
 
-	return readDataVerify(vbufp, vssec, vnsec);
+	readDataVerify(vbufp, vssec, vnsec);
 }
 
 void disk::readDone(const char *const bufp, uint64_t sector, uint16_t nsectors) {
-	try {
-		auto corruption = readDataVerify(bufp, sector, nsectors);
-		if (corruption) {
-			assert(0);
+	if (checkMode_) {
+		checkRead(bufp, sector, nsectors);
+		return;
+	}
+
+	if (replay_) {
+		auto pr = removeReadIORange(sector, nsectors, bufp);
+		if (pr.second == false) {
+			/* read raced with a write on same sectors - nothing to verify */
+			return;
 		}
-	} catch(Corruption &c) {
-		cout << "Data Corruption\n";
-		cout << "Read(sector = " << c.sector << ", nsectors=" << c.nsectors << ")\n";
-		cout << "Expected Pattern = " << c.pattern << endl;
-		cout << "Read Pattern = " << c.readLine << endl;
+	}
 
-		trace_.dumpTraceLog(c.sector, c.nsectors);
-		base.terminateLoopSoon();
+	if (asyncio.getEngine() == IOEngine::NULLIO) {
+		/* no data behind the null engine */
+		return;
+	} else if (!verifySampled()) {
+		return;
+	}
+
+	try {
+		readDataVerify(bufp, sector, nsectors);
+	} catch(Corruption &c) {
+		/* what readDataVerify() compared against, the map has not changed */
+		vector<IO> expected;
+		snapshotExpected(sector, nsectors, expected);
+		corruptionFound(c, bufp, sector, nsectors, expected);
 	}
 }
 
-void disk::writeDone(uint64_t sector, uint16_t nsectors) {
-	auto pr = removeWriteIORange(sector, nsectors);
-	if (pr.second == false) {
-		/*
-		 * TODO: improve this
-		 *
-		 * IO on same range of sectors was submitted simultaneously. There is
-		 * no simple way to verify data. At the moment, we remove all traces
-		 * of the related IOs.
-		 */
-		while (1) {
-			auto io = ios.find(pr.first);
-			if (io == ios.end()) {
-				break;
+string disk::slowIOString(const SlowIO &s, uint64_t startNs) {
+	std::ostringstream os;
+	os << (s.read ? "read" : "write") << " sector " << bytes_to_sector(s.offset) <<
+		" nsectors " << bytes_to_sector(s.size) << " submitted t=" <<
+		(s.submitNs - std::min(s.submitNs, startNs)) / 1000000 << "ms latency " <<
+		s.latencyNs / 1000 << "us inflight " << s.inflight;
+	return os.str();
+}
+
+/*
+ * data is the read of <sector, nsectors> c was found in, expected what the
+ * verifier compared it with and aiop the AsyncIO which read it. Without a
+ * reporter the run stops at c. With one, verification only got as far as c's
+ * piece: the rest of the read goes to the reporter, which classifies every
+ * sector and reports each contiguous bad extent, and is forgotten here.
+ */
+void disk::corruptionFound(const Corruption &c, const char *const data, uint64_t sector,
+		uint16_t nsectors, const vector<IO> &expected, const AsyncIO *aiop) {
+	auto &aio = aiop ? *aiop : asyncio;
+	ncorruptions_++;
+	if (reporter_) {
+		assert(c.sector >= sector && c.sector < sector + nsectors);
+		range x(c.sector, sector + nsectors - c.sector);
+
+		CorruptionEvent e;
+		e.sector   = x.sector;
+		e.nsectors = x.nsectors;
+		for (auto &io : expected) {
+			if (io.r.end_sector() < x.start_sector() ||
+					io.r.start_sector() > x.end_sector()) {
+				continue;
 			}
-			ios.erase(io);
+			auto s  = std::max(x.start_sector(), io.r.start_sector());
+			auto ns = MIN(x.end_sector(), io.r.end_sector()) - s + 1;
+			auto ps = io.pattern.empty() ? 0 : (sector_to_byte(s -
+				io.r.start_sector()) + io.pattern_start) % io.pattern.length();
+			e.expected.emplace_back(s, ns, io.pattern, ps);
 		}
-		assert(ios.find(pr.first) == ios.end());
+		e.data.assign(data + sector_to_byte(x.sector - sector),
+			sector_to_byte(x.nsectors));
+		e.slow = aio.getSlowIOs();
+		reporter_->report(std::move(e));
+
+		/* reported once, later reads of it are not verified */
+		forgetRange(x);
+		if (journal_) {
+			journal_->append(x.sector, x.nsectors, JournalOp::FORGET);
+		}
+		markStateDirty();
 		return;
 	}
 
-	string p;
-	patternCreate(sector, nsectors, p);
-	writeDone(sector, nsectors, p, 0);
+	cout << "Data Corruption\n";
+	cout << "Read(sector = " << c.sector << ", nsectors=" << c.nsectors << ")\n";
+	cout << "Expected Pattern = " << c.pattern << endl;
+	cout << "Read Pattern = " << c.readLine << endl;
+	for (auto &slow : aio.getSlowIOs()) {
+		cout << "Slow IO " << slowIOString(slow, startNs_) << endl;
+	}
+
+	if (queues_.empty()) {
+		/* submitter threads keep no trace and are stopped by queueCorruption() */
+		trace_.dumpTraceLog(c.sector, c.nsectors);
+		terminateLoop();
+	}
 }
 
-void disk::writeDone(uint64_t sector, uint16_t nsectors, const string &pattern, const int16_t pattern_start) {
-	range r(sector, nsectors);
+/* verification offload */
+void disk::setVerifyThreads(uint32_t nthreads) {
+	if (nthreads) {
+		verifyPool_ = std::make_unique<VerifyPool>(nthreads, iodepth_, numaNode_);
+	}
+}
 
-	auto nios = r.start_sector(); /* new IO start sector */
-	auto nioe = r.end_sector();   /* new IO end sector   */
+void disk::setCorruptionReport(const string &path) {
+	reporter_ = std::make_unique<CorruptionReporter>(path);
+}
 
-	do {
-		auto io = ios.find(r);
-		if (io == ios.end()) {
-			auto newiop = make_shared<IO>(sector, nsectors, pattern, pattern_start);
-			ios.insert(newiop);
-			break;
-		}
+void disk::setPrefill() {
+	if (baseSectors_) {
+		/* resumed state already has the base layer */
+		return;
+	}
 
-		/* overlapping IO range found */
-		/*
-		std::cout << "Trying to insert " << sector << " " << nsectors << " ";
-		std::cout << "preset " << (*io)->r.sector << " " << (*io)->r.nsectors << std::endl;
-		*/
+	/* the fill overwrites anything resumed */
+	for (auto &sp : shards_) {
+		sp->ios.clear();
+	}
+	markStateDirty();
+	filling_     = true;
+	fillCursor_  = 0;
+	fillStartNs_ = 0;
+}
 
-		auto oios     = (*io)->r.start_sector(); /* old IO start sector */
-		auto oions    = (*io)->r.nsectors;       /* old IO nsectors */
-		auto oioe     = (*io)->r.end_sector();   /* old IO end sector   */
+void disk::setVerifyDepth(VerifyDepth depth, uint32_t sample) {
+	assert(sample >= 1);
+	verifyDepth_  = depth;
+	verifySample_ = sample;
+}
+
+void disk::setMapBudget(uint64_t bytes) {
+	mapBudget_ = bytes;
+	evictSize_ = bytes / IO_ENTRY_BYTES;
+}
+
+/* split the (empty) map in shards of shardSectors */
+void disk::setMapShards(uint64_t shardSectors) {
+	assert(getNRanges() == 0);
+	auto n = (sectors_ + shardSectors - 1) / shardSectors;
+	shards_.clear();
+	for (uint64_t i = 0; i < n; i++) {
+		shards_.push_back(std::make_unique<MapShard>());
+	}
+	shardSectors_ = shardSectors;
+}
+
+/* always in ascending order, no thread waits on one it holds up */
+void disk::shardsLock(size_t first, size_t last, bool exclusive) {
+	if (queues_.empty()) {
+		return;
+	}
+	for (auto i = first; i <= last; i++) {
+		if (exclusive) {
+			shards_[i]->lock.lock();
+		} else {
+			shards_[i]->lock.lock_shared();
+		}
+	}
+}
+
+void disk::shardsUnlock(size_t first, size_t last, bool exclusive) {
+	if (queues_.empty()) {
+		return;
+	}
+	for (auto i = last + 1; i-- > first; ) {
+		if (exclusive) {
+			shards_[i]->lock.unlock();
+		} else {
+			shards_[i]->lock.unlock_shared();
+		}
+	}
+}
+
+uint64_t disk::shardsSize(size_t first, size_t last) const {
+	uint64_t n = 0;
+	for (auto i = first; i <= last; i++) {
+		n += shards_[i]->ios.size();
+	}
+	return n;
+}
+
+uint64_t disk::mapSize() const {
+	if (queues_.empty()) {
+		return getNRanges();
+	}
+	return queueNRanges_.load(std::memory_order_relaxed);
+}
+
+/*
+ * Evict the least recently used ranges down to 7/8 of the budget at once, so
+ * the scan is amortized over many writes. Without a base layer an evicted
+ * range leaves the map. With one it has to become a hole, which alone would
+ * not shrink the map: adjacent victims and holes are evicted as one spanning
+ * hole instead, and a victim without such neighbours takes its colder
+ * neighbour along. Every span then removes at least one entry.
+ *
+ * With submitter threads, one at a time evicts holding one shard lock at a
+ * time, writes to the other shards go on meanwhile.
+ */
+void disk::mapEvict() {
+	auto max    = mapBudget_ / IO_ENTRY_BYTES;
+	auto target = max - max / 8;
+	while (mapSize() > target) {
+		vector<uint64_t> uses;
+		uses.reserve(mapSize());
+		for (size_t i = 0; i < shards_.size(); i++) {
+			shardsLock(i, i, false);
+			for (auto &io : shards_[i]->ios) {
+				uses.push_back(__atomic_load_n(&io->lastUse, __ATOMIC_RELAXED));
+			}
+			shardsUnlock(i, i, false);
+		}
+		if (uses.size() <= target) {
+			break;
+		}
+		auto nevict = uses.size() - target;
+		std::nth_element(uses.begin(), uses.begin() + nevict - 1, uses.end());
+		auto cold = uses[nevict - 1];
+
+		uint64_t n       = 0;
+		uint64_t removed = 0;
+		for (size_t i = 0; i < shards_.size() && n < nevict; i++) {
+			auto          &ios = shards_[i]->ios;
+			vector<range> victims;
+			shardsLock(i, i, true);
+			if (baseSectors_ == 0) {
+				for (auto &io : ios) {
+					if (n == nevict) {
+						break;
+					} else if (io->lastUse <= cold && !io->pattern.empty()) {
+						victims.push_back(io->r);
+						n++;
+					}
+				}
+			} else {
+				n += evictSpans(ios, cold, nevict - n, victims);
+			}
+
+			auto size = ios.size();
+			for (auto &r : victims) {
+				forgetRange(r);
+			}
+			removed += size - ios.size();
+			shardsUnlock(i, i, true);
+		}
+		nevicted_ += n;
+		if (!queues_.empty()) {
+			queueNRanges_ -= removed;
+		}
+		if (removed == 0) {
+			/* nothing left to evict */
+			break;
+		}
+	}
+	markStateDirty();
+}
+
+/*
+ * Spans of a shard of a base layer map to evict, up to nevict ranges last
+ * used at or before cold. Returns the number of ranges in them.
+ */
+uint64_t disk::evictSpans(const set<IOPtr, IOCompare> &ios, uint64_t cold,
+		uint64_t nevict, vector<range> &spans) {
+	auto victim = [cold] (const IOPtr &io) {
+		return !io->pattern.empty() && io->lastUse <= cold;
+	};
+
+	uint64_t n     = 0;
+	uint64_t floor = 0; /* first sector not in a span yet */
+	for (auto it = ios.begin(); it != ios.end() && n < nevict; ) {
+		if (!victim(*it)) {
+			it++;
+			continue;
+		}
+
+		auto     first    = it;
+		auto     last     = it;
+		uint64_t nentries = 1;
+		n++;
+		for (auto nx = std::next(last); nx != ios.end() &&
+				((*nx)->pattern.empty() || (victim(*nx) && n < nevict));
+				nx = std::next(last)) {
+			n       += (*nx)->pattern.empty() ? 0 : 1;
+			last     = nx;
+			nentries++;
+		}
+		while (first != ios.begin() && (*std::prev(first))->r.sector >= floor &&
+				(*std::prev(first))->pattern.empty()) {
+			first--;
+			nentries++;
+		}
+
+		if (nentries == 1) {
+			auto prev = first == ios.begin() || (*std::prev(first))->r.sector < floor ?
+				ios.end() : std::prev(first);
+			auto next = std::next(last);
+			if (prev != ios.end() && (next == ios.end() ||
+					(*prev)->lastUse <= (*next)->lastUse)) {
+				first = prev;
+			} else if (next != ios.end()) {
+				last = next;
+			}
+		}
+
+		auto s  = (*first)->r.start_sector();
+		auto ns = (*last)->r.end_sector() - s + 1;
+		if (ns > UINT32_MAX) {
+			/* too far apart to be one entry */
+			spans.push_back((*it)->r);
+		} else {
+			spans.emplace_back(s, ns);
+		}
+		floor = (*last)->r.end_sector() + 1;
+		it    = std::next(last);
+	}
+	return n;
+}
+
+/* whether to verify this read, a power loss check reads everything */
+bool disk::verifySampled() {
+	if (checkMode_ || nsampleReads_++ % verifySample_ == 0) {
+		return true;
+	}
+	nreadsSkipped_++;
+	return false;
+}
+
+/* NUMA placement */
+int disk::setNumaNode(int node) {
+	if (node < 0) {
+		if (pathEngine(path_) != IOEngine::AIO || numaNumNodes() < 2) {
+			return -1;
+		}
+		node = numaDeviceNode(path_);
+		if (node < 0) {
+			return -1;
+		}
+	}
+
+	/*
+	 * IO buffers are allocated lazily by this thread, so once it prefers the
+	 * node they are placed there on first touch.
+	 */
+	if (!numaBindThread(node)) {
+		throw std::invalid_argument("Invalid NUMA node " + std::to_string(node));
+	}
+	numaNode_ = node;
+	return node;
+}
+
+void disk::readDone(ManagedBuffer bufp, uint64_t sector, uint16_t nsectors) {
+	auto size = sector_to_byte(nsectors);
+	if (!verifyPool_ || checkMode_ || asyncio.getEngine() == IOEngine::NULLIO) {
+		readDone(bufp.get(), sector, nsectors);
+		asyncio.putIOBuffer(std::move(bufp), size);
+		return;
+	}
+
+	if (replay_) {
+		auto pr = removeReadIORange(sector, nsectors, bufp.get());
+		if (pr.second == false) {
+			/* read raced with a write on same sectors - nothing to verify */
+			asyncio.putIOBuffer(std::move(bufp), size);
+			return;
+		}
+	}
+
+	if (!verifySampled()) {
+		asyncio.putIOBuffer(std::move(bufp), size);
+		return;
+	}
+
+	VerifyJob job{std::move(bufp), sector, nsectors, {}, verifyDepth_};
+	snapshotExpected(sector, nsectors, job.expected);
+	if (job.expected.empty()) {
+		/* never written */
+		asyncio.putIOBuffer(std::move(job.bufp), size);
+		return;
+	}
+
+	if (verifyPool_->submit(job)) {
+		return;
+	}
+
+	/* every worker is busy */
+	verifyPool_->verifiedInline();
+	try {
+		verifyExpected(job.bufp.get(), sector, nsectors, job.expected,
+			verifyDepth_, &nbytesCompared_);
+	} catch (Corruption &c) {
+		corruptionFound(c, job.bufp.get(), sector, nsectors, job.expected);
+	}
+	asyncio.putIOBuffer(std::move(job.bufp), size);
+}
+
+/* submitter threads */
+void disk::setSubmitThreads(uint32_t n) {
+	assert(queues_.empty());
+	if (n == 0) {
+		return;
+	}
+
+	/* writes lock the map shards of their in flight tracking stripes */
+	setMapShards(inflight_->getStripeSectors());
+	for (uint32_t i = 0; i < n; i++) {
+		/* same pattern over the same region, a different sequence each */
+		auto gen = make_io_generator(0, ioNSectors(), sizes_, pattern_, i + 2);
+		queues_.push_back(std::make_unique<SubmitQueue>(this, i, iodepth_,
+			std::move(gen)));
+	}
+}
+
+vector<AsyncIO *> disk::getAsyncIOs() {
+	vector<AsyncIO *> aios;
+	for (auto &qp : queues_) {
+		aios.push_back(&qp->getAsyncIO());
+	}
+	if (aios.empty()) {
+		aios.push_back(&asyncio);
+	}
+	return aios;
+}
+
+void disk::queueWriteSubmitted(uint64_t sector, uint16_t nsectors,
+		const void *io) {
+	addWriteIORange(sector, nsectors, io);
+}
+
+void disk::queueWritesDone(const vector<range> &writes,
+		const vector<ManagedBuffer> &bufs) {
+	assert(writes.size() == bufs.size());
+	std::shared_lock<std::shared_timed_mutex> l(lock);
+	for (size_t i = 0; i < writes.size(); i++) {
+		auto &r = writes[i];
+		/*
+		 * A write overlapping it locks one of its shards too: it leaves the
+		 * in flight ranges and updates the map after this one.
+		 */
+		auto first = shardOf(r.start_sector());
+		auto last  = shardOf(r.end_sector());
+		shardsLock(first, last, true);
+		auto n = shardsSize(first, last);
+		writeDone(r.sector, r.nsectors, bufs[i].get());
+		queueNRanges_ += shardsSize(first, last) - n;
+		shardsUnlock(first, last, true);
+	}
+
+	/* not holding up the writes of other threads, nor their next batches */
+	if (mapBudget_ && mapSize() > evictSize_ && !queueEvicting_.exchange(true)) {
+		mapEvict();
+		queueEvicting_ = false;
+	}
+}
+
+void disk::queueReadSubmitted(uint64_t sector, uint16_t nsectors,
+		const void *io) {
+	addReadIORange(sector, nsectors, io);
+}
+
+void disk::queueReadDone(uint64_t sector, uint16_t nsectors, const void *io) {
+	removeReadIORange(sector, nsectors, io);
+}
+
+void disk::queueSnapshots(const vector<range> &reads,
+		const vector<ManagedBuffer> &bufs, vector<vector<IO>> &expected) {
+	assert(reads.size() == bufs.size());
+	std::shared_lock<std::shared_timed_mutex> l(lock);
+	for (size_t i = 0; i < reads.size(); i++) {
+		auto &r    = reads[i];
+		auto first = shardOf(r.start_sector());
+		auto last  = shardOf(r.end_sector());
+		shardsLock(first, last, false);
+		snapshotExpected(r.sector, r.nsectors, expected[i]);
+		shardsUnlock(first, last, false);
+
+		/*
+		 * In flight till after the snapshot: a write overlapping it and
+		 * completing before it was taken was submitted, and made the read
+		 * unclean, in time.
+		 */
+		auto pr = removeReadIORange(r.sector, r.nsectors, bufs[i].get());
+		if (pr.second == false) {
+			/* read raced with a write on same sectors - nothing to verify */
+			expected[i].clear();
+		}
+	}
+}
+
+void disk::queueCorruption(const Corruption &c, const char *const data,
+		uint64_t sector, uint16_t nsectors, const vector<IO> &expected,
+		const AsyncIO &aio) {
+	{
+		std::unique_lock<std::shared_timed_mutex> l(lock);
+		if (!reporter_ && queueStopped()) {
+			/* the run already ends on an earlier one */
+			return;
+		}
+		corruptionFound(c, data, sector, nsectors, expected, &aio);
+		queueNRanges_ = getNRanges();
+	}
+	if (!reporter_) {
+		/* not under lock, queueBarrier() takes it with queueLock_ held */
+		queueStop();
+	}
+}
+
+void disk::queueSwitch(uint64_t &epoch, IOMode &mode) {
+	std::lock_guard<std::mutex> l(queueLock_);
+	epoch = queueEpoch_.load(std::memory_order_acquire);
+	mode  = queueMode_;
+}
+
+bool disk::queueBarrier(uint64_t &epoch, IOMode &mode) {
+	std::unique_lock<std::mutex> l(queueLock_);
+	auto gen = queueGen_;
+	if (++queueArrived_ == queueRunning_) {
+		/* no IOs in flight - good point to checkpoint expected state */
+		{
+			std::unique_lock<std::shared_timed_mutex> ml(lock);
+			saveState();
+			if (queueMode_ == IOMode::WRITE) {
+				markStateDirty();
+			}
+		}
+		queueArrived_   = 0;
+		queueEpochDone_ = queueEpoch_.load(std::memory_order_acquire);
+		queueGen_++;
+		queueCv_.notify_all();
+	} else {
+		queueCv_.wait(l, [this, gen] () {
+			return queueGen_ != gen || queueStopped();
+		});
+	}
+	if (queueGen_ == gen) {
+		/* stopped while waiting for the others */
+		queueArrived_--;
+		return false;
+	}
+	epoch = queueEpochDone_;
+	mode  = queueMode_;
+	return true;
+}
+
+void disk::queueStop() {
+	std::lock_guard<std::mutex> l(queueLock_);
+	queueStop_.store(true, std::memory_order_release);
+	queueCv_.notify_all();
+}
+
+void disk::queueFinished() {
+	std::lock_guard<std::mutex> l(queueLock_);
+	if (--queueRunning_ == 0) {
+		base.runInEventBaseThread([this] () {
+			terminateLoop();
+		});
+	}
+}
+
+void disk::getStats(uint64_t *nreadsp, uint64_t *nwritesp, uint64_t *nreadBytesp,
+		uint64_t *nwroteBytes) {
+	*nreadsp     = asyncio.getNReads();
+	*nwritesp    = asyncio.getNWrites();
+	*nreadBytesp = asyncio.getBytesRead();
+	*nwroteBytes = asyncio.getBytesWrote();
+	for (auto &qp : queues_) {
+		*nreadsp     += qp->getNReads();
+		*nwritesp    += qp->getNWrites();
+		*nreadBytesp += qp->getBytesRead();
+		*nwroteBytes += qp->getBytesWrote();
+	}
+}
+
+uint64_t disk::getNBytesCompared() const {
+	auto n = nbytesCompared_;
+	for (auto &qp : queues_) {
+		n += qp->getNBytesCompared();
+	}
+	return n;
+}
+
+uint64_t disk::getNReadsSkipped() const {
+	auto n = nreadsSkipped_;
+	for (auto &qp : queues_) {
+		n += qp->getNReadsSkipped();
+	}
+	return n;
+}
+
+/* copy of the expected ranges overlapping <sector, nsectors> */
+void disk::snapshotExpected(uint64_t sector, uint16_t nsectors, vector<IO> &expected) {
+	range r(sector, nsectors);
+	auto  next = sector; /* first sector not yet accounted for */
+	for (auto s = sector; s <= r.end_sector(); s = shardEnd(s) + 1) {
+		auto &ios = shardMap(s);
+		for (auto it = ios.lower_bound(range(s, 1)); it != ios.end(); it++) {
+			if ((*it)->r.start_sector() > r.end_sector()) {
+				break;
+			}
+			if ((*it)->r.start_sector() > next) {
+				baseExpected(next, (*it)->r.start_sector() - 1, expected);
+			}
+			/* submitter threads snapshot under a shared lock */
+			__atomic_store_n(&(*it)->lastUse, useClock_.load(std::memory_order_relaxed),
+				__ATOMIC_RELAXED);
+			expected.push_back(**it);
+			next = (*it)->r.end_sector() + 1;
+		}
+		if (shardEnd(s) >= r.end_sector()) {
+			break;
+		}
+	}
+	if (next <= r.end_sector()) {
+		baseExpected(next, r.end_sector(), expected);
+	}
+}
+
+/* base layer expected in <sector, end>, nothing where it was not filled */
+void disk::baseExpected(uint64_t sector, uint64_t end, vector<IO> &expected) {
+	end = MIN(end, baseSectors_ - 1);
+	while (baseSectors_ && sector <= end) {
+		/* the fill write of sector's stripe */
+		auto ss = sector / MAX_IO_SECTORS * MAX_IO_SECTORS;
+		auto sn = MIN(baseSectors_ - ss, MAX_IO_SECTORS);
+		auto se = MIN(end, ss + sn - 1);
+
+		string p;
+		patternCreate(ss, sn, p);
+		expected.emplace_back(sector, se - sector + 1, p,
+			sector_to_byte(sector - ss) % p.length());
+		sector = se + 1;
+	}
+}
+
+void disk::baseVerify(const char *const data, uint64_t sector, uint16_t nsectors) {
+	vector<IO> expected;
+	baseExpected(sector, sector + nsectors - 1, expected);
+	verifyExpected(data, sector, nsectors, expected, verifyDepth_, &nbytesCompared_);
+}
+
+void disk::verifyExpected(const char *const data, uint64_t sector,
+		uint16_t nsectors, const vector<IO> &expected, VerifyDepth depth,
+		uint64_t *comparedp) {
+	auto end = sector + nsectors - 1;
+	for (auto &e : expected) {
+		if (e.pattern.empty()) {
+			/* hole */
+			continue;
+		}
+		auto s  = std::max(sector, e.r.start_sector());
+		auto ns = MIN(end, e.r.end_sector()) - s + 1;
+		auto d  = s - e.r.start_sector();
+		auto ps = (sector_to_byte(d) + e.pattern_start) % e.pattern.length();
+		auto n  = patternVerify(s, ns, data + sector_to_byte(s - sector),
+			e.pattern, ps, depth);
+		if (comparedp) {
+			*comparedp += n;
+		}
+	}
+}
+
+/*
+ * Sectors of a read at data whose content is not the one expected, each
+ * classified as a whole, in extents of adjacent bad sectors. Sectors with
+ * nothing expected end an extent.
+ */
+vector<range> disk::corruptExtents(const char *const data, uint64_t sector,
+		uint16_t nsectors, const vector<IO> &expected) {
+	vector<range> extents;
+	auto end = sector + nsectors - 1;
+	for (auto &e : expected) {
+		if (e.pattern.empty()) {
+			continue;
+		}
+		auto s  = std::max(sector, e.r.start_sector());
+		auto se = MIN(end, e.r.end_sector());
+		for (auto x = s; x <= se; x++) {
+			auto     ps = (sector_to_byte(x - e.r.start_sector()) +
+				e.pattern_start) % e.pattern.length();
+			uint64_t fs;
+			uint32_t fns;
+			auto st = sectorClassify(data + sector_to_byte(x - sector), x,
+				e.pattern, ps, &fs, &fns);
+			if (st == SectorState::MATCH) {
+				continue;
+			}
+			if (!extents.empty() && extents.back().end_sector() + 1 == x) {
+				extents.back().nsectors++;
+			} else {
+				extents.emplace_back(x, 1);
+			}
+		}
+	}
+	return extents;
+}
+
+/* buffers and results of finished verifications */
+void disk::verifyCollect() {
+	verifyPool_->collect([this] (VerifyResult &r) {
+		nbytesCompared_ += r.compared;
+		if (r.corruption) {
+			corruptionFound(*r.corruption, r.bufp.get(), r.sector,
+				bytes_to_sector(r.size), r.expected);
+		}
+		asyncio.putIOBuffer(std::move(r.bufp), r.size);
+	});
+}
+
+void disk::writeDone(uint64_t sector, uint16_t nsectors, const void *io) {
+	if (filling_) {
+		/* part of the base layer once the fill completes */
+		return;
+	}
+
+	auto pr = removeWriteIORange(sector, nsectors, io);
+	if (pr.second == false) {
+		/*
+		 * TODO: improve this
+		 *
+		 * IO on same range of sectors was submitted simultaneously. There is
+		 * no simple way to verify data. At the moment, we remove all traces
+		 * of the related IOs.
+		 */
+		forgetIOs(pr.first);
+		if (journal_) {
+			journal_->append(sector, nsectors, JournalOp::FORGET);
+		}
+		return;
+	}
+
+	string p;
+	patternCreate(sector, nsectors, p);
+	if (queues_.empty()) {
+		/* the only writer of the clock */
+		useClock_.store(useClock_.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	}
+	writeDone(sector, nsectors, p, 0);
+	if (journal_) {
+		journal_->append(sector, nsectors, JournalOp::WRITE);
+	}
+}
+
+void disk::forgetIOs(const range &r) {
+	auto hs = r.start_sector();
+	auto he = r.end_sector();
+	for (auto s = hs; s <= r.end_sector(); s = shardEnd(s) + 1) {
+		auto &ios = shardMap(s);
+		while (1) {
+			auto io = ios.find(r);
+			if (io == ios.end()) {
+				break;
+			}
+			hs = std::min(hs, (*io)->r.start_sector());
+			he = std::max(he, (*io)->r.end_sector());
+			ios.erase(io);
+		}
+		assert(ios.find(r) == ios.end());
+		if (shardEnd(s) >= r.end_sector()) {
+			break;
+		}
+	}
+
+	if (baseSectors_) {
+		/* without an entry the base layer would be expected */
+		holeInsert(range(hs, he - hs + 1));
+	}
+}
+
+/* stop verifying exactly r, ranges overlapping it are trimmed or split */
+void disk::forgetRange(const range &r) {
+	holeInsert(r);
+	if (baseSectors_ == 0) {
+		/* no base layer, a missing entry is not verified either */
+		forgetIOs(r);
+	}
+}
+
+void disk::holeInsert(const range &r) {
+	writeDone(r.sector, r.nsectors, "", 0);
+}
+
+/* whether b continues a, both holes or the same write at contiguous offsets */
+static bool ioContinues(const IO &a, const IO &b) {
+	if (a.r.end_sector() + 1 != b.r.start_sector() || a.pattern != b.pattern ||
+			(uint64_t) a.r.nsectors + b.r.nsectors > UINT32_MAX) {
+		return false;
+	} else if (a.pattern.empty()) {
+		return true;
+	}
+	auto len = a.pattern.length();
+	return (sector_to_byte(a.r.nsectors) + a.pattern_start) % len == b.pattern_start;
+}
+
+/* merge it into its neighbours where they continue each other */
+void disk::mergeAround(set<IOPtr, IOCompare> &ios, set<IOPtr, IOCompare>::iterator it) {
+	if (it != ios.begin()) {
+		auto prev = std::prev(it);
+		if (ioContinues(**prev, **it)) {
+			/* growing prev into it's sectors keeps the set ordered */
+			(*prev)->r.nsectors += (*it)->r.nsectors;
+			(*prev)->lastUse     = std::max((*prev)->lastUse, (*it)->lastUse);
+			ios.erase(it);
+			it = prev;
+			nmerged_++;
+		}
+	}
+
+	auto next = std::next(it);
+	if (next != ios.end() && ioContinues(**it, **next)) {
+		(*it)->r.nsectors += (*next)->r.nsectors;
+		(*it)->lastUse     = std::max((*it)->lastUse, (*next)->lastUse);
+		ios.erase(next);
+		nmerged_++;
+	}
+}
+
+void disk::writeDone(uint64_t sector, uint32_t nsectors, const string &pattern, const int16_t pattern_start) {
+	auto end = sector + nsectors - 1;
+	auto ps  = pattern_start;
+	for (auto s = sector; ; s = shardEnd(s) + 1) {
+		/* no range crosses shards, each shard gets its part */
+		auto se = MIN(end, shardEnd(s));
+		if (!pattern.empty()) {
+			ps = (sector_to_byte(s - sector) + pattern_start) % pattern.length();
+		}
+		writeDone(shardMap(s), s, se - s + 1, pattern, ps);
+		if (se == end) {
+			break;
+		}
+	}
+}
+
+void disk::writeDone(set<IOPtr, IOCompare> &ios, uint64_t sector, uint32_t nsectors,
+		const string &pattern, const int16_t pattern_start) {
+	range r(sector, nsectors);
+
+	auto nios = r.start_sector(); /* new IO start sector */
+	auto nioe = r.end_sector();   /* new IO end sector   */
+
+	do {
+		auto io = ios.find(r);
+		if (io == ios.end()) {
+			auto newiop = make_shared<IO>(sector, nsectors, pattern, pattern_start);
+			newiop->lastUse = useClock_;
+			mergeAround(ios, ios.insert(newiop).first);
+			break;
+		}
+
+		/* overlapping IO range found */
+		/*
+		std::cout << "Trying to insert " << sector << " " << nsectors << " ";
+		std::cout << "preset " << (*io)->r.sector << " " << (*io)->r.nsectors << std::endl;
+		*/
+
+		auto oios     = (*io)->r.start_sector(); /* old IO start sector */
+		auto oions    = (*io)->r.nsectors;       /* old IO nsectors */
+		auto oioe     = (*io)->r.end_sector();   /* old IO end sector   */
 		auto opattern = (*io)->pattern;
 		auto ops      = (*io)->pattern_start;
 		if (oios == nios && oioe == nioe) {
 			/* exact match - only update pattern */
 			(*io)->pattern       = pattern;
-			(*io)->pattern_start = 0;
+			(*io)->pattern_start = pattern_start;
+			(*io)->lastUse       = useClock_;
+			mergeAround(ios, io);
 			break;
 		}
 
@@ -479,7 +1662,7 @@ void disk::writeDone(uint64_t sector, uint16_t nsectors, const string &pattern,
 				auto ons = oioe - oios + 1;
 				assert(ons != 0);
 
-				writeDone(oios, ons, opattern, ops);
+				writeDone(ios, oios, ons, opattern, ops);
 			} else {
 				if (oios != nios) {
 					auto o1s  = oios;
@@ -487,14 +1670,15 @@ void disk::writeDone(uint64_t sector, uint16_t nsectors, const string &pattern,
 					auto o1b  = opattern;
 
 					assert(o1s + o1ns == nios);
-					writeDone(o1s, o1ns, opattern, ops);
+					writeDone(ios, o1s, o1ns, opattern, ops);
 				}
 
 				auto o2s   = nioe + 1;
 				auto d     = o2s - oios;
 				auto o2ns  = oions - d;
-				int16_t ps = (sector_to_byte(d) + ops) % opattern.size();
-				writeDone(o2s, o2ns, opattern, ps);
+				int16_t ps = opattern.empty() ? 0 :
+					(sector_to_byte(d) + ops) % opattern.size();
+				writeDone(ios, o2s, o2ns, opattern, ps);
 			}
 		} else {
 			/*
@@ -509,127 +1693,748 @@ void disk::writeDone(uint64_t sector, uint16_t nsectors, const string &pattern,
 			auto ns = oions - d; /* calculate nsectors */
 			auto ss = oios + d;  /* start sector number */
 			assert(r.sector + r.nsectors == ss);
-			int16_t ps = (sector_to_byte(d) + ops) % opattern.size(); /* pattern start */
-			writeDone(ss, ns, opattern, ps);
+			int16_t ps = opattern.empty() ? 0 : /* pattern start */
+				(sector_to_byte(d) + ops) % opattern.size();
+			writeDone(ios, ss, ns, opattern, ps);
+		}
+	} while (1);
+}
+
+void ioCompleted(void *cbdata, ManagedBuffer bufp, size_t size, uint64_t offset, ssize_t result, bool read) {
+	assert(cbdata && bufp && result == size && size >= sector_to_byte(1));
+
+	disk     *diskp   = reinterpret_cast<disk *>(cbdata);
+	uint64_t sector   = bytes_to_sector(offset);
+	uint16_t nsectors = bytes_to_sector(size);
+	assert(nsectors >= 1);
+
+	if (read == true) {
+		diskp->readDone(std::move(bufp), sector, nsectors);
+	} else {
+		diskp->writeDone(sector, nsectors, bufp.get());
+		diskp->getAsyncIO().putIOBuffer(std::move(bufp), size);
+	}
+}
+
+void nioCompleted(void *cbdata, uint32_t nios) {
+	assert(cbdata);
+
+	disk *diskp = reinterpret_cast<disk *>(cbdata);
+	diskp->iosSubmit(nios);
+}
+
+void hungIOCompleted(void *cbdata, const SlowIO &io, bool critical) {
+	disk *diskp = reinterpret_cast<disk *>(cbdata);
+	diskp->hungIO(io, critical);
+}
+
+bool disk::runInEventBaseThread(folly::Function<void()> func) {
+	return base.runInEventBaseThread(std::move(func));
+}
+
+/* IO mode and it's timer */
+static void switchIOModeTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->switchIOMode();
+}
+
+void disk::setIOMode(IOMode mode) {
+	this->mode_              = mode;
+	this->ioModeSwitchTimer_ = std::make_unique<TimeoutWrapper>(&base, switchIOModeTCB, this);
+	this->ioModeSwitchTimer_->scheduleTimeout(MIN_TO_MILLI(1));
+}
+
+void disk::switchIOMode() {
+	assert(modeSwitched_ == false);
+
+	IOMode m;
+	switch (this->mode_) {
+	case IOMode::WRITE:
+		m = IOMode::VERIFY;
+		cout << "Setting IO Mode to VERIFY\n";
+		break;
+	case IOMode::VERIFY:
+		m = IOMode::WRITE;
+		cout << "Setting IO Mode to WRITE\n";
+		break;
+	}
+	if (!queues_.empty()) {
+		/* submitter threads switch in queueSwitch() or queueBarrier() */
+		std::lock_guard<std::mutex> l(queueLock_);
+		queueMode_ = m;
+		queueEpoch_.fetch_add(1, std::memory_order_release);
+	} else {
+		modeSwitched_ = true;
+	}
+
+	base.runInEventBaseThread([dpCap = this, mode = m] () {
+		dpCap->setIOMode(mode);
+	});
+}
+
+/* runtime and it's timer handling */
+static void runtimeExpiredTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->runtimeExpired();
+}
+
+void disk::runtimeExpired() {
+	runtimeComplete_ = true;
+	if (!queues_.empty()) {
+		queueStop();
+		return;
+	}
+	if (pendingIOs() == 0) {
+		terminateLoop();
+	}
+}
+
+/* periodic progress report */
+static void reportTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->reportExpired();
+}
+
+void disk::setReportInterval(uint32_t secs) {
+	reportInterval_ = secs;
+}
+
+void disk::reportExpired() {
+	auto secs = (monotonicNs() - startNs_) / 1000000000ull;
+	uint64_t nr, nw, nbr, nbw;
+	getStats(&nr, &nw, &nbr, &nbw);
+	std::shared_lock<std::shared_timed_mutex> l(lock, std::defer_lock);
+	if (!queues_.empty()) {
+		l.lock();
+	}
+	cout << "[" << secs << "s] reads " << nr << " writes " << nw <<
+		" ranges " << mapSize() << " (" << mapSize() * IO_ENTRY_BYTES / 1024 <<
+		"KB) merged " << nmerged_ << " evicted " << nevicted_ << endl;
+	/* the slowest of every submitter thread's slowest */
+	auto    aios = getAsyncIOs();
+	SlowIOs slowest;
+	slowest.setMax(aios[0]->getNSlowIOs());
+	for (auto aiop : aios) {
+		for (auto &slow : aiop->getSlowIOs()) {
+			if (slowest.isSlow(slow.latencyNs)) {
+				slowest.add(slow);
+			}
+		}
+		aiop->clearSlowIOs();
+	}
+	for (auto &slow : slowest.sorted()) {
+		cout << "  slow " << slowIOString(slow, startNs_) << endl;
+	}
+	reportTimer_->scheduleTimeout(SEC_TO_MILLI(reportInterval_));
+}
+
+/* periodic checkpoints of the expected state while writing */
+static void checkpointTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->checkpointExpired();
+}
+
+void disk::setCheckpointInterval(uint32_t secs) {
+	checkpointInterval_ = secs;
+}
+
+void disk::setCheckpointTimer() {
+	if (!state_ || verifyOnly_ || checkpointInterval_ == 0) {
+		return;
+	}
+	checkpointTimer_ = std::make_unique<TimeoutWrapper>(&base, checkpointTCB, this);
+	checkpointTimer_->scheduleTimeout(SEC_TO_MILLI(checkpointInterval_));
+}
+
+void disk::checkpointExpired() {
+	if (!queues_.empty()) {
+		/* a barrier as for a mode switch, in the same mode */
+		std::lock_guard<std::mutex> l(queueLock_);
+		if (queueMode_ == IOMode::WRITE) {
+			queueEpoch_.fetch_add(1, std::memory_order_release);
+		}
+	} else if (stateDirty_ && !filling_) {
+		/* iosSubmit() drains IOs and saves */
+		checkpoint_ = true;
+	}
+	checkpointTimer_->scheduleTimeout(SEC_TO_MILLI(checkpointInterval_));
+}
+
+/* live stats for dvstat */
+static void liveStatsTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->liveStatsExpired();
+}
+
+void disk::setLiveStats(uint32_t intervalMs) {
+	liveStatsInterval_ = intervalMs;
+	liveStats_         = std::make_unique<LiveStatsWriter>(path_);
+}
+
+void disk::liveStatsExpired() {
+	publishLiveStats(true);
+	liveStatsTimer_->scheduleTimeout(liveStatsInterval_);
+}
+
+/* use clock of submitter threads */
+static void useClockTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->useClockExpired();
+}
+
+void disk::useClockExpired() {
+	useClock_.store(useClock_.load(std::memory_order_relaxed) + 1,
+		std::memory_order_relaxed);
+	useClockTimer_->scheduleTimeout(USE_TICK_MS);
+}
+
+void disk::publishLiveStats(bool running) {
+	/* one writer of the seqlock: hungIO() may publish from a submitter thread */
+	std::lock_guard<std::mutex> pl(liveStatsLock_);
+	std::shared_lock<std::shared_timed_mutex> l(lock, std::defer_lock);
+	if (!queues_.empty()) {
+		l.lock();
+	}
+	auto sp = liveStats_->begin();
+	sp->pid            = getpid();
+	sp->running        = running;
+	sp->elapsedNs      = monotonicNs() - startNs_;
+	getStats(&sp->nreads, &sp->nwrites, &sp->nbytesRead, &sp->nbytesWrote);
+	sp->pending        = asyncio.getPending();
+	for (auto &qp : queues_) {
+		sp->pending   += qp->getPending();
+	}
+	sp->nranges        = mapSize();
+	sp->mapBytes       = sp->nranges * IO_ENTRY_BYTES;
+	sp->nbytesCompared = getNBytesCompared();
+	sp->ncorruptions   = ncorruptions_;
+	sp->readLatency    = LatencyHistogram();
+	sp->writeLatency   = LatencyHistogram();
+	for (auto aiop : getAsyncIOs()) {
+		for (auto polling : {false, true}) {
+			aiop->mergeLatency(sp->readLatency, polling, true);
+			aiop->mergeLatency(sp->writeLatency, polling, false);
+		}
+	}
+	liveStats_->end();
+}
+
+/* hung IO watchdog */
+void disk::setHungIO(uint32_t warnMs, uint32_t critMs, bool abort) {
+	hungAbort_ = abort;
+	for (auto aiop : getAsyncIOs()) {
+		aiop->setWatchdog(warnMs, critMs, hungIOCompleted, this);
+	}
+}
+
+void disk::hungIO(const SlowIO &io, bool critical) {
+	cout << "Hung IO " << (critical ? "critical" : "warning") << ": " <<
+		(io.read ? "read" : "write") << " sector " << bytes_to_sector(io.offset) <<
+		" nsectors " << bytes_to_sector(io.size) << " age " <<
+		io.latencyNs / 1000000 << "ms inflight " << io.inflight << endl;
+	if (!critical || !hungAbort_) {
+		return;
+	}
+
+	/* the device may never complete it, do not wait on anything IO */
+	cout << "Aborting, IO pending for over its critical deadline" << endl;
+	if (reporter_) {
+		reporter_->flush();
+	}
+	if (liveStats_) {
+		publishLiveStats(false);
+	}
+
+	/*
+	 * Other threads keep running: exit() would run destructors under them,
+	 * unmapping the buffer arena the device may still DMA into.
+	 */
+	cout.flush();
+	_exit(HUNG_IO_EXIT);
+}
+
+/* completion modes and the event loop */
+void disk::setCompletionMode(CompletionMode mode, uint64_t spinUs, uint64_t sleepUs) {
+	completion_  = mode;
+	pollSpinNs_  = spinUs * 1000;
+	pollSleepUs_ = sleepUs;
+	asyncio.setPolling(mode == CompletionMode::POLL);
+	for (auto &qp : queues_) {
+		/* compare is refused with submitter threads */
+		if (mode == CompletionMode::POLL) {
+			qp->setPolling(pollSpinNs_, pollSleepUs_);
 		}
-	} while (1);
+	}
 }
 
-void ioCompleted(void *cbdata, ManagedBuffer bufp, size_t size, uint64_t offset, ssize_t result, bool read) {
-	assert(cbdata && bufp && result == size && size >= sector_to_byte(1));
+static void completionSwitchTCB(void *cbdp) {
+	disk *dp = reinterpret_cast<disk *>(cbdp);
+	dp->completionSwitchExpired();
+}
 
-	disk     *diskp   = reinterpret_cast<disk *>(cbdata);
-	uint64_t sector   = bytes_to_sector(offset);
-	uint16_t nsectors = bytes_to_sector(size);
-	assert(nsectors >= 1);
+void disk::setCompletionSwitchTimer() {
+	completionSwitchTimer_ = std::make_unique<TimeoutWrapper>(&base,
+			completionSwitchTCB, this);
+	completionSwitchTimer_->scheduleTimeout(SEC_TO_MILLI(runtime_) / 2);
+}
 
-	if (read == true) {
-		char *bp = bufp.get();
-		diskp->readDone(bp, sector, nsectors);
+void disk::completionSwitchExpired() {
+	if (runtimeComplete_) {
+		return;
+	}
+	completionSwitch_ = true;
+	if (pendingIOs() == 0) {
+		terminateLoop();
+	}
+}
+
+void disk::terminateLoop() {
+	loopStop_ = true;
+	base.terminateLoopSoon();
+}
+
+void disk::runLoop() {
+	if (asyncio.getPolling()) {
+		pollLoop();
 	} else {
-		diskp->writeDone(sector, nsectors);
+		base.loopForever();
 	}
 }
 
-void nioCompleted(void *cbdata, uint16_t nios) {
-	assert(cbdata);
+/*
+ * Reap completions (which submit more IOs) without waiting for the eventfd.
+ * Timers and functions queued to the event base are run every millisecond.
+ */
+void disk::pollLoop() {
+	const uint64_t LOOP_NS = 1000000;
+
+	auto now       = monotonicNs();
+	auto idleSince = now;
+	auto lastLoop  = now;
+	while (!loopStop_) {
+		auto n = asyncio.poll();
+		now    = monotonicNs();
+		if (n) {
+			idleSince = now;
+		} else if (pollSleepUs_ && now - idleSince >= pollSpinNs_) {
+			usleep(pollSleepUs_);
+		}
 
-	disk *diskp = reinterpret_cast<disk *>(cbdata);
-	diskp->iosSubmit(nios);
+		if (now - lastLoop >= LOOP_NS) {
+			base.loopOnce(EVLOOP_NONBLOCK);
+			lastLoop = now;
+		}
+	}
 }
 
-bool disk::runInEventBaseThread(folly::Function<void()> func) {
-	return base.runInEventBaseThread(std::move(func));
+void disk::setRuntimeTimer() {
+	assert(runtimeComplete_ == false);
+	runtimeTimer_ = std::make_unique<TimeoutWrapper>(&base, runtimeExpiredTCB, this);
+	runtimeTimer_->scheduleTimeout(SEC_TO_MILLI(runtime_));
 }
 
-/* IO mode and it's timer */
-static void switchIOModeTCB(void *cbdp) {
-	disk *dp = reinterpret_cast<disk *>(cbdp);
-	dp->switchIOMode();
+void disk::replayTrace(const string &path, const string &format) {
+	auto reader = openTrace(path, format);
+	replay_ = std::make_unique<TraceReplay>(std::move(reader), 0,
+			ioNSectors(), MAX_IO_SECTORS);
 }
 
-void disk::setIOMode(IOMode mode) {
-	this->mode_              = mode;
-	this->ioModeSwitchTimer_ = std::make_unique<TimeoutWrapper>(&base, switchIOModeTCB, this);
-	this->ioModeSwitchTimer_->scheduleTimeout(MIN_TO_MILLI(1));
+/* expected state map persistence */
+void disk::setStateFile(const string &path, bool verifyOnly, bool allowDirty) {
+	state_      = std::make_unique<StateFile>(path);
+	verifyOnly_ = verifyOnly;
+	loadState(allowDirty);
+	if (verifyOnly_ && getNRanges() == 0) {
+		throw runtime_error("Nothing to verify in state file " + path);
+	}
 }
 
-void disk::switchIOMode() {
-	assert(modeSwitched_ == false);
+void disk::loadState(bool allowDirty) {
+	assert(state_ && getNRanges() == 0);
+	if (!state_->load(sectors_, allowDirty)) {
+		return;
+	}
 
-	IOMode m;
-	switch (this->mode_) {
-	case IOMode::WRITE:
-		m = IOMode::VERIFY;
-		cout << "Setting IO Mode to VERIFY\n";
-		break;
-	case IOMode::VERIFY:
-		m = IOMode::WRITE;
-		cout << "Setting IO Mode to WRITE\n";
-		break;
+	if (state_->flags() & StateFile::FLAG_BASE) {
+		baseSectors_ = state_->ioSectors();
 	}
-	modeSwitched_ = true;
 
-	base.runInEventBaseThread([dpCap = this, mode = m] () {
-		dpCap->setIOMode(mode);
+	auto rp = state_->records();
+	auto n  = state_->nrecords();
+	for (auto e = rp + n; rp < e; rp++) {
+		string p;
+		if (rp->pattern_nsectors) {
+			patternCreate(rp->pattern_sector, rp->pattern_nsectors, p);
+		}
+
+		/* records are sorted on sector, one crossing shards is split */
+		auto end = rp->sector + rp->nsectors - 1;
+		for (auto s = rp->sector; ; s = shardEnd(s) + 1) {
+			auto    se = MIN(end, shardEnd(s));
+			int16_t ps = p.empty() ? rp->pattern_start :
+				(sector_to_byte(s - rp->sector) + rp->pattern_start) % p.length();
+			auto &ios = shardMap(s);
+			ios.emplace_hint(ios.end(), make_shared<IO>(s, se - s + 1, p, ps));
+			if (se == end) {
+				break;
+			}
+		}
+	}
+	assert(getNRanges() >= n);
+}
+
+void disk::saveState() {
+	if (!state_ || !stateDirty_) {
+		return;
+	}
+
+	/* journaled writes are part of the state being saved */
+	if (journal_) {
+		journal_->flush();
+	}
+
+	/* IOs in flight can not be accounted for */
+	assert(pendingIOs() == 0);
+	auto flags = baseSectors_ ? StateFile::FLAG_BASE : 0;
+	auto ioSectors = baseSectors_ ? baseSectors_ : ioNSectors();
+	state_->save(sectors_, ioSectors, getNRanges(), flags, [this] (state_record *rp) {
+		for (auto &sp : shards_) {
+			for (auto &io : sp->ios) {
+				std::memset(rp, 0, sizeof(*rp));
+				rp->sector        = io->r.sector;
+				rp->nsectors      = io->r.nsectors;
+				rp->pattern_start = io->pattern_start;
+				if (!io->pattern.empty()) {
+					auto rc = patternDecode(io->pattern, rp->pattern_sector,
+							rp->pattern_nsectors);
+					assert(rc == true);
+				}
+				rp++;
+			}
+		}
 	});
+	stateDirty_ = false;
+
+	if (journal_) {
+		journal_->reset(state_->generation());
+	}
 }
 
-/* runtime and it's timer handling */
-static void runtimeExpiredTCB(void *cbdp) {
-	disk *dp = reinterpret_cast<disk *>(cbdp);
-	dp->runtimeExpired();
+void disk::markStateDirty() {
+	if (state_ && !stateDirty_) {
+		state_->markDirty();
+		stateDirty_ = true;
+	}
 }
 
-void disk::runtimeExpired() {
-	runtimeComplete_ = true;
-	if (asyncio.getPending() == 0) {
-		base.terminateLoopSoon();
+/* acknowledged write journal and post power loss check */
+void disk::setJournal(const string &path) {
+	if (state_ && state_->dirty()) {
+		/* killed or crashed, what it wrote since the save is journaled */
+		std::multimap<uint64_t, uint16_t> intents;
+		size_t n;
+		if (!applyJournal(path, intents, &n)) {
+			throw runtime_error("journal " + path + " does not cover the "
+				"writes since the state file was saved");
+		}
+		/* whether writes in flight at the crash reached the device is unknown */
+		for (auto &it : intents) {
+			forgetIOs(range(it.first, it.second));
+		}
+		cout << "Replayed " << n << " journal records, " << intents.size() <<
+			" writes in flight forgotten" << endl;
+
+		/* the journal is reset on top of this save, it must be CLEAN first */
+		stateDirty_ = true;
+		saveState();
+	} else if (state_ && state_->generation() == 0) {
+		/* nothing saved yet, journaled records need a save to apply to */
+		stateDirty_ = true;
+		saveState();
 	}
+	journal_ = std::make_unique<WriteJournal>(path, sectors_, fd);
+	journal_->reset(state_ ? state_->generation() : 0);
 }
 
-void disk::setRuntimeTimer() {
-	assert(runtimeComplete_ == false);
-	runtimeTimer_ = std::make_unique<TimeoutWrapper>(&base, runtimeExpiredTCB, this);
-	runtimeTimer_->scheduleTimeout(SEC_TO_MILLI(runtime_));
+/*
+ * Rebuild expected state as of the last durable write, applying the journal
+ * on top of the loaded state file. Writes with an intent but no WRITE or
+ * FORGET record yet are left in intents: they may or may not have reached the
+ * media, their sectors can hold either pattern. Returns false if the journal
+ * is older than the state file, it has nothing to add.
+ */
+bool disk::applyJournal(const string &path,
+		std::multimap<uint64_t, uint16_t> &intents, size_t *nrecordsp) {
+	vector<journal_record> records;
+	auto epoch = WriteJournal::replay(path, sectors_,
+			[&records] (const journal_record &jr) {
+		records.push_back(jr);
+	});
+
+	*nrecordsp      = 0;
+	auto generation = state_ ? state_->generation() : 0;
+	if (epoch > generation) {
+		throw runtime_error("journal " + path + " is newer than the state file");
+	} else if (epoch < generation) {
+		return false;
+	}
+
+	for (auto &jr : records) {
+		range r(jr.sector, jr.nsectors);
+		if (jr.op == JournalOp::INTENT) {
+			intents.emplace(jr.sector, jr.nsectors);
+			continue;
+		}
+
+		auto er = intents.equal_range(jr.sector);
+		for (auto it = er.first; it != er.second; ++it) {
+			if (it->second == jr.nsectors) {
+				intents.erase(it);
+				break;
+			}
+		}
+		if (jr.op == JournalOp::FORGET) {
+			forgetIOs(r);
+			continue;
+		}
+
+		string p;
+		patternCreate(jr.sector, jr.nsectors, p);
+		writeDone(jr.sector, jr.nsectors, p, 0);
+	}
+	*nrecordsp = records.size();
+	return true;
+}
+
+void disk::checkJournal(const string &path) {
+	size_t n;
+	if (!applyJournal(path, checkIntents_, &n)) {
+		/* crashed after saving state, before the journal was reset */
+		cout << "Journal " << path << " is covered by the state file" << endl;
+	}
+	if (getNRanges() == 0) {
+		throw runtime_error("Nothing to check in journal " + path);
+	}
+
+	cout << "Replayed " << n << " journal records, " <<
+		getNRanges() << " ranges to check, " << checkIntents_.size() <<
+		" writes in flight" << endl;
+	checkMode_  = true;
+	verifyOnly_ = true;
+	stateDirty_ = false;
+}
+
+/* does sector hold the data of a write in flight at the power loss */
+bool disk::checkInflight(const char *const sp, uint64_t sector) {
+	auto lo = sector >= MAX_IO_SECTORS ? sector - MAX_IO_SECTORS + 1 : 0;
+	auto e  = checkIntents_.upper_bound(sector);
+	for (auto it = checkIntents_.lower_bound(lo); it != e; ++it) {
+		if (sector >= it->first + it->second) {
+			continue;
+		}
+
+		string   p;
+		uint64_t fs;
+		uint32_t fns;
+		patternCreate(it->first, it->second, p);
+		auto ps = sector_to_byte(sector - it->first) % p.length();
+		if (sectorClassify(sp, sector, p, ps, &fs, &fns) == SectorState::MATCH) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void disk::checkRead(const char *const bufp, uint64_t sector, uint16_t nsectors) {
+	auto &ios = shardMap(sector);
+	auto io   = ios.find(range(sector, nsectors));
+	assert(io != ios.end() && (*io)->r.start_sector() <= sector &&
+			(*io)->r.end_sector() >= sector + nsectors - 1);
+
+	auto     &pattern = (*io)->pattern;
+	if (pattern.empty()) {
+		/* hole, nothing known about its data */
+		return;
+	}
+	uint64_t counts[(int) SectorState::MAX] = {};
+	uint64_t fs  = 0;
+	uint32_t fns = 0;
+	for (uint16_t i = 0; i < nsectors; i++) {
+		auto d  = sector + i - (*io)->r.start_sector();
+		auto ps = (sector_to_byte(d) + (*io)->pattern_start) % pattern.length();
+		auto st = sectorClassify(bufp + sector_to_byte(i), sector + i,
+				pattern, ps, &fs, &fns);
+		if (st != SectorState::MATCH && checkInflight(bufp + sector_to_byte(i),
+				sector + i)) {
+			st = SectorState::MATCH;
+			checkStats_.inflight++;
+		}
+		counts[(int) st]++;
+		checkStats_.sectors[(int) st]++;
+	}
+
+	checkStats_.nranges++;
+	auto match = counts[(int) SectorState::MATCH];
+	auto torn  = counts[(int) SectorState::TORN];
+	if (match == nsectors) {
+		checkStats_.intact++;
+		return;
+	}
+
+	string found;
+	if (fns) {
+		patternCreate(fs, fns, found);
+	}
+
+	if (match == 0 && torn == 0) {
+		checkStats_.oldData++;
+		cout << "OLD-DATA";
+	} else {
+		checkStats_.torn++;
+		cout << "TORN";
+	}
+	cout << " sector " << sector << " nsectors " << nsectors <<
+		" expected " << pattern << " found " << (found.empty() ? "-" : found);
+	for (int i = 0; i < (int) SectorState::MAX; i++) {
+		if (counts[i]) {
+			cout << " " << sectorStateName((SectorState) i) << "=" << counts[i];
+		}
+	}
+	cout << endl;
 }
 
 int disk::verify() {
+	if (!queues_.empty()) {
+		return verifyQueues();
+	}
+
 	asyncio.init(&base);
 	asyncio.registerCallback(ioCompleted, nioCompleted, this);
 
-	setIOMode(IOMode::WRITE);
+	if (verifyOnly_) {
+		/* read back what an earlier run wrote */
+		mode_ = IOMode::VERIFY;
+	} else if (!replay_) {
+		/* trace replay mixes reads and writes, no need to switch modes */
+		setIOMode(IOMode::WRITE);
+	}
 	setRuntimeTimer();
+	setCheckpointTimer();
+	startNs_ = monotonicNs();
+	if (reportInterval_) {
+		reportTimer_   = std::make_unique<TimeoutWrapper>(&base, reportTCB, this);
+		reportTimer_->scheduleTimeout(SEC_TO_MILLI(reportInterval_));
+	}
+	if (liveStats_) {
+		liveStatsTimer_ = std::make_unique<TimeoutWrapper>(&base, liveStatsTCB, this);
+		liveStatsTimer_->scheduleTimeout(liveStatsInterval_);
+	}
+	if (completion_ == CompletionMode::COMPARE) {
+		setCompletionSwitchTimer();
+	}
 	auto rc = iosSubmit(iodepth_);
 	assert(rc == 0);
 
-	base.loopForever();
+	runLoop();
 	// rc = event_base_dispatch(ebp);
+
+	if (completionSwitch_) {
+		/* second half of a compare run */
+		completionSwitch_ = false;
+		loopStop_         = false;
+		asyncio.setPolling(true);
+		cout << "Switching to polling completions\n";
+
+		rc = iosSubmit(iodepth_);
+		assert(rc == 0);
+		runLoop();
+	}
+
+	/* wait for verifications still running */
+	while (verifyPool_ && verifyPool_->outstanding()) {
+		verifyCollect();
+		usleep(50);
+	}
+	if (reporter_) {
+		reporter_->flush();
+	}
+	if (liveStats_) {
+		liveStatsTimer_->cancelTimeout();
+		publishLiveStats(false);
+	}
+
+	if (pendingIOs() == 0) {
+		saveState();
+	} else if (state_ && stateDirty_) {
+		cout << "IOs in flight, expected state is not saved.\n";
+	}
+	return 0;
+}
+
+/*
+ * Start the submitter threads and run timers on this thread until every one
+ * of them finished: runtime expired or, without a reporter, a corruption.
+ */
+int disk::verifyQueues() {
+	setIOMode(IOMode::WRITE);
+	setRuntimeTimer();
+	setCheckpointTimer();
+	startNs_ = monotonicNs();
+	if (reportInterval_) {
+		reportTimer_   = std::make_unique<TimeoutWrapper>(&base, reportTCB, this);
+		reportTimer_->scheduleTimeout(SEC_TO_MILLI(reportInterval_));
+	}
+	if (liveStats_) {
+		liveStatsTimer_ = std::make_unique<TimeoutWrapper>(&base, liveStatsTCB, this);
+		liveStatsTimer_->scheduleTimeout(liveStatsInterval_);
+	}
+	if (mapBudget_) {
+		useClockTimer_ = std::make_unique<TimeoutWrapper>(&base, useClockTCB, this);
+		useClockTimer_->scheduleTimeout(USE_TICK_MS);
+	}
+	markStateDirty();
+
+	queueNRanges_ = getNRanges();
+	queueRunning_ = queues_.size();
+	for (auto &qp : queues_) {
+		qp->start(numaNode_);
+	}
+	base.loopForever();
+	for (auto &qp : queues_) {
+		qp->join();
+	}
+
+	if (reporter_) {
+		reporter_->flush();
+	}
+	if (liveStats_) {
+		liveStatsTimer_->cancelTimeout();
+		publishLiveStats(false);
+	}
+	saveState();
+	return 0;
 }
 
 void disk::cleanupEverything() {
-	ios.erase(ios.begin(), ios.end());
+	for (auto &sp : shards_) {
+		sp->ios.clear();
+	}
 }
 
 void disk::testReadSubmit(uint64_t s, uint16_t ns) {
-	struct iocb *ios[1];
-	struct iocb cb;
 	size_t      sz;
 	uint64_t    o;
 	
 	sz        = sector_to_byte(ns);
 	o         = sector_to_byte(s);
 	auto bufp = getIOBuffer(sz);
-	ios[0]    = &cb;
-	asyncio.preadPrepare(&cb, fd, std::move(bufp), sz, o);
+	asyncio.preadQueue(fd, std::move(bufp), sz, o);
 
-	auto rc = asyncio.pread(ios, 1);
+	auto rc = asyncio.flush();
 	assert(rc == 1);
 }
 
 void disk::testWriteSubmit(uint64_t s, uint16_t ns) {
-	struct iocb *ios[1];
-	struct iocb cb;
 	size_t      sz;
 	uint64_t    o;
 
@@ -639,10 +2444,10 @@ void disk::testWriteSubmit(uint64_t s, uint16_t ns) {
 	sz        = sector_to_byte(ns);
 	o         = sector_to_byte(s);
 	auto bufp = prepareIOBuffer(sz, p);
-	ios[0]    = &cb;
-	asyncio.pwritePrepare(&cb, fd, std::move(bufp), sz, o);
+	addWriteIORange(s, ns, bufp.get());
+	asyncio.pwriteQueue(fd, std::move(bufp), sz, o);
 
-	auto rc = asyncio.pwrite(ios, 1);
+	auto rc = asyncio.flush();
 	assert(rc == 1);
 }
 
@@ -661,37 +2466,37 @@ void disk::testWriteOnceReadMany() {
 		base.loopOnce();
 	}
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testOverWrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 	for (auto step = 1; step < 16; step++) {
 		for (int16_t ns = 16, c = 0; ns > 0; ns-=step, c++) {
 			testWriteSubmit(512, ns);
 			base.loopOnce();
-			assert(ios.size() == c+1);
+			assert(getNRanges() == c+1);
 			testReadSubmit(500, 50);
 			base.loopOnce();
 		}
 		cleanupEverything();
-		assert(ios.size() == 0);
+		assert(getNRanges() == 0);
 	}
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	for (auto step = 1; step < 160; step++) {
 		for (int16_t ns = 160, c = 0; ns > 0; ns-=step, c++) {
 			testWriteSubmit(100, ns);
 			base.loopOnce();
-			assert(ios.size() == c+1);
+			assert(getNRanges() == c+1);
 			testReadSubmit(98, 200);
 			base.loopOnce();
 		}
 		cleanupEverything();
-		assert(ios.size() == 0);
+		assert(getNRanges() == 0);
 	}
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testNO2() {
@@ -702,11 +2507,11 @@ W 8081398 1093
 R 8082135 8
 */
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(8081398, 1404);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 #if 0
 	cout << "1\n";
 	for (auto &io : ios) {
@@ -716,28 +2521,28 @@ R 8082135 8
 
 	testWriteSubmit(8081398, 909);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 
 	testWriteSubmit(8081398, 1093);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(8082135, 8);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testNO1() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	const uint64_t SECTOR = 1783797;
 
 	testWriteSubmit(SECTOR, 1207);
 	base.loopOnce();
-	assert(ios.size() == 1);
-	for (auto &io : ios) {
+	assert(getNRanges() == 1);
+	for (auto &io : shardMap(SECTOR)) {
 		string p;
 		patternCreate(SECTOR, 1207, p);
 		assert(io->r.sector == SECTOR && io->r.nsectors == 1207 &&
@@ -748,9 +2553,9 @@ void disk::testNO1() {
 	auto sz = sector_to_byte(ns);
 	testWriteSubmit(SECTOR, ns);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	int c = 0;
-	for (auto &io : ios) {
+	for (auto &io : shardMap(SECTOR)) {
 		if (c == 0) {
 			string p;
 			patternCreate(SECTOR, ns, p);
@@ -770,9 +2575,9 @@ void disk::testNO1() {
 	auto sz1 = sector_to_byte(ns1);
 	testWriteSubmit(SECTOR, 16);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	c = 0;
-	for (auto &io : ios) {
+	for (auto &io : shardMap(SECTOR)) {
 		if (c == 0) {
 			string p;
 			patternCreate(SECTOR, ns1, p);
@@ -792,317 +2597,317 @@ void disk::testNO1() {
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testNoOverlap() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 3000);
 	base.loopOnce();
 
 	testWriteSubmit(2000, 500);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(1000, 3000);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testExactOverwrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testTailExactOverwrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(1300, 200);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testHeadExactOverwrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(1000, 100);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testDoubleSplit() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(1200, 100);
 	base.loopOnce();
-	assert(ios.size() == 3);
+	assert(getNRanges() == 3);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testTailOverwrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(1300, 500);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(1000, 1000);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testHeadOverwrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(800, 500);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(500, 2000);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testCompleteOverwrite() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 100);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	testWriteSubmit(1000, 500);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(1000, 500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testHeadSideSplit() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 2000);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1000, 100);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1000, 200);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1300, 200);
 	base.loopOnce();
-	assert(ios.size() == 4);
+	assert(getNRanges() == 4);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1600, 600);
 	base.loopOnce();
-	assert(ios.size() == 6);
+	assert(getNRanges() == 6);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1400, 600);
 	base.loopOnce();
-	assert(ios.size() == 6);
+	assert(getNRanges() == 6);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1100, 20);
 	base.loopOnce();
-	assert(ios.size() == 8);
+	assert(getNRanges() == 8);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testMid() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 2000);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1500, 50);
 	base.loopOnce();
-	assert(ios.size() == 3);
+	assert(getNRanges() == 3);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1300, 350);
 	base.loopOnce();
-	assert(ios.size() == 3);
+	assert(getNRanges() == 3);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1200, 500);
 	base.loopOnce();
-	assert(ios.size() == 3);
+	assert(getNRanges() == 3);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1600, 10);
 	base.loopOnce();
-	assert(ios.size() == 5);
+	assert(getNRanges() == 5);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1350, 300);
 	base.loopOnce();
-	assert(ios.size() == 5);
+	assert(getNRanges() == 5);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::testTailSideSplit() {
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(1000, 2000);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(2500, 500);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(2000, 1000);
 	base.loopOnce();
-	assert(ios.size() == 2);
+	assert(getNRanges() == 2);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(2200, 500);
 	base.loopOnce();
-	assert(ios.size() == 4);
+	assert(getNRanges() == 4);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(2200, 600);
 	base.loopOnce();
-	assert(ios.size() == 4);
+	assert(getNRanges() == 4);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(2100, 300);
 	base.loopOnce();
-	assert(ios.size() == 5);
+	assert(getNRanges() == 5);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1500, 300);
 	base.loopOnce();
-	assert(ios.size() == 7);
+	assert(getNRanges() == 7);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	testWriteSubmit(1700, 500);
 	base.loopOnce();
-	assert(ios.size() == 6);
+	assert(getNRanges() == 6);
 	testReadSubmit(800, 2500);
 	base.loopOnce();
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 }
 
 void disk::_testSectorReads(uint64_t sector, uint16_t nsectors) {
@@ -1119,11 +2924,11 @@ void disk::testSectorReads() {
 	const uint16_t NSECTORS = 500;
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
 
 	testWriteSubmit(SECTOR, NSECTORS);
 	base.loopOnce();
-	assert(ios.size() == 1);
+	assert(getNRanges() == 1);
 	_testSectorReads(SECTOR, NSECTORS);
 
 	for (auto s = SECTOR; s < (SECTOR + NSECTORS); s += 2) {
@@ -1133,13 +2938,312 @@ void disk::testSectorReads() {
 	}
 
 	cleanupEverything();
-	assert(ios.size() == 0);
+	assert(getNRanges() == 0);
+}
+
+/*
+ * Differential test of writeDone against a per sector reference of the write
+ * each sector last saw. Writes are applied to the map directly without IO.
+ * Every read's data is built from the reference and must verify against the
+ * map, with unwritten sectors filled with junk the map must not claim. The
+ * same data with one byte flipped in a written sector must not verify.
+ */
+/* base starts from a prefilled region, forgotten ranges become holes */
+void disk::testRandomOverwrites(uint64_t nwrites, uint32_t seed, bool base,
+		uint64_t maxRanges, uint64_t shardSectors) {
+	const uint64_t REGION       = 2 * MAX_IO_SECTORS + 100;
+	const uint16_t MAX_WRITE    = 64;
+	const uint16_t MAX_READ     = 256;
+	const uint64_t READ_EVERY   = 16;
+	const uint64_t FORGET_EVERY = 64;
+	const char     UNWRITTEN    = (char) 0xa5;
+
+	cleanupEverything();
+	assert(getNRanges() == 0);
+	if (shardSectors) {
+		/* ranges split at shard boundaries, as with submitter threads */
+		setMapShards(shardSectors);
+	}
+
+	/* refNSectors 0: never written or forgotten, data is not verified */
+	vector<uint64_t> refSector(REGION);
+	vector<uint16_t> refNSectors(REGION, 0);
+	crand            rand(seed);
+	uint64_t         nreads = 0;
+
+	baseSectors_ = base ? REGION : 0;
+	setMapBudget(maxRanges * IO_ENTRY_BYTES);
+	for (uint64_t i = 0; i < baseSectors_; i++) {
+		refSector[i]   = i / MAX_IO_SECTORS * MAX_IO_SECTORS;
+		refNSectors[i] = MIN(REGION - refSector[i], MAX_IO_SECTORS);
+	}
+
+	auto buf = getIOBuffer(sector_to_byte(MAX_READ));
+	for (uint64_t w = 0; w < nwrites; w++) {
+		uint16_t ns = 1 + crand::bound(rand.next(), MAX_WRITE);
+		uint64_t s  = crand::bound(rand.next(), REGION - ns + 1);
+
+		if (w % FORGET_EVERY == FORGET_EVERY - 1) {
+			forgetRange(range(s, ns));
+			for (auto i = s; i < s + ns; i++) {
+				refNSectors[i] = 0;
+			}
+			continue;
+		}
+
+		string p;
+		patternCreate(s, ns, p);
+		useClock_++;
+		writeDone(s, ns, p, 0);
+		for (auto i = s; i < s + ns; i++) {
+			refSector[i]   = s;
+			refNSectors[i] = ns;
+		}
+
+		if (maxRanges && getNRanges() > evictSize_) {
+			/* evicted sectors are no longer verified */
+			mapEvict();
+			assert(getNRanges() <= maxRanges);
+			for (auto &sp : shards_) {
+				for (auto &io : sp->ios) {
+					for (auto i = io->r.start_sector(); io->pattern.empty() &&
+							i <= io->r.end_sector(); i++) {
+						refNSectors[i] = 0;
+					}
+				}
+			}
+		}
+
+		if (w % READ_EVERY) {
+			continue;
+		}
+
+		/* read back a random range */
+		uint16_t rns = 1 + crand::bound(rand.next(), MAX_READ);
+		uint64_t rs  = crand::bound(rand.next(), REGION - rns + 1);
+		auto     bp  = buf.get();
+		int64_t  written = -1;
+		for (uint16_t i = 0; i < rns; i++) {
+			auto sp  = bp + sector_to_byte(i);
+			auto sec = rs + i;
+			if (refNSectors[sec] == 0) {
+				std::memset(sp, UNWRITTEN, sector_to_byte(1));
+				continue;
+			}
+
+			string rp;
+			patternCreate(refSector[sec], refNSectors[sec], rp);
+			auto len = rp.length();
+			auto off = sector_to_byte(sec - refSector[sec]) % len;
+			for (size_t b = 0; b < sector_to_byte(1); ) {
+				auto cl = MIN(len - off, sector_to_byte(1) - b);
+				std::memcpy(sp + b, rp.c_str() + off, cl);
+				b  += cl;
+				off = 0;
+			}
+			written = i;
+		}
+
+		readDataVerify(bp, rs, rns);
+		vector<IO> expected;
+		snapshotExpected(rs, rns, expected);
+		verifyExpected(bp, rs, rns, expected);
+		verifyExpected(bp, rs, rns, expected, VerifyDepth::EDGES);
+		nreads++;
+
+		if (written < 0) {
+			continue;
+		}
+
+		/* corrupt one byte of a written sector */
+		auto co = crand::bound(rand.next(), sector_to_byte(1));
+		auto cp = bp + sector_to_byte(written) + co;
+		*cp ^= 0x1;
+		auto detected = false;
+		try {
+			readDataVerify(bp, rs, rns);
+		} catch (Corruption &c) {
+			detected = true;
+		}
+		assert(detected == true);
+		detected = false;
+		try {
+			verifyExpected(bp, rs, rns, expected);
+		} catch (Corruption &c) {
+			detected = true;
+		}
+		assert(detected == true);
+		detected = false;
+		try {
+			verifyExpected(bp, rs, rns, expected, VerifyDepth::EDGES);
+		} catch (Corruption &c) {
+			detected = true;
+		}
+		assert(detected == (co < EDGE_BYTES || co >= sector_to_byte(1) - EDGE_BYTES));
+
+		/* the whole bad extent, across the pieces of the read */
+		auto extents = corruptExtents(bp, rs, rns, expected);
+		assert(extents.size() == 1 && extents[0].sector == rs + written &&
+			extents[0].nsectors == 1);
+		if (written > 0 && refNSectors[rs + written - 1]) {
+			auto pp = bp + sector_to_byte(written - 1);
+			*pp ^= 0x1;
+			extents = corruptExtents(bp, rs, rns, expected);
+			assert(extents.size() == 1 && extents[0].sector == rs + written - 1 &&
+				extents[0].nsectors == 2);
+			*pp ^= 0x1;
+		}
+		*cp ^= 0x1;
+	}
+
+	/*
+	 * every map entry must be backed by the reference, holes by nothing,
+	 * and stay within its shard
+	 */
+	uint64_t last = 0;
+	for (auto &sp : shards_) {
+		for (auto &io : sp->ios) {
+			auto s = io->r.start_sector();
+			assert(s >= last && (base || !io->pattern.empty()));
+			assert(&shardMap(s) == &sp->ios && shardEnd(s) >= io->r.end_sector());
+			for (auto i = s; i <= io->r.end_sector(); i++) {
+				assert(i < REGION && io->pattern.empty() == (refNSectors[i] == 0));
+			}
+			last = io->r.end_sector() + 1;
+		}
+	}
+
+	/* and every written sector expected with the pattern of its last write */
+	vector<bool> covered(REGION, false);
+	for (uint64_t s = 0; s < REGION; s += MAX_READ) {
+		vector<IO> expected;
+		snapshotExpected(s, MIN(REGION - s, MAX_READ), expected);
+		for (auto &io : expected) {
+			if (io.pattern.empty()) {
+				continue;
+			}
+
+			uint64_t ps;
+			uint32_t pns;
+			auto rc = patternDecode(io.pattern, ps, pns);
+			assert(rc == true);
+			auto len = io.pattern.length();
+			for (auto i = io.r.start_sector(); i <= io.r.end_sector(); i++) {
+				assert(refNSectors[i] && refSector[i] == ps && refNSectors[i] == pns);
+				assert((sector_to_byte(i - io.r.sector) + io.pattern_start) % len ==
+					sector_to_byte(i - ps) % len);
+				covered[i] = true;
+			}
+		}
+	}
+	for (uint64_t i = 0; i < REGION; i++) {
+		assert(covered[i] == (refNSectors[i] != 0));
+	}
+
+	cout << "Random overwrites " << nwrites << " writes " << nreads <<
+		" reads, " << getNRanges() << " ranges" << (base ? " on base layer" : "");
+	if (maxRanges) {
+		cout << ", " << nevicted_ << " evicted";
+	}
+	if (shardSectors) {
+		cout << ", " << shards_.size() << " shards";
+	}
+	cout << endl;
+	cleanupEverything();
+	baseSectors_ = 0;
+	setMapBudget(0);
+	nevicted_    = 0;
+	if (shardSectors) {
+		setMapShards(sectors_);
+	}
+	assert(getNRanges() == 0);
+}
+
+struct TestTimer : public TimerWheel::Entry {
+	uint64_t due;
+	uint32_t nfired = 0;
+	bool     cancel = false;
+	bool     rearm  = false;
+};
+
+struct TestWheel {
+	TimerWheel *wheelp;
+	uint64_t   now;
+};
+
+static void testTimerExpired(void *cbdatap, TimerWheel::Entry *ep) {
+	auto twp = static_cast<TestWheel *>(cbdatap);
+	auto tp  = static_cast<TestTimer *>(ep);
+	assert(!tp->cancel && tp->due == twp->now && tp->nfired == 0);
+	tp->nfired++;
+	if (tp->rearm) {
+		/* again from the callback, possibly a level up */
+		tp->rearm  = false;
+		tp->nfired = 0;
+		tp->due    = twp->now + 1 + tp->expiry % (TimerWheel::SPAN / 2);
+		twp->wheelp->insert(tp, tp->due);
+	}
+}
+
+/*
+ * Deadlines on every level and past the wheel's span fire exactly on their
+ * tick, cancelled ones never, re-inserted ones on their new deadline.
+ */
+void disk::testTimerWheel() {
+	const uint64_t SPAN = TimerWheel::SPAN;
+	const size_t   N    = 4096;
+
+	TimerWheel wheel;
+	TestWheel  tw{&wheel, 0};
+	vector<TestTimer> timers(N);
+	crand rand(7);
+	size_t i = 0;
+	for (uint64_t d : vector<uint64_t>{0, 1, 63, 64, 65, 4095, 4096, 4097,
+			262143, 262144, 262145, SPAN - 1, SPAN, SPAN + 1, 2 * SPAN + 12345}) {
+		timers[i++].due = d;
+	}
+	for (; i < N; i++) {
+		timers[i].due = crand::bound(rand.next(), 3 * SPAN);
+	}
+	for (i = 0; i < N; i++) {
+		timers[i].rearm = i % 7 == 3;
+		wheel.insert(&timers[i], timers[i].due);
+	}
+	assert(wheel.getNQueued() == N);
+
+	uint64_t end = 3 * SPAN + SPAN / 2 + 2;
+	for (tw.now = 0; tw.now <= end; tw.now++) {
+		if (tw.now == SPAN / 3) {
+			/* cancel a few, re-insert some of them for later */
+			for (i = 5; i < N; i += 11) {
+				if (timers[i].due <= tw.now || timers[i].rearm) {
+					continue;
+				}
+				wheel.remove(&timers[i]);
+				timers[i].cancel = true;
+				if (i % 2) {
+					timers[i].cancel = false;
+					timers[i].due    = tw.now + timers[i].due % SPAN;
+					wheel.insert(&timers[i], timers[i].due);
+				}
+			}
+		}
+		wheel.advance(tw.now, testTimerExpired, &tw);
+	}
+
+	for (auto &t : timers) {
+		assert(t.nfired == (t.cancel ? 0 : 1) && !t.rearm);
+	}
+	assert(wheel.getNQueued() == 0);
+	cout << "Timer wheel " << N << " timers over " << end << " ticks" << endl;
 }
 
 void disk::test() {
 	asyncio.init(&base);
 	asyncio.registerCallback(ioCompleted, nullptr, this);
 
+	testTimerWheel();
+
 	testWriteOnceReadMany();
 	testOverWrite();
 	testNO1();
@@ -1157,6 +3261,11 @@ void disk::test() {
 	testMid();
 	testTailSideSplit();
 	testSectorReads();
+	testRandomOverwrites(1000000, 1, false);
+	testRandomOverwrites(250000, 2, true);
+	testRandomOverwrites(100000, 3, true, 64);
+	testRandomOverwrites(250000, 4, false, 0, 1000);
+	testRandomOverwrites(100000, 5, true, 64, 1000);
 }
 
 void lineSplit(const string &line, const char delim, vector<string> &result) {
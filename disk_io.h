@@ -5,10 +5,15 @@
 #include <string>
 #include <memory>
 #include <set>
+#include <map>
+#include <deque>
 #include <vector>
 #include <atomic>
 #include <utility>
+#include <algorithm>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
 
 #include <libaio.h>
 #include <event.h>
@@ -21,6 +26,9 @@
 #include "zipf.h"
 #include "AsyncIO.h"
 #include "block_trace.h"
+#include "trace_replay.h"
+#include "state_file.h"
+#include "journal.h"
 
 #define MIN_TO_SEC(min)   ((min) * 60)
 #define SEC_TO_MILLI(sec) ((sec) * 1000)
@@ -42,19 +50,64 @@ struct Corruption: public std::runtime_error {
 	uint16_t nsectors;
 	string   readLine;
 	string   pattern;
+	int16_t  start;   /* offset within pattern of sector's first byte */
 
-	Corruption(uint64_t sector_, uint16_t nsectors_, const string &readline_, const string &pattern_) :
+	Corruption(uint64_t sector_, uint16_t nsectors_, const string &readline_, const string &pattern_,
+			int16_t start_ = 0) :
 			sector(sector_), nsectors(nsectors_), readLine(readline_), pattern(pattern_),
-			std::runtime_error("Corruption") {
+			start(start_), std::runtime_error("Corruption") {
 
 	}
 };
 
+/* what a sector read back holds */
+enum class SectorState {
+	MATCH,       /* expected data */
+	STALE,       /* an older write of this sector */
+	MISDIRECTED, /* a write meant for other sectors */
+	TORN,        /* partly expected data */
+	GARBAGE,     /* anything else */
+	MAX,
+};
+
+const char *sectorStateName(SectorState state);
+
+struct CheckStats {
+	uint64_t nranges = 0;
+	uint64_t intact  = 0;
+	uint64_t oldData = 0;
+	uint64_t torn    = 0;
+	uint64_t inflight = 0; /* sectors matching a write not known durable */
+	uint64_t sectors[(int) SectorState::MAX] = {};
+};
+
+class VerifyPool;
+class CorruptionReporter;
+class LiveStatsWriter;
+class SubmitQueue;
+class InflightRanges;
+
 enum class IOMode {
 	WRITE,
 	VERIFY,
 };
 
+/* bytes at either end of a sector compared by VerifyDepth::EDGES */
+const size_t EDGE_BYTES = 64;
+
+/* how much of the data of a verified read is compared */
+enum class VerifyDepth {
+	FULL,  /* every byte */
+	EDGES, /* first and last EDGE_BYTES of every sector */
+};
+
+/* how IO completions are waited for */
+enum class CompletionMode {
+	EVENT,   /* eventfd wakes up the event loop */
+	POLL,    /* IO thread spins reaping completions */
+	COMPARE, /* EVENT for the first half of runtime, POLL for the second */
+};
+
 class range {
 public:
 	uint64_t sector;
@@ -92,9 +145,10 @@ public:
 
 class IO {
 public:
-	range   r;
-	string  pattern;
-	int16_t pattern_start;
+	range    r;
+	string   pattern;
+	int16_t  pattern_start;
+	uint64_t lastUse = 0; /* disk's use clock when last written or verified */
 
 public:
 	IO(uint64_t sect, uint32_t nsec, const string &pattern, int16_t pattern_start);
@@ -125,34 +179,180 @@ private:
 	uint64_t     size;
 	uint64_t     sectors_;
 	int          fd;
-	uint16_t     iodepth_;
+	uint32_t     iodepth_;
 	uint16_t     percent_;
 	unique_ptr<io_generator> iogen;
+	vector<pair<uint32_t, double>> sizes_;
+	pattern_config pattern_;
 	TraceLog     trace_;
 
 private:
 	folly::EventBase      base;
 	AsyncIO               asyncio;
-	std::mutex            lock;
-	set<IOPtr, IOCompare> ios;
-	vector<pair<range, bool>> writeIOsSubmitted;
+	/*
+	 * The expected state map and what goes with it (state file, reporter,
+	 * counters) with submitter threads: shared while updating or reading
+	 * parts of the map, exclusive for the whole of it (saves, corruption
+	 * reports). The single IO thread never takes it.
+	 */
+	std::shared_timed_mutex lock;
+	/*
+	 * The expected state map, in shards of shardSectors_ sectors no range
+	 * crosses. Submitter threads lock the shards of a range, exclusive to
+	 * update and shared to snapshot it, so writes completing in different
+	 * parts of the disk do not wait on each other. A single shard without
+	 * submitter threads.
+	 */
+	struct MapShard {
+		std::shared_timed_mutex lock;
+		set<IOPtr, IOCompare>   ios;
+	};
+	vector<unique_ptr<MapShard>> shards_;
+	uint64_t                  shardSectors_ = UINT64_MAX;
+
+	size_t shardOf(uint64_t sector) const {
+		if (shards_.size() == 1) {
+			return 0;
+		}
+		return std::min<uint64_t>(sector / shardSectors_, shards_.size() - 1);
+	}
+
+	set<IOPtr, IOCompare> &shardMap(uint64_t sector) {
+		return shards_[shardOf(sector)]->ios;
+	}
+
+	/* last sector of sector's shard */
+	uint64_t shardEnd(uint64_t sector) const {
+		auto i = shardOf(sector);
+		return i + 1 == shards_.size() ? UINT64_MAX : (i + 1) * shardSectors_ - 1;
+	}
+	/*
+	 * Map memory is estimated at IO_ENTRY_BYTES per range: the IO and its
+	 * shared_ptr control block, the tree node and a heap allocated pattern.
+	 * Past mapBudget_ the least recently used ranges are evicted.
+	 *
+	 * Ranges are stamped with useClock_. From the IO thread it counts writes.
+	 * Submitter threads only read it, a timer ticks it every USE_TICK_MS -
+	 * ranges used within the same tick are equally recent.
+	 */
+	static const size_t       IO_ENTRY_BYTES = sizeof(IO) + 16 + 48 + 32;
+	static const uint32_t     USE_TICK_MS    = 1;
+
+	bool                      hungAbort_ = false;
+	uint64_t                  mapBudget_  = 0; /* bytes, 0 unlimited */
+	uint64_t                  evictSize_  = 0; /* ranges to evict at */
+	std::atomic<uint64_t>     useClock_{0};
+	std::atomic<uint64_t>     nmerged_{0};
+	std::atomic<uint64_t>     nevicted_{0};
+	unique_ptr<InflightRanges> inflight_; /* IOs submitted, not completed */
+	unique_ptr<TraceReplay>   replay_;
+	unique_ptr<StateFile>     state_;
+	bool                      stateDirty_ = false;
+	bool                      verifyOnly_ = false;
+	uint64_t                  sweepCursor_ = 0;
+	unique_ptr<WriteJournal>  journal_;
+	/* write batches held till their journaled intents are durable */
+	struct HeldWrite {
+		ManagedBuffer bufp;
+		size_t        size;
+		uint64_t      sector;
+		uint16_t      nsectors;
+	};
+	std::deque<vector<HeldWrite>> journalHeld_;
+	uint64_t                  journalHeldIOs_ = 0;
+	bool                      checkMode_ = false;
+	CheckStats                checkStats_;
+	/* journaled intents without a WRITE or FORGET, sector to nsectors */
+	std::multimap<uint64_t, uint16_t> checkIntents_;
+	unique_ptr<VerifyPool>    verifyPool_;
+	int                       numaNode_ = -1;
+	unique_ptr<CorruptionReporter> reporter_;
+
+	/*
+	 * Prefill writes [0, ioNSectors()) sequentially. Once done, sectors no
+	 * range in ios covers are expected to hold the fill pattern of their
+	 * stripe (the base layer) and forgotten ranges are kept as holes, ranges
+	 * with an empty pattern which are never verified.
+	 */
+	bool                      filling_     = false;
+	uint64_t                  fillCursor_  = 0;
+	uint64_t                  fillStartNs_ = 0;
+	uint64_t                  baseSectors_ = 0;
+
+	VerifyDepth               verifyDepth_    = VerifyDepth::FULL;
+	uint32_t                  verifySample_   = 1;
+	uint64_t                  nsampleReads_   = 0;
+	uint64_t                  nreadsSkipped_  = 0; /* not sampled */
+	uint64_t                  nbytesCompared_ = 0;
+	uint64_t                  ncorruptions_   = 0;
 
 protected:
 	void setIOMode(IOMode mode);
 	int  writesSubmit(uint64_t nreads);
 	int  readsSubmit(uint64_t nreads);
+	int  replaySubmit(uint64_t nios);
+	int  sweepSubmit(uint64_t nios);
+	bool fillSubmit(uint64_t nios);
+	void journalSubmit(vector<HeldWrite> &&batch);
+	void journalHeldSubmit(const string &error);
+	/* IOs submitted and writes held for the journal */
+	uint64_t pendingIOs();
 	void setRuntimeTimer();
+	void setCompletionSwitchTimer();
 
 	ManagedBuffer getIOBuffer(size_t size);
 	ManagedBuffer prepareIOBuffer(size_t size, const string &pattern);
-	bool patternCompare(uint64_t s, uint16_t ns, const char *const bufp,
+	static bool patternCompare(uint64_t s, uint16_t ns, const char *const bufp,
 		size_t size, const string &pattern, int16_t start);
-	bool readDataVerify(const char *const data, uint64_t sector, uint16_t nsectors);
-	void patternCreate(uint64_t sector, uint16_t nsectors, string &pattern);
-	void writeDone(uint64_t sector, uint16_t nsectors, const string &pattern, const int16_t pattern_start);
-
-	void addWriteIORange(uint64_t sector, uint16_t nsectors);
-	pair<range, bool> removeWriteIORange(uint64_t sector, uint16_t nsectors);
+	static void patternCompareEdges(uint64_t s, uint16_t ns, const char *const bufp,
+		const string &pattern, int16_t start);
+	static uint64_t patternVerify(uint64_t s, uint16_t ns, const char *const bufp,
+		const string &pattern, int16_t start, VerifyDepth depth);
+	bool verifySampled();
+	/* throws Corruption at the first piece not holding what is expected */
+	void readDataVerify(const char *const data, uint64_t sector, uint16_t nsectors);
+	static bool patternDecode(const string &pattern, uint64_t &sector, uint32_t &nsectors);
+	void writeDone(uint64_t sector, uint32_t nsectors, const string &pattern, const int16_t pattern_start);
+	/* writeDone() of a range within the shard of ios */
+	void writeDone(set<IOPtr, IOCompare> &ios, uint64_t sector, uint32_t nsectors,
+		const string &pattern, const int16_t pattern_start);
+	void mergeAround(set<IOPtr, IOCompare> &ios, set<IOPtr, IOCompare>::iterator it);
+	void mapEvict();
+	uint64_t evictSpans(const set<IOPtr, IOCompare> &ios, uint64_t cold,
+		uint64_t nevict, vector<range> &spans);
+	void setMapShards(uint64_t shardSectors);
+	/* lock shards first to last, exclusive or shared, with submitter threads */
+	void shardsLock(size_t first, size_t last, bool exclusive);
+	void shardsUnlock(size_t first, size_t last, bool exclusive);
+	uint64_t shardsSize(size_t first, size_t last) const;
+	/* getNRanges(), while submitter threads may be changing the map too */
+	uint64_t mapSize() const;
+	void forgetIOs(const range &r);
+	uint64_t openDevice(const string &path, uint64_t size);
+	void checkRead(const char *const bufp, uint64_t sector, uint16_t nsectors);
+	bool checkInflight(const char *const sp, uint64_t sector);
+	void snapshotExpected(uint64_t sector, uint16_t nsectors, vector<IO> &expected);
+	void verifyCollect();
+	void corruptionFound(const Corruption &c, const char *const data, uint64_t sector,
+		uint16_t nsectors, const vector<IO> &expected, const AsyncIO *aiop = nullptr);
+	void forgetRange(const range &r);
+	void holeInsert(const range &r);
+	void baseExpected(uint64_t sector, uint64_t end, vector<IO> &expected);
+	void baseVerify(const char *const data, uint64_t sector, uint16_t nsectors);
+
+	/* io is the IO's buffer, telling IOs with the same range apart */
+	void addWriteIORange(uint64_t sector, uint16_t nsectors, const void *io);
+	pair<range, bool> removeWriteIORange(uint64_t sector, uint16_t nsectors,
+		const void *io);
+	void addReadIORange(uint64_t sector, uint16_t nsectors, const void *io);
+	pair<range, bool> removeReadIORange(uint64_t sector, uint16_t nsectors,
+		const void *io);
+
+	void loadState(bool allowDirty);
+	bool applyJournal(const string &path,
+		std::multimap<uint64_t, uint16_t> &intents, size_t *nrecordsp);
+	void saveState();
+	void markStateDirty();
 public:
 	class TimeoutWrapper : public AsyncTimeout {
 	private:
@@ -168,28 +368,217 @@ public:
 		}
 	};
 
-	disk(string path, uint16_t percent, vector<pair<uint32_t, uint8_t>> sizes,
-			uint16_t iodepth, uint64_t runtime);
+	/* exit status of a run aborted on a hung IO */
+	static const int HUNG_IO_EXIT = 3;
+
+	disk(string path, uint16_t percent, const vector<pair<uint32_t, double>> &sizes,
+			uint32_t iodepth, uint64_t runtime,
+			const pattern_config &pattern = pattern_config(), uint64_t size = 0);
 	~disk();
 	void switchIOMode();
+	void replayTrace(const string &path, const string &format);
+	/*
+	 * allowDirty loads a state file which was not saved cleanly, only useful
+	 * together with a journal: checkJournal() after a power loss, or
+	 * setJournal() resuming a run which was killed or crashed.
+	 */
+	void setStateFile(const string &path, bool verifyOnly, bool allowDirty = false);
+	/*
+	 * A state file left DIRTY is first brought forward with the journal's
+	 * records and saved, then the journal restarts on top of that save.
+	 */
+	void setJournal(const string &path);
+	void checkJournal(const string &path);
 	int  verify();
 
-	void writeDone(uint64_t sector, uint16_t nsectors);
+	void writeDone(uint64_t sector, uint16_t nsectors, const void *io);
 	void readDone(const char *const bufp, uint64_t sector, uint16_t nsectors);
+	/* hands the read to the verifier pool when there is one */
+	void readDone(ManagedBuffer bufp, uint64_t sector, uint16_t nsectors);
+	void setVerifyThreads(uint32_t nthreads);
+	/*
+	 * Run the calling (IO) thread and verifier threads started later on a
+	 * NUMA node, and allocate IO buffers there. -1 picks the device's node.
+	 * Returns the node used, -1 if none.
+	 */
+	int  setNumaNode(int node);
+	/*
+	 * Keep going after a corruption: every one is analysed and written to
+	 * path by a reporter thread, and its range is no longer verified.
+	 */
+	void setCorruptionReport(const string &path);
+	/* write the whole IO region before the first random IO */
+	void setPrefill();
+	/* evict least recently used ranges from verification past bytes */
+	void setMapBudget(uint64_t bytes);
+	/* print progress and map size every secs seconds */
+	void setReportInterval(uint32_t secs);
+	/*
+	 * Drain IOs and save the state file every secs seconds of the write
+	 * mode too, not only at mode switches. 0 only at mode switches.
+	 */
+	void setCheckpointInterval(uint32_t secs);
+	/*
+	 * Publish counters, latencies and map size every intervalMs to
+	 * /dev/shm for dvstat, from the IO thread's timer.
+	 */
+	void setLiveStats(uint32_t intervalMs);
+	/*
+	 * Report IOs in flight past warnMs and again past critMs. With abort,
+	 * a critical IO ends the process with HUNG_IO_EXIT.
+	 */
+	void setHungIO(uint32_t warnMs, uint32_t critMs, bool abort);
+	void hungIO(const SlowIO &io, bool critical);
+	/* verify one read in sample to depth, others are not compared */
+	void setVerifyDepth(VerifyDepth depth, uint32_t sample);
+	/*
+	 * Submit from n threads, each with its own AsyncIO keeping iodepth IOs
+	 * in flight and its own generator, all sharing the expected state map.
+	 * Set right after construction, 0 submits from the calling thread.
+	 */
+	void setSubmitThreads(uint32_t n);
+	/* the AsyncIO of every submitter thread, or the IO thread's */
+	vector<AsyncIO *> getAsyncIOs();
+
+	/* used by submitter threads, see SubmitQueue */
+	void queueWriteSubmitted(uint64_t sector, uint16_t nsectors, const void *io);
+	void queueWritesDone(const vector<range> &writes,
+		const vector<ManagedBuffer> &bufs);
+	void queueReadSubmitted(uint64_t sector, uint16_t nsectors, const void *io);
+	/* a read not verified */
+	void queueReadDone(uint64_t sector, uint16_t nsectors, const void *io);
+	/*
+	 * The expected state of reads, which are then done. Reads which raced with
+	 * a write of another queue get nothing expected.
+	 */
+	void queueSnapshots(const vector<range> &reads,
+		const vector<ManagedBuffer> &bufs, vector<vector<IO>> &expected);
+	void queueCorruption(const Corruption &c, const char *const data,
+		uint64_t sector, uint16_t nsectors, const vector<IO> &expected,
+		const AsyncIO &aio);
+	/*
+	 * After a mode switch, the switch's epoch and the new mode. Queues take
+	 * it on their own, reads of some overlapping writes of others, unless
+	 * state is saved - which needs no IO in flight.
+	 */
+	void queueSwitch(uint64_t &epoch, IOMode &mode);
+	bool queueSavesState() const {
+		return state_ != nullptr;
+	}
+	/*
+	 * Wait for every submitter to drain its IOs after a mode switch, the last
+	 * one in saves state. Returns as queueSwitch(), false if the run is over.
+	 */
+	bool queueBarrier(uint64_t &epoch, IOMode &mode);
+	void queueStop();
+	void queueFinished();
+
+	uint64_t queueEpoch() const {
+		return queueEpoch_.load(std::memory_order_acquire);
+	}
+
+	bool queueStopped() const {
+		return queueStop_.load(std::memory_order_acquire);
+	}
+
+	/*
+	 * Verify a read against a copy of the expected ranges it overlaps, throws
+	 * Corruption. Bytes compared are added to *comparedp. Safe to call from
+	 * any thread.
+	 */
+	static void verifyExpected(const char *const data, uint64_t sector,
+		uint16_t nsectors, const vector<IO> &expected,
+		VerifyDepth depth = VerifyDepth::FULL, uint64_t *comparedp = nullptr);
+	/* contiguous extents of sectors of a read not holding what expected */
+	static vector<range> corruptExtents(const char *const data, uint64_t sector,
+		uint16_t nsectors, const vector<IO> &expected);
+	static void patternCreate(uint64_t sector, uint16_t nsectors, string &pattern);
+	/* repeat pattern over size bytes of bufp */
+	static void patternFill(char *bufp, size_t size, const string &pattern);
+	/*
+	 * Classify one sector read back against the pattern expected in it,
+	 * start is the offset within the pattern of the sector's first byte.
+	 */
+	static SectorState sectorClassify(const char *const sp, uint64_t sector,
+		const string &pattern, int16_t start, uint64_t *fsp, uint32_t *fnsp);
+	/* one line describing a slow IO, its submission time relative to startNs */
+	static string slowIOString(const SlowIO &s, uint64_t startNs);
 	int  iosSubmit(uint64_t nios);
 //	void print_ios(void);
 
-	uint64_t getStats(uint64_t *nreadsp, uint64_t *nwritesp, uint64_t *nreadBytesp, uint64_t *nwroteBytes) {
-		*nreadsp = asyncio.getNReads();
-		*nwritesp = asyncio.getNWrites();
-		*nreadBytesp = asyncio.getBytesRead();
-		*nwroteBytes = asyncio.getBytesWrote();
-	}
+	void getStats(uint64_t *nreadsp, uint64_t *nwritesp, uint64_t *nreadBytesp, uint64_t *nwroteBytes);
 
 	uint64_t nsectors() {
 		return sectors_;
 	}
 
+	AsyncIO &getAsyncIO() {
+		return asyncio;
+	}
+
+	const TraceReplay *getTraceReplay() const {
+		return replay_.get();
+	}
+
+	uint64_t getNRanges() const {
+		uint64_t n = 0;
+		for (auto &sp : shards_) {
+			n += sp->ios.size();
+		}
+		return n;
+	}
+
+	const CheckStats &getCheckStats() const {
+		return checkStats_;
+	}
+
+	const WriteJournal *getJournal() const {
+		return journal_.get();
+	}
+
+	const VerifyPool *getVerifyPool() const {
+		return verifyPool_.get();
+	}
+
+	const CorruptionReporter *getCorruptionReporter() const {
+		return reporter_.get();
+	}
+
+	uint64_t getMapBytes() const {
+		return getNRanges() * IO_ENTRY_BYTES;
+	}
+
+	uint64_t getNMerged() const {
+		return nmerged_;
+	}
+
+	uint64_t getNEvicted() const {
+		return nevicted_;
+	}
+
+	uint64_t getNBytesCompared() const;
+	uint64_t getNReadsSkipped() const;
+
+	VerifyDepth getVerifyDepth() const {
+		return verifyDepth_;
+	}
+
+	uint32_t getVerifySample() const {
+		return verifySample_;
+	}
+
+	uint64_t getBaseSectors() const {
+		return baseSectors_;
+	}
+
+	int getNumaNode() const {
+		return numaNode_;
+	}
+
+	uint64_t getStartNs() const {
+		return startNs_;
+	}
+
 	uint64_t ioNSectors() {
 		return sectors_ * percent_ / 100;
 	}
@@ -199,8 +588,30 @@ public:
 	}
 
 	void runtimeExpired();
+	void reportExpired();
+	void checkpointExpired();
+	void liveStatsExpired();
+	void useClockExpired();
 	bool runInEventBaseThread(folly::Function<void()>);
+
+	/*
+	 * In polling modes the IO thread spins for spinUs once idle and then
+	 * sleeps sleepUs between polls, sleepUs 0 never sleeps.
+	 */
+	void setCompletionMode(CompletionMode mode, uint64_t spinUs, uint64_t sleepUs);
+	void completionSwitchExpired();
 private:
+	void terminateLoop();
+	void runLoop();
+	void pollLoop();
+
+	CompletionMode             completion_ = CompletionMode::EVENT;
+	bool                       completionSwitch_ = false;
+	bool                       loopStop_ = false;
+	uint64_t                   pollSpinNs_  = 0;
+	uint64_t                   pollSleepUs_ = 0;
+	unique_ptr<TimeoutWrapper> completionSwitchTimer_;
+
 	IOMode                     mode_;
 	unique_ptr<TimeoutWrapper> ioModeSwitchTimer_;
 	bool                       modeSwitched_;
@@ -209,6 +620,39 @@ private:
 	unique_ptr<TimeoutWrapper> runtimeTimer_;
 	bool                       runtimeComplete_ = false;
 
+	uint32_t                   reportInterval_ = 0; /* seconds */
+	uint64_t                   startNs_        = 0; /* verify() started */
+	unique_ptr<TimeoutWrapper> reportTimer_;
+
+	uint32_t                   checkpointInterval_ = 0; /* seconds */
+	bool                       checkpoint_         = false;
+	unique_ptr<TimeoutWrapper> checkpointTimer_;
+	void setCheckpointTimer();
+
+	uint32_t                   liveStatsInterval_ = 0; /* milliseconds */
+	unique_ptr<LiveStatsWriter> liveStats_;
+	std::mutex                 liveStatsLock_;
+	unique_ptr<TimeoutWrapper> liveStatsTimer_;
+	void publishLiveStats(bool running);
+
+	unique_ptr<TimeoutWrapper> useClockTimer_;
+
+	/* submitter threads */
+	vector<unique_ptr<SubmitQueue>> queues_;
+	std::mutex                      queueLock_;
+	std::condition_variable         queueCv_;
+	std::atomic<uint64_t>           queueEpoch_{0}; /* mode switches */
+	std::atomic<bool>               queueStop_{false};
+	uint64_t                        queueEpochDone_ = 0;
+	uint64_t                        queueGen_       = 0; /* barriers passed */
+	uint32_t                        queueArrived_   = 0;
+	uint32_t                        queueRunning_   = 0;
+	IOMode                          queueMode_      = IOMode::WRITE;
+	/* map size, counted by the threads changing it rather than per shard */
+	std::atomic<uint64_t>           queueNRanges_{0};
+	std::atomic<bool>               queueEvicting_{false};
+	int  verifyQueues();
+
 public: /* some test APIs */
 	void cleanupEverything();
 	void testReadSubmit(uint64_t s, uint16_t ns);
@@ -230,7 +674,10 @@ public: /* some test APIs */
 	void testMid();
 	void testTailSideSplit();
 	void testSectorReads();
+	void testTimerWheel();
 	void _testSectorReads(uint64_t sector, uint16_t nsectors);
+	void testRandomOverwrites(uint64_t nwrites, uint32_t seed, bool base,
+		uint64_t maxRanges = 0, uint64_t shardSectors = 0);
 	void test();
 };
 
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "live_stats.h"
+
+using std::cout;
+using std::endl;
+
+/*
+ * dvstat <disk> [interval]
+ *
+ * Print the live stats of the run on <disk> (as given to --disk) once, or
+ * every interval seconds with rates over the interval.
+ */
+static void printLatency(const char *op, const LatencyHistogram &h) {
+	if (h.count() == 0) {
+		return;
+	}
+	printf("%-5s latency(us) p50 %.1f p99 %.1f p99.9 %.1f max %.1f mean %.1f\n",
+		op, h.percentile(50) / 1e3, h.percentile(99) / 1e3,
+		h.percentile(99.9) / 1e3, h.max() / 1e3, h.mean() / 1e3);
+}
+
+static const char *state(const live_stats &s) {
+	if (!s.running) {
+		return "exited";
+	}
+	/* running, but killed before it could say otherwise */
+	return LiveStatsReader::writerAlive(s) ? "running" : "died";
+}
+
+static void print(const char *disk, const live_stats &s, const live_stats *lastp,
+		int interval) {
+	printf("disk %s pid %ld %s elapsed %.1fs\n", disk, (long) s.pid, state(s),
+		s.elapsedNs / 1e9);
+	printf("reads %lu writes %lu read %luMB wrote %luMB pending %lu\n",
+		s.nreads, s.nwrites, s.nbytesRead >> 20, s.nbytesWrote >> 20, s.pending);
+	if (lastp) {
+		printf("rate reads/s %lu writes/s %lu read MB/s %lu wrote MB/s %lu\n",
+			(s.nreads - lastp->nreads) / interval,
+			(s.nwrites - lastp->nwrites) / interval,
+			((s.nbytesRead - lastp->nbytesRead) >> 20) / interval,
+			((s.nbytesWrote - lastp->nbytesWrote) >> 20) / interval);
+	}
+	printf("ranges %lu map %luKB compared %luMB corruptions %lu\n", s.nranges,
+		s.mapBytes >> 10, s.nbytesCompared >> 20, s.ncorruptions);
+	printLatency("read", s.readLatency);
+	printLatency("write", s.writeLatency);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "usage: " << argv[0] << " <disk> [interval]" << endl;
+		return 2;
+	}
+	auto interval = argc == 3 ? std::atoi(argv[2]) : 0;
+
+	try {
+		LiveStatsReader reader(argv[1]);
+		live_stats      last;
+		live_stats      s;
+		auto stale = [&s] () {
+			std::cerr << "stale live stats: pid " << s.pid <<
+				" stopped in the middle of an update" << endl;
+			return 1;
+		};
+		if (!reader.snapshot(s)) {
+			return stale();
+		}
+		print(reader.disk(), s, nullptr, interval);
+		while (interval > 0 && s.running && LiveStatsReader::writerAlive(s)) {
+			last = s;
+			sleep(interval);
+			if (!reader.snapshot(s)) {
+				return stale();
+			}
+			cout << endl;
+			print(reader.disk(), s, &last, interval);
+		}
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
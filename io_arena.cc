@@ -0,0 +1,214 @@
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include "io_arena.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+std::unique_ptr<IOArena> IOArena::arena_;
+
+static const size_t HUGE_2M_BYTES = 2ull << 20;
+static const size_t HUGE_1G_BYTES = 1ull << 30;
+
+const char *arenaPagesName(ArenaPages pages) {
+	switch (pages) {
+	case ArenaPages::HUGE_1G:
+		return "1G";
+	case ArenaPages::HUGE_2M:
+		return "2M";
+	case ArenaPages::THP:
+		return "thp";
+	}
+	return "unknown";
+}
+
+static size_t roundUp(size_t v, size_t a) {
+	return (v + a - 1) / a * a;
+}
+
+bool IOArena::map(size_t bytes, ArenaPages pages) {
+	void *p = MAP_FAILED;
+	switch (pages) {
+	case ArenaPages::HUGE_1G:
+		if (bytes % HUGE_1G_BYTES) {
+			/* rounding up could fault and lock most of a gigabyte more */
+			break;
+		}
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+			MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+		break;
+	case ArenaPages::HUGE_2M:
+		bytes = roundUp(bytes, HUGE_2M_BYTES);
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+			MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+		break;
+	case ArenaPages::THP: {
+		/* over map to align on a huge page, khugepaged wants aligned ranges */
+		bytes = roundUp(bytes, HUGE_2M_BYTES);
+		auto mp = mmap(nullptr, bytes + HUGE_2M_BYTES, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mp == MAP_FAILED) {
+			break;
+		}
+		auto a    = (char *) roundUp((uintptr_t) mp, HUGE_2M_BYTES);
+		auto head = a - (char *) mp;
+		if (head) {
+			munmap(mp, head);
+		}
+		munmap(a + bytes, HUGE_2M_BYTES - head);
+		madvise(a, bytes, MADV_HUGEPAGE);
+		p = a;
+		break;
+	}
+	}
+	if (p == MAP_FAILED) {
+		return false;
+	}
+
+	basep_ = (char *) p;
+	bytes_ = bytes;
+	pages_ = pages;
+	return true;
+}
+
+void IOArena::create(size_t bytes, ArenaPages pages) {
+	assert(!arena_);
+	if (bytes < MAX_BLOCK_BYTES) {
+		throw std::invalid_argument("IO arena smaller than an IO");
+	}
+
+	std::unique_ptr<IOArena> ap(new IOArena());
+	auto ok = false;
+	switch (pages) {
+	case ArenaPages::HUGE_1G:
+		ok = ap->map(bytes, ArenaPages::HUGE_1G);
+		/* fall through */
+	case ArenaPages::HUGE_2M:
+		ok = ok || ap->map(bytes, ArenaPages::HUGE_2M);
+		/* fall through */
+	case ArenaPages::THP:
+		ok = ok || ap->map(bytes, ArenaPages::THP);
+	}
+	if (!ok) {
+		throw std::runtime_error("IO arena mmap failed: " +
+			std::string(strerror(errno)));
+	}
+
+	/* fault everything in now rather than during the run */
+	for (size_t o = 0; o < ap->bytes_; o += 4096) {
+		ap->basep_[o] = 0;
+	}
+	ap->locked_ = mlock(ap->basep_, ap->bytes_) == 0;
+
+	auto npages = ap->bytes_ / PAGE_BYTES;
+	ap->next_.resize(npages);
+	ap->prev_.resize(npages);
+	ap->order_.resize(npages);
+	ap->isFree_.resize(npages);
+	std::fill(ap->free_, ap->free_ + NORDERS, NONE);
+	/* highest first, the lowest block is allocated first */
+	for (auto pg = npages / (1u << (NORDERS - 1)) * (1u << (NORDERS - 1));
+			pg > 0; ) {
+		pg -= 1u << (NORDERS - 1);
+		ap->pushFree(NORDERS - 1, pg);
+	}
+	arena_ = std::move(ap);
+}
+
+IOArena::~IOArena() {
+	if (basep_) {
+		munmap(basep_, bytes_);
+	}
+}
+
+uint32_t IOArena::order(size_t size) {
+	uint32_t o = 0;
+	while ((PAGE_BYTES << o) < size) {
+		o++;
+	}
+	return o;
+}
+
+void IOArena::pushFree(uint32_t o, uint32_t pg) {
+	next_[pg] = free_[o];
+	prev_[pg] = NONE;
+	if (free_[o] != NONE) {
+		prev_[free_[o]] = pg;
+	}
+	free_[o]    = pg;
+	order_[pg]  = o;
+	isFree_[pg] = 1;
+}
+
+void IOArena::unlinkFree(uint32_t o, uint32_t pg) {
+	assert(isFree_[pg] && order_[pg] == o);
+	if (prev_[pg] != NONE) {
+		next_[prev_[pg]] = next_[pg];
+	} else {
+		free_[o] = next_[pg];
+	}
+	if (next_[pg] != NONE) {
+		prev_[next_[pg]] = prev_[pg];
+	}
+	isFree_[pg] = 0;
+}
+
+char *IOArena::alloc(size_t size) {
+	std::lock_guard<std::mutex> l(lock_);
+	auto o = order(size);
+	auto f = o;
+	while (f < NORDERS && free_[f] == NONE) {
+		f++;
+	}
+	if (f >= NORDERS) {
+		nmisses_++;
+		return nullptr;
+	}
+
+	/* most recently freed block, split down to the order wanted */
+	auto pg = free_[f];
+	unlinkFree(f, pg);
+	while (f > o) {
+		f--;
+		pushFree(f, pg + (1u << f));
+	}
+	order_[pg] = o;
+	return basep_ + (size_t) pg * PAGE_BYTES;
+}
+
+void IOArena::release(char *bufp) {
+	assert(contains(bufp) && (bufp - basep_) % PAGE_BYTES == 0);
+	uint32_t pg = (bufp - basep_) / PAGE_BYTES;
+
+	std::lock_guard<std::mutex> l(lock_);
+	assert(!isFree_[pg]);
+	uint32_t o = order_[pg];
+	for (; o + 1 < NORDERS; o++) {
+		/* merge with the buddy while it is free */
+		auto b = pg ^ (1u << o);
+		if (b >= isFree_.size() || !isFree_[b] || order_[b] != o) {
+			break;
+		}
+		unlinkFree(o, b);
+		pg = std::min(pg, b);
+	}
+	pushFree(o, pg);
+}
+
+void ioBufferFree(void *p) {
+	auto ap = IOArena::get();
+	if (ap && ap->contains(p)) {
+		ap->release((char *) p);
+		return;
+	}
+	free(p);
+}
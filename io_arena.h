@@ -0,0 +1,107 @@
+#ifndef __IO_ARENA_H__
+#define __IO_ARENA_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+enum class ArenaPages {
+	HUGE_1G,
+	HUGE_2M,
+	THP,      /* transparent huge pages, no hugetlb reservation needed */
+};
+
+/*
+ * Process wide region IO buffers are carved from, backed by huge pages and
+ * pre-faulted and locked at creation, so O_DIRECT pins a handful of huge pages
+ * instead of walking 4K pages for every IO.
+ *
+ * Buffers are buddy allocated blocks of 4K to MAX_BLOCK_BYTES, an IO gets the
+ * smallest power of two holding it. Free blocks of an order are a list linked
+ * through per page arrays, so alloc and release take O(NORDERS) steps. With at most n buffers in use an arena of
+ * n blocks of the largest one never misses: some block of that size is always
+ * untouched.
+ *
+ * hugetlb pages are tried first, then transparent huge pages. 1G pages are
+ * only used for a whole number of them. Blocks go back to the arena through
+ * ioBufferFree(), from any thread.
+ */
+class IOArena {
+public:
+	static const size_t   PAGE_BYTES      = 4096;
+	static const uint32_t NORDERS         = 9;
+	static const size_t   MAX_BLOCK_BYTES = PAGE_BYTES << (NORDERS - 1);
+
+private:
+	char          *basep_ = nullptr;
+	size_t        bytes_  = 0;
+	ArenaPages    pages_;
+	bool          locked_ = false;
+
+	static const uint32_t NONE = UINT32_MAX;
+
+	std::mutex            lock_;
+	uint32_t              free_[NORDERS]; /* first page of a free block by order */
+	std::vector<uint32_t> next_;          /* free list links, by first page */
+	std::vector<uint32_t> prev_;
+	std::vector<uint8_t>  order_;         /* of the block at a page */
+	std::vector<uint8_t>  isFree_;
+	uint64_t              nmisses_ = 0;
+
+	static std::unique_ptr<IOArena> arena_;
+
+	IOArena() {
+	}
+	bool map(size_t bytes, ArenaPages pages);
+	static uint32_t order(size_t size);
+	void pushFree(uint32_t o, uint32_t pg);
+	void unlinkFree(uint32_t o, uint32_t pg);
+
+public:
+	~IOArena();
+
+	/* create the arena, pages is the largest page size to try */
+	static void create(size_t bytes, ArenaPages pages);
+	static IOArena *get() {
+		return arena_.get();
+	}
+
+	/* bytes taken by a buffer of size */
+	static size_t blockBytes(size_t size) {
+		return PAGE_BYTES << order(size);
+	}
+
+	/* a block for an IO of up to MAX_BLOCK_BYTES, nullptr if none is free */
+	char *alloc(size_t size);
+	void release(char *bufp);
+
+	bool contains(const void *p) const {
+		return p >= basep_ && p < basep_ + bytes_;
+	}
+
+	size_t getBytes() const {
+		return bytes_;
+	}
+
+	ArenaPages getPages() const {
+		return pages_;
+	}
+
+	bool getLocked() const {
+		return locked_;
+	}
+
+	/* allocations that found no free slot */
+	uint64_t getNMisses() const {
+		return nmisses_;
+	}
+};
+
+const char *arenaPagesName(ArenaPages pages);
+
+/* deleter of IO buffers, returns arena blocks and frees everything else */
+void ioBufferFree(void *p);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef __IO_GEN_H__
 #define __IO_GEN_H__
 
+#include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 #include <utility>
 #include <algorithm>
@@ -9,17 +12,19 @@
 #include <cassert>
 
 #include "zipf.h"
+#include "access_pattern.h"
 
 using std::vector;
 using std::pair;
+using std::unique_ptr;
 
 class block_stats {
 public:
 	uint64_t nios;
 	uint32_t nsectors;
-	uint8_t  percent;
+	double   percent;
 
-	block_stats(uint8_t nsectors, uint8_t percent) {
+	block_stats(uint32_t nsectors, double percent) {
 		this->nsectors = nsectors;
 		this->percent  = percent;
 		this->nios     = 0;
@@ -27,81 +32,130 @@ public:
 
 	void dump(void) {
 		std::cout << "# Sectors: " << nsectors << " Percentage " <<
-			+percent << " IOs " << nios << std::endl;
+			percent << " IOs " << nios << std::endl;
 	}
 };
 
 class io_generator {
-private:
-	const uint64_t MAX_IO_SIZE  = 1ull << 20;
-	const uint64_t SECTOR_SHIFT = 9;
-	const uint64_t MAX_SECTORS  = MAX_IO_SIZE >> SECTOR_SHIFT;
-private:
+public:
+	static const uint64_t MAX_IO_SIZE  = 1ull << 20;
+	static const uint64_t SECTOR_SHIFT = 9;
+	static const uint64_t MAX_SECTORS  = MAX_IO_SIZE >> SECTOR_SHIFT;
+protected:
 	uint64_t sector;   /* start sector */
 	uint64_t nsectors; /* number of sectors */
 	uint64_t seed;
-	uniform  size_rand;
-	zipf     sector_rand;
 
 	uint64_t total_ios;
 	vector<block_stats> bstat;
+	alias               size_rand; /* picks an index into bstat */
+	vector<uint32_t>    size_scratch;
+
+private:
+	/* merge duplicate sizes, bstat[i] is drawn with weight of sizes */
+	static vector<double> size_weights(const vector<pair<uint32_t, double>> &sizes,
+			vector<block_stats> &bstat) {
+		vector<double> weights;
+		for (auto &it : sizes) {
+			auto s = it.first;
+			auto p = it.second;
+			assert(s >= 1 && s <= MAX_SECTORS && p >= 0);
+
+			auto b = std::find_if(bstat.begin(), bstat.end(),
+				[s] (const block_stats &b) {
+					return b.nsectors == s;
+				});
+			if (b != bstat.end()) {
+				b->percent += p;
+				weights[b - bstat.begin()] += p;
+				continue;
+			}
+			bstat.emplace_back(s, p);
+			weights.push_back(p);
+		}
+		return weights;
+	}
+
+protected:
+	uint32_t next_nsectors(void) {
+		total_ios++;
+
+		auto &b = bstat[size_rand.next()];
+		b.nios++;
+		return b.nsectors;
+	}
+
+	void next_nsectors(io_desc *descs, size_t n) {
+		if (size_scratch.size() < n) {
+			size_scratch.resize(n);
+		}
+
+		auto bp = size_scratch.data();
+		size_rand.fill(bp, n);
+		for (size_t i = 0; i < n; i++) {
+			auto &b = bstat[bp[i]];
+			b.nios++;
+			descs[i].nsectors = b.nsectors;
+		}
+		total_ios += n;
+	}
 
 public:
+	/*
+	 * sizes is the complete block size distribution as (nsectors, percent)
+	 * pairs, including any remainder not covered by --blocksize.
+	 */
 	io_generator(uint64_t sector, uint64_t nsectors,
-			vector<pair<uint32_t, uint8_t>> &sizes) :
-		size_rand(1, 1, MAX_SECTORS),
-		sector_rand(0.9, nsectors - MAX_SECTORS, 1)
+			const vector<pair<uint32_t, double>> &sizes, uint32_t seed = 1) :
+		size_rand(size_weights(sizes, bstat), seed)
 	{
-		uint32_t seed = 1;
-
+		assert(nsectors > MAX_SECTORS);
 		nsectors         -= MAX_SECTORS;
 		this->sector      = sector;
 		this->nsectors    = nsectors;
 		this->seed        = seed;
 		this->total_ios   = 0;
+	}
 
-		for (auto &it : sizes) {
-			auto s = it.first;
-			auto p = it.second;
-
-			block_stats b(s, p);
-			bstat.push_back(b);
-		}
+	virtual ~io_generator() {}
 
-		std::sort(bstat.begin(), bstat.end(),
-			[] (const block_stats &a, const block_stats &b) {
-				return a.percent > b.percent;
-			});
-	}
+	virtual void next_io(uint64_t *sectorp, uint64_t *nsectorsp) = 0;
 
-	void next_io(uint64_t *sectorp, uint64_t *nsectorsp) {
-		total_ios++;
+	/* generate n IOs at once */
+	virtual void next_ios(io_desc *descs, size_t n) = 0;
 
-		uint32_t ns = 0;
+	void dump_stats(void) {
 		for (auto &it : bstat) {
-			auto n = it.nios;
-			auto p = it.percent;
-
-			if ((100 * n / total_ios) < p) {
-				ns = it.nsectors;
-				it.nios++;
-				break;
+			if (it.nios) {
+				it.dump();
 			}
 		}
 
-		if (ns == 0) {
-			ns = size_rand.next();
-			assert(ns >= 1 && ns <= MAX_SECTORS);
+		std::cout << "Total IOs " << total_ios << std::endl;
+	}
+};
 
-			for (auto &it : bstat) {
-				if (it.nsectors == ns) {
-					it.nios++;
-					break;
-				}
-			}
-		}
+/*
+ * IO generator for access pattern P. Only next_ios() is dispatched
+ * virtually, once per batch; P's per IO code is inlined into the loop.
+ */
+template <typename P>
+class pattern_io_generator final : public io_generator {
+private:
+	P sector_rand;
+
+public:
+	pattern_io_generator(uint64_t sector, uint64_t nsectors,
+			const vector<pair<uint32_t, double>> &sizes,
+			const pattern_config &cfg, uint32_t seed) :
+		io_generator(sector, nsectors, sizes, seed),
+		sector_rand(cfg, nsectors - MAX_SECTORS, seed)
+	{
+	}
 
-		auto s = sector_rand.next();
+	void next_io(uint64_t *sectorp, uint64_t *nsectorsp) override {
+		auto ns = next_nsectors();
+		auto s  = sector_rand.next(ns);
 		assert(s >= 0 && s <= this->nsectors);
 		s += this->sector;
 		assert(s < this->sector + this->nsectors);
@@ -110,13 +164,33 @@ public:
 		*sectorp   = s;
 	}
 
-	void dump_stats(void) {
-		for (auto &it : bstat) {
-			it.dump();
+	void next_ios(io_desc *descs, size_t n) override {
+		next_nsectors(descs, n);
+		sector_rand.fill(descs, n);
+		for (size_t i = 0; i < n; i++) {
+			assert(descs[i].sector < this->nsectors);
+			descs[i].sector += this->sector;
 		}
-
-		std::cout << "Total IOs " << total_ios << std::endl;
 	}
 };
 
+static inline unique_ptr<io_generator> make_io_generator(uint64_t sector,
+		uint64_t nsectors, const vector<pair<uint32_t, double>> &sizes,
+		const pattern_config &cfg, uint32_t seed = 1) {
+	if (cfg.name == "zipf") {
+		return std::make_unique<pattern_io_generator<zipf_pattern>>(sector, nsectors, sizes, cfg, seed);
+	} else if (cfg.name == "uniform") {
+		return std::make_unique<pattern_io_generator<uniform_pattern>>(sector, nsectors, sizes, cfg, seed);
+	} else if (cfg.name == "sequential") {
+		return std::make_unique<pattern_io_generator<sequential_pattern>>(sector, nsectors, sizes, cfg, seed);
+	} else if (cfg.name == "strided") {
+		return std::make_unique<pattern_io_generator<strided_pattern>>(sector, nsectors, sizes, cfg, seed);
+	} else if (cfg.name == "pareto") {
+		return std::make_unique<pattern_io_generator<pareto_pattern>>(sector, nsectors, sizes, cfg, seed);
+	} else if (cfg.name == "hotcold") {
+		return std::make_unique<pattern_io_generator<hotcold_pattern>>(sector, nsectors, sizes, cfg, seed);
+	}
+	throw std::invalid_argument("Unknown access pattern " + cfg.name);
+}
+
 #endif
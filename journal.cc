@@ -0,0 +1,267 @@
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "journal.h"
+
+using std::string;
+using std::vector;
+using std::runtime_error;
+
+static const uint64_t JOURNAL_MAGIC   = 0x4c4e524a56445644ull; /* DVDVJRNL */
+static const uint32_t JOURNAL_VERSION = 1;
+
+WriteJournal::WriteJournal(const string &path, uint64_t diskSectors, int dataFd) :
+			path_(path), fd_(-1), dataFd_(dataFd), diskSectors_(diskSectors),
+			capacity_(0), nonce_(0), seq_(0), busy_(false), stop_(false),
+			nrecords_(0), ncommits_(0), ndataFlushes_(0) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd_ < 0) {
+		throw runtime_error("Could not open journal " + path);
+	}
+
+	struct stat sb;
+	auto rc = fstat(fd_, &sb);
+	if (rc == 0 && S_ISBLK(sb.st_mode)) {
+		uint64_t sz;
+		rc = ioctl(fd_, BLKGETSIZE64, &sz);
+		if (rc < 0 || sz < 2 * BLOCK_BYTES) {
+			throw runtime_error("journal device " + path + " is too small");
+		}
+		capacity_ = sz / BLOCK_BYTES;
+	}
+
+	writer_ = std::thread([this] () {
+		writerLoop();
+	});
+}
+
+WriteJournal::~WriteJournal() {
+	{
+		std::lock_guard<std::mutex> g(lock_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	writer_.join();
+
+	if (fd_ >= 0) {
+		close(fd_);
+	}
+}
+
+uint64_t WriteJournal::checksum(const void *p, size_t size) {
+	uint64_t csum = 0xcbf29ce484222325ull;
+	auto     wp   = reinterpret_cast<const uint64_t *>(p);
+	for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+		csum ^= wp[i];
+		csum *= 0x100000001b3ull;
+	}
+	return csum;
+}
+
+void WriteJournal::writeHeader(uint64_t epoch) {
+	char b[BLOCK_BYTES];
+	std::memset(b, 0, sizeof(b));
+
+	auto hp          = reinterpret_cast<header *>(b);
+	hp->magic        = JOURNAL_MAGIC;
+	hp->version      = JOURNAL_VERSION;
+	hp->epoch        = epoch;
+	hp->nonce        = nonce_;
+	hp->disk_sectors = diskSectors_;
+	hp->csum         = checksum(hp, offsetof(header, csum));
+
+	auto rc = pwrite(fd_, b, sizeof(b), 0);
+	if (rc != sizeof(b) || fdatasync(fd_) < 0) {
+		throw runtime_error("Could not write journal header " + path_);
+	}
+}
+
+void WriteJournal::reset(uint64_t epoch) {
+	flush();
+
+	std::lock_guard<std::mutex> g(lock_);
+	if (!error_.empty()) {
+		throw runtime_error(error_);
+	}
+
+	std::random_device rd;
+	nonce_ = ((uint64_t) rd() << 32) | rd();
+	seq_   = 0;
+	writeHeader(epoch);
+}
+
+void WriteJournal::append(uint64_t sector, uint32_t nsectors, JournalOp op) {
+	{
+		std::lock_guard<std::mutex> g(lock_);
+		if (!error_.empty()) {
+			throw runtime_error(error_);
+		}
+		pending_.push_back({sector, nsectors, op});
+	}
+	cv_.notify_one();
+}
+
+void WriteJournal::flushAsync(std::function<void(const string &error)> done) {
+	{
+		std::lock_guard<std::mutex> g(lock_);
+		waiters_.push_back(std::move(done));
+	}
+	cv_.notify_one();
+}
+
+void WriteJournal::flush() {
+	std::unique_lock<std::mutex> g(lock_);
+	flushed_.wait(g, [this] () {
+		return (pending_.empty() && !busy_) || !error_.empty();
+	});
+}
+
+void WriteJournal::commit(vector<journal_record> &records) {
+	auto nblocks = (records.size() + RECORDS_PER_BLOCK - 1) / RECORDS_PER_BLOCK;
+	if (capacity_ && 1 + seq_ + nblocks > capacity_) {
+		throw runtime_error("journal device " + path_ + " is full");
+	}
+
+	/* writes acknowledged before this point are durable after the flush */
+	auto writes = std::any_of(records.begin(), records.end(),
+			[] (const journal_record &jr) {
+		return jr.op == JournalOp::WRITE;
+	});
+	if (writes && dataFd_ >= 0) {
+		if (fdatasync(dataFd_) < 0) {
+			throw runtime_error("Could not flush data device for journal " + path_);
+		}
+		ndataFlushes_++;
+	}
+
+	vector<char> buf(nblocks * BLOCK_BYTES, 0);
+	auto rp = records.data();
+	auto n  = records.size();
+	for (size_t i = 0; i < nblocks; i++) {
+		auto bp      = reinterpret_cast<block *>(buf.data() + i * BLOCK_BYTES);
+		auto c       = n < RECORDS_PER_BLOCK ? n : RECORDS_PER_BLOCK;
+		bp->magic    = JOURNAL_MAGIC;
+		bp->nonce    = nonce_;
+		bp->seq      = seq_ + i;
+		bp->nrecords = c;
+		std::memcpy(bp->records, rp, c * sizeof(*rp));
+		bp->csum     = checksum(bp, BLOCK_BYTES);
+		rp += c;
+		n  -= c;
+	}
+
+	auto off = (1 + seq_) * BLOCK_BYTES;
+	auto rc  = pwrite(fd_, buf.data(), buf.size(), off);
+	if (rc != (ssize_t) buf.size() || fdatasync(fd_) < 0) {
+		throw runtime_error("Could not write journal " + path_);
+	}
+	seq_ += nblocks;
+}
+
+void WriteJournal::writerLoop() {
+	vector<journal_record> records;
+	vector<std::function<void(const string &)>> waiters;
+
+	std::unique_lock<std::mutex> g(lock_);
+	while (1) {
+		cv_.wait(g, [this] () {
+			return stop_ || !pending_.empty() || !waiters_.empty();
+		});
+		if (pending_.empty() && waiters_.empty() && stop_) {
+			break;
+		}
+
+		/* group commit everything appended so far */
+		records.swap(pending_);
+		waiters.swap(waiters_);
+		busy_ = true;
+		auto error = error_;
+		g.unlock();
+
+		if (!records.empty() && error.empty()) {
+			try {
+				commit(records);
+			} catch (std::exception &e) {
+				error = e.what();
+			}
+		}
+		for (auto &done : waiters) {
+			done(error);
+		}
+		waiters.clear();
+
+		g.lock();
+		if (!records.empty()) {
+			ncommits_++;
+			nrecords_ += records.size();
+		}
+		records.clear();
+		busy_ = false;
+		if (!error.empty()) {
+			error_ = error;
+			pending_.clear();
+		}
+		flushed_.notify_all();
+	}
+}
+
+uint64_t WriteJournal::replay(const string &path, uint64_t diskSectors,
+		std::function<void(const journal_record &)> fn) {
+	auto fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw runtime_error("Could not open journal " + path);
+	}
+
+	char b[BLOCK_BYTES];
+	auto rc = pread(fd, b, sizeof(b), 0);
+	auto hp = reinterpret_cast<header *>(b);
+	if (rc != sizeof(b) || hp->magic != JOURNAL_MAGIC ||
+			hp->version != JOURNAL_VERSION ||
+			hp->csum != checksum(hp, offsetof(header, csum))) {
+		close(fd);
+		throw runtime_error(path + " is not a journal.");
+	}
+	if (hp->disk_sectors != diskSectors) {
+		close(fd);
+		throw runtime_error(path + " belongs to a device of different size.");
+	}
+
+	auto epoch = hp->epoch;
+	auto nonce = hp->nonce;
+	for (uint64_t seq = 0; ; seq++) {
+		rc = pread(fd, b, sizeof(b), (1 + seq) * BLOCK_BYTES);
+		if (rc != sizeof(b)) {
+			break;
+		}
+
+		auto bp   = reinterpret_cast<block *>(b);
+		auto csum = bp->csum;
+		bp->csum  = 0;
+		if (bp->magic != JOURNAL_MAGIC || bp->nonce != nonce ||
+				bp->seq != seq || bp->nrecords > RECORDS_PER_BLOCK ||
+				checksum(bp, BLOCK_BYTES) != csum) {
+			/* end of journal */
+			break;
+		}
+
+		for (uint32_t i = 0; i < bp->nrecords; i++) {
+			fn(bp->records[i]);
+		}
+	}
+	close(fd);
+	return epoch;
+}
@@ -0,0 +1,144 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using std::string;
+using std::vector;
+
+enum class JournalOp : uint32_t {
+	WRITE  = 1, /* write <sector,nsectors> was acknowledged and flushed */
+	FORGET = 2, /* sectors are no longer verifiable */
+	INTENT = 3, /* write <sector,nsectors> is about to be submitted */
+};
+
+struct journal_record {
+	uint64_t  sector;
+	uint32_t  nsectors;
+	JournalOp op;
+};
+
+/*
+ * Write ahead journal of acknowledged writes, kept on a separate file or
+ * device. Records are appended from the IO thread into a memory buffer and a
+ * writer thread group commits everything appended so far with one pwrite and
+ * one fdatasync, so journaling keeps up with the device however small the
+ * IOs are.
+ *
+ * An acknowledged write may still sit in the device's volatile cache, so a
+ * commit holding WRITE records first flushes the data device: a WRITE record
+ * is only durable once the write is. Until then, and from its INTENT record
+ * on, a write's sectors may hold either the old or the new data.
+ *
+ * The IO thread does not wait for commits: flushAsync() calls back from the
+ * writer thread once what was appended before it is durable, and writes are
+ * submitted from there. flush() blocks, for saves with no IOs in flight.
+ *
+ * Block 0 holds the journal header, records follow in 4K blocks each
+ * carrying the header's nonce, a sequence number and a checksum. Replay stops
+ * at the first block which does not validate.
+ */
+class WriteJournal {
+public:
+	static const size_t BLOCK_BYTES = 4096;
+
+	struct header {
+		uint64_t magic;
+		uint32_t version;
+		uint32_t pad;
+		uint64_t epoch;        /* state file generation records apply to */
+		uint64_t nonce;        /* changes on every reset */
+		uint64_t disk_sectors;
+		uint64_t csum;
+	};
+
+	struct block {
+		uint64_t magic;
+		uint64_t nonce;
+		uint64_t seq;
+		uint32_t nrecords;
+		uint32_t pad;
+		uint64_t csum;
+		journal_record records[(BLOCK_BYTES - 40) / sizeof(journal_record)];
+	};
+
+	static const size_t RECORDS_PER_BLOCK =
+		(BLOCK_BYTES - 40) / sizeof(journal_record);
+
+private:
+	string  path_;
+	int     fd_;
+	int     dataFd_;     /* flushed before WRITE records commit, -1 if none */
+	uint64_t diskSectors_;
+	uint64_t capacity_;  /* in blocks, 0 if unlimited */
+	uint64_t nonce_;
+	uint64_t seq_;       /* next block sequence number */
+
+	std::thread             writer_;
+	std::mutex              lock_;
+	std::condition_variable cv_;
+	std::condition_variable flushed_;
+	vector<journal_record>  pending_;
+	/* flushAsync() callbacks, called once pending_ as of then is durable */
+	vector<std::function<void(const string &)>> waiters_;
+	bool                    busy_;
+	bool                    stop_;
+	string                  error_;
+
+	uint64_t nrecords_;
+	uint64_t ncommits_;
+	uint64_t ndataFlushes_;
+
+private:
+	static uint64_t checksum(const void *p, size_t size);
+	void writeHeader(uint64_t epoch);
+	void writerLoop();
+	void commit(vector<journal_record> &records);
+
+public:
+	/* dataFd is the device written to, -1 for engines without one */
+	WriteJournal(const string &path, uint64_t diskSectors, int dataFd = -1);
+	~WriteJournal();
+
+	/* start a new journal, records apply on top of state generation epoch */
+	void reset(uint64_t epoch);
+
+	void append(uint64_t sector, uint32_t nsectors, JournalOp op);
+
+	/* wait till everything appended so far is durable */
+	void flush();
+
+	/*
+	 * Call done on the writer thread once everything appended so far is
+	 * durable, with the error if the journal failed. Callbacks are called in
+	 * the order they were registered.
+	 */
+	void flushAsync(std::function<void(const string &error)> done);
+
+	uint64_t getNRecords() const {
+		return nrecords_;
+	}
+
+	uint64_t getNCommits() const {
+		return ncommits_;
+	}
+
+	uint64_t getNDataFlushes() const {
+		return ndataFlushes_;
+	}
+
+	/*
+	 * Read back a journal. Calls fn for every durable record and returns the
+	 * epoch of the journal. Throws if the journal belongs to another disk.
+	 */
+	static uint64_t replay(const string &path, uint64_t diskSectors,
+		std::function<void(const journal_record &)> fn);
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+
+static inline uint64_t monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Log-linear latency histogram in nanoseconds. Values are bucketed by their
+ * most significant bit and the SUB_BITS bits following it, so every bucket is
+ * within 1/16th of its value and record() is a couple of instructions.
+ *
+ * A histogram has a single writer. record() does plain (relaxed atomic)
+ * stores, so other threads may mergeLive() it without a lock; such a merge
+ * sees every value recorded before the count it read, give or take those
+ * racing with it.
+ */
+class LatencyHistogram {
+public:
+	static const unsigned SUB_BITS = 4;
+	static const unsigned SUB      = 1u << SUB_BITS;
+	static const unsigned NBUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+private:
+	uint64_t buckets_[NBUCKETS] = {};
+	uint64_t count_ = 0;
+	uint64_t sum_   = 0;
+	uint64_t max_   = 0;
+
+	static unsigned bucket(uint64_t v) {
+		if (v < SUB) {
+			return v;
+		}
+		unsigned msb = 63 - __builtin_clzll(v);
+		unsigned sh  = msb - SUB_BITS;
+		return (sh + 1) * SUB + ((v >> sh) & (SUB - 1));
+	}
+
+	/* largest value falling in bucket b */
+	static uint64_t bucketMax(unsigned b) {
+		if (b < SUB) {
+			return b;
+		}
+		unsigned sh = b / SUB - 1;
+		uint64_t m  = SUB + b % SUB;
+		return ((m + 1) << sh) - 1;
+	}
+
+public:
+	inline void record(uint64_t ns) {
+		auto b = bucket(ns);
+		__atomic_store_n(&buckets_[b], buckets_[b] + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&sum_, sum_ + ns, __ATOMIC_RELAXED);
+		if (ns > max_) {
+			__atomic_store_n(&max_, ns, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&count_, count_ + 1, __ATOMIC_RELEASE);
+	}
+
+	void merge(const LatencyHistogram &h) {
+		for (unsigned b = 0; b < NBUCKETS; b++) {
+			buckets_[b] += h.buckets_[b];
+		}
+		count_ += h.count_;
+		sum_   += h.sum_;
+		max_    = h.max_ > max_ ? h.max_ : max_;
+	}
+
+	/* merge h while its writer may be recording to it */
+	void mergeLive(const LatencyHistogram &h) {
+		count_ += __atomic_load_n(&h.count_, __ATOMIC_ACQUIRE);
+		for (unsigned b = 0; b < NBUCKETS; b++) {
+			buckets_[b] += __atomic_load_n(&h.buckets_[b], __ATOMIC_RELAXED);
+		}
+		sum_ += __atomic_load_n(&h.sum_, __ATOMIC_RELAXED);
+		auto m = __atomic_load_n(&h.max_, __ATOMIC_RELAXED);
+		max_   = m > max_ ? m : max_;
+	}
+
+	/* value at percentile p (0 - 100) */
+	uint64_t percentile(double p) const {
+		if (count_ == 0) {
+			return 0;
+		}
+
+		uint64_t n = (uint64_t) (count_ * p / 100.0);
+		n = n ? n : 1;
+		uint64_t c = 0;
+		for (unsigned b = 0; b < NBUCKETS; b++) {
+			c += buckets_[b];
+			if (c >= n) {
+				auto v = bucketMax(b);
+				return v < max_ ? v : max_;
+			}
+		}
+		return max_;
+	}
+
+	uint64_t count() const {
+		return count_;
+	}
+
+	uint64_t max() const {
+		return max_;
+	}
+
+	double mean() const {
+		return count_ ? (double) sum_ / count_ : 0.0;
+	}
+};
+
+/* a completed IO, kept for being among the slowest */
+struct SlowIO {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t submitNs;
+	uint64_t latencyNs;
+	uint32_t inflight;  /* IOs in flight when it was reaped */
+	bool     read;
+};
+
+/*
+ * The max slowest IOs recorded since the last clear(), as a min-heap on
+ * latency. isSlow() is a single compare against the fastest IO kept, so IOs
+ * which are not outliers cost nothing beyond it.
+ */
+class SlowIOs {
+private:
+	std::vector<SlowIO> heap_;
+	size_t              max_  = 0;
+	uint64_t            min_  = UINT64_MAX; /* latency to beat */
+
+	static bool slower(const SlowIO &a, const SlowIO &b) {
+		return a.latencyNs > b.latencyNs;
+	}
+
+public:
+	void setMax(size_t max) {
+		max_ = max;
+		heap_.reserve(max);
+		clear();
+	}
+
+	size_t getMax() const {
+		return max_;
+	}
+
+	inline bool isSlow(uint64_t ns) const {
+		return ns > min_;
+	}
+
+	void add(const SlowIO &s) {
+		if (heap_.size() == max_) {
+			std::pop_heap(heap_.begin(), heap_.end(), slower);
+			heap_.back() = s;
+		} else {
+			heap_.push_back(s);
+		}
+		std::push_heap(heap_.begin(), heap_.end(), slower);
+		min_ = heap_.size() == max_ ? heap_.front().latencyNs : 0;
+	}
+
+	void clear() {
+		heap_.clear();
+		min_ = max_ ? 0 : UINT64_MAX;
+	}
+
+	/* in heap order; setMax() reserved them, so copying never reallocates */
+	std::vector<SlowIO> unsorted() const {
+		return heap_;
+	}
+
+	/* slowest first */
+	static void sort(std::vector<SlowIO> &v) {
+		std::sort(v.begin(), v.end(), slower);
+	}
+
+	std::vector<SlowIO> sorted() const {
+		auto v = unsorted();
+		sort(v);
+		return v;
+	}
+};
+
+#endif
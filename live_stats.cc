@@ -0,0 +1,121 @@
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "live_stats.h"
+
+using std::runtime_error;
+
+string liveStatsPath(const string &disk) {
+	string name(disk);
+	for (auto &c : name) {
+		if (c == '/') {
+			c = '_';
+		}
+	}
+	return "/dev/shm/dvstat." + name;
+}
+
+LiveStatsWriter::LiveStatsWriter(const string &disk) : path_(liveStatsPath(disk)) {
+	auto fd = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw runtime_error("Could not create live stats " + path_);
+	}
+	auto rc = ftruncate(fd, sizeof(live_stats_segment));
+	auto p  = rc < 0 ? MAP_FAILED : mmap(nullptr, sizeof(live_stats_segment),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		throw runtime_error("Could not map live stats " + path_);
+	}
+
+	/* a zero filled file, readers reject it until the header is complete */
+	segp_ = reinterpret_cast<live_stats_segment *>(p);
+	std::strncpy(segp_->disk, disk.c_str(), sizeof(segp_->disk) - 1);
+	segp_->version = live_stats_segment::VERSION;
+	segp_->size    = sizeof(live_stats_segment);
+	std::atomic_thread_fence(std::memory_order_release);
+	segp_->magic   = live_stats_segment::MAGIC;
+}
+
+LiveStatsWriter::~LiveStatsWriter() {
+	/* left behind with running 0 for monitors to see how the run ended */
+	munmap(segp_, sizeof(live_stats_segment));
+}
+
+live_stats *LiveStatsWriter::begin() {
+	segp_->seq.store(++seq_, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	return &segp_->stats;
+}
+
+void LiveStatsWriter::end() {
+	segp_->seq.store(++seq_, std::memory_order_release);
+}
+
+LiveStatsReader::LiveStatsReader(const string &disk) : segp_(nullptr), size_(0) {
+	auto path = liveStatsPath(disk);
+	auto fd   = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw runtime_error("Could not open live stats " + path);
+	}
+
+	struct stat sb;
+	auto rc = fstat(fd, &sb);
+	if (rc < 0 || (size_t) sb.st_size < sizeof(live_stats_segment)) {
+		close(fd);
+		throw runtime_error("Live stats " + path + " too small");
+	}
+	auto p = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		throw runtime_error("Could not map live stats " + path);
+	}
+	segp_ = reinterpret_cast<live_stats_segment *>(p);
+	size_ = sb.st_size;
+
+	if (segp_->magic != live_stats_segment::MAGIC ||
+			segp_->version != live_stats_segment::VERSION ||
+			segp_->size != sizeof(live_stats_segment)) {
+		munmap(p, size_);
+		throw runtime_error("Live stats " + path + " of unknown version");
+	}
+}
+
+LiveStatsReader::~LiveStatsReader() {
+	if (segp_) {
+		munmap(segp_, size_);
+	}
+}
+
+bool LiveStatsReader::snapshot(live_stats &stats) const {
+	for (uint32_t i = 0; i < SNAPSHOT_RETRIES; i++) {
+		if (i >= SNAPSHOT_SPINS) {
+			usleep(100);
+		}
+		auto s1 = segp_->seq.load(std::memory_order_acquire);
+		if (s1 & 1) {
+			continue;
+		}
+		std::memcpy(&stats, &segp_->stats, sizeof(stats));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (segp_->seq.load(std::memory_order_relaxed) == s1) {
+			return true;
+		}
+	}
+
+	/* seq stayed odd, the update is never going to complete */
+	std::memcpy(&stats, &segp_->stats, sizeof(stats));
+	return false;
+}
+
+bool LiveStatsReader::writerAlive(const live_stats &stats) {
+	return stats.pid > 0 && (kill(stats.pid, 0) == 0 || errno != ESRCH);
+}
@@ -0,0 +1,94 @@
+#ifndef __LIVE_STATS_H__
+#define __LIVE_STATS_H__
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#include "latency.h"
+
+using std::string;
+
+/* counters of a run, published as one consistent snapshot */
+struct live_stats {
+	int64_t  pid;
+	uint32_t running;        /* 0 once the run finished */
+	uint32_t pad;
+	uint64_t elapsedNs;
+	uint64_t nreads;
+	uint64_t nwrites;
+	uint64_t nbytesRead;
+	uint64_t nbytesWrote;
+	uint64_t pending;
+	uint64_t nranges;        /* of the expected state map */
+	uint64_t mapBytes;
+	uint64_t nbytesCompared;
+	uint64_t ncorruptions;
+	LatencyHistogram readLatency;
+	LatencyHistogram writeLatency;
+};
+
+/*
+ * Shared memory segment /dev/shm/dvstat.<disk> for monitors which can not
+ * attach to the process. The IO thread publishes a snapshot under a sequence
+ * lock: seq is odd while it is being written. Readers copy the snapshot and
+ * retry if seq was odd or changed, so they never hold up the writer.
+ */
+struct live_stats_segment {
+	static const uint64_t MAGIC   = 0x5354415453564444ull; /* DDVSTATS */
+	static const uint32_t VERSION = 1;
+
+	uint64_t              magic;
+	uint32_t              version;
+	uint32_t              size;   /* of the segment */
+	char                  disk[256];
+	std::atomic<uint64_t> seq;
+	live_stats            stats;
+};
+
+string liveStatsPath(const string &disk);
+
+class LiveStatsWriter {
+private:
+	string             path_;
+	live_stats_segment *segp_;
+	uint64_t           seq_ = 0;
+
+public:
+	LiveStatsWriter(const string &disk);
+	~LiveStatsWriter();
+
+	/* fill the returned stats, then call end() - plain stores only */
+	live_stats *begin();
+	void end();
+};
+
+class LiveStatsReader {
+private:
+	/* a snapshot takes microseconds, spin then sleep 100us for about a second */
+	static const uint32_t SNAPSHOT_SPINS   = 1000;
+	static const uint32_t SNAPSHOT_RETRIES = SNAPSHOT_SPINS + 10000;
+
+	live_stats_segment *segp_;
+	size_t             size_;
+
+public:
+	/* throws if the segment is missing or of another version */
+	LiveStatsReader(const string &disk);
+	~LiveStatsReader();
+
+	const char *disk() const {
+		return segp_->disk;
+	}
+
+	/*
+	 * Consistent copy of the latest snapshot. False if the segment is stale:
+	 * its writer died or stopped mid-update, stats then hold a torn copy.
+	 */
+	bool snapshot(live_stats &stats) const;
+
+	/* whether the process which wrote stats still exists */
+	static bool writerAlive(const live_stats &stats);
+};
+
+#endif
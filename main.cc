@@ -1,10 +1,18 @@
 #include <iostream>
+#include <algorithm>
 
 #include <cassert>
+#include <cstdio>
 #include <gflags/gflags.h>
 
+#include <sys/resource.h>
+
 #include "io_generator.h"
 #include "disk_io.h"
+#include "verify_pool.h"
+#include "topology.h"
+#include "io_arena.h"
+#include "corruption_report.h"
 
 using std::vector;
 using std::pair;
@@ -12,12 +20,61 @@ using std::string;
 using std::cout;
 using std::endl;
 
-DEFINE_string(disk, "/dev/null", "Comma seperated list of block devices for IO verification");
-DEFINE_int32(iodepth, 32, "Number of concurrent IOs");
+DEFINE_string(disk, "/dev/null", "Block device, regular file, ram or null engine for IO verification");
+DEFINE_string(size, "", "Size in K/M/G/T: of ram/null engines, to fallocate a regular file to or to limit a device to");
+DEFINE_bool(aio_ring, true, "Reap completions from the mmapped AIO ring, saving io_getevents calls");
+DEFINE_string(completion, "event", "Wait for IO completions: event (eventfd), poll (busy-poll) or compare (event then poll)");
+DEFINE_uint64(poll_spin_us, 50, "poll completion: microseconds to spin once idle before sleeping");
+DEFINE_uint64(poll_sleep_us, 0, "poll completion: microseconds to sleep between polls after spinning, 0 spins forever");
+DEFINE_int32(submit_batch, 1, "Queue IOs and submit them in batches of this many");
+DEFINE_uint64(submit_deadline_us, 100, "Submit a partial batch once its oldest IO waited this long");
+DEFINE_int32(verify_threads, 0, "Threads verifying read data, 0 verifies on the IO thread");
+DEFINE_int32(numa_node, -1, "NUMA node for the IO and verifier threads and buffers, -1 the device's node, -2 none");
+DEFINE_string(buffer_arena, "", "Size in K/M/G of a pre-faulted, locked huge page arena to carve IO buffers from, "
+	"at least iodepth buffers of the largest IO rounded to a power of two per submitter and verifier thread");
+DEFINE_string(buffer_arena_pages, "2M", "buffer_arena: largest page size to try 1G/2M/thp, smaller ones are fallbacks, "
+	"1G only for a multiple of 1G");
+DEFINE_string(corruption_report, "", "Keep running on data corruption, reporting every one to this file");
+DEFINE_bool(prefill, false, "Write the whole IO region sequentially first, so every read verifies data");
+DEFINE_string(verify_depth, "full", "Compare full sectors or only their first and last 64 bytes (edges)");
+DEFINE_int32(verify_sample, 1, "Verify one read in this many, the others are not compared");
+DEFINE_string(map_budget, "", "Memory in K/M/G for the expected state map, least recently used ranges are evicted past it");
+DEFINE_int32(report_interval, 0, "Print progress and map size every this many seconds, 0 never");
+DEFINE_int32(slow_ios, 8, "Track this many slowest IOs per report interval, printed with reports and corruptions");
+DEFINE_int32(hung_io_warn_ms, 10000, "Report IOs in flight for longer than this, 0 no hung IO watchdog");
+DEFINE_int32(hung_io_critical_ms, 60000, "Report IOs in flight for longer than this as critical");
+DEFINE_bool(hung_io_abort, false, "Exit with status 3 once an IO is in flight past hung_io_critical_ms");
+DEFINE_int32(live_stats_ms, 0, "Publish live stats to /dev/shm for dvstat every this many milliseconds, 0 never");
+DEFINE_bool(test, false, "Run the built-in disk tests and exit");
+DEFINE_int32(iodepth, 32, "Number of concurrent IOs. The kernel reserves twice iodepth (at "
+	"least 8 per CPU and AIO context) of fs.aio-max-nr, by default 65536 for all processes, "
+	"so deeper than about 32K needs a larger fs.aio-max-nr");
+DEFINE_int32(aio_contexts, 0, "AIO contexts to spread IOs over, 0 one per 512 of iodepth");
+DEFINE_int32(submit_threads, 0, "Threads submitting IOs, each with iodepth IOs in flight and its own AIO contexts, "
+		"sharing the expected state; 0 submits from the main thread");
 DEFINE_int32(percent, 100, "Percent of block device to use for IOs");
 DEFINE_string(blocksize, "4096:40,8192:40",	"Typical block sizes for IO.");
+DEFINE_string(blocksize_remainder, "uniform", "Block sizes for IOs not covered by --blocksize: "
+		"uniform (any multiple of 512 up to 1MB), pow2 (512B to 1MB powers of two) or none");
+DEFINE_string(pattern, "zipf", "Access pattern zipf/uniform/sequential/strided/pareto/hotcold");
+DEFINE_double(zipf_theta, 0.9, "zipf pattern: theta (!= 1.0)");
+DEFINE_double(pareto_h, 0.2, "pareto pattern: h (0 < h < 1)");
+DEFINE_int32(stride, 1 << 20, "strided pattern: distance in bytes between consecutive IOs");
+DEFINE_double(hot_percent, 10, "hotcold pattern: percent of the region which is hot");
+DEFINE_double(hot_io_percent, 90, "hotcold pattern: percent of IOs to the hot region");
 DEFINE_string(runtime, "1h", "runtime in (s)seconds/(m)minutes/(h)hours/(d)days");
 DEFINE_string(logpath, "/tmp/", "Log directory path");
+DEFINE_string(statefile, "", "File to save expected state to and resume from. Saved at mode switches and "
+		"checkpoints with no IOs in flight; loading checks and rebuilds every record, O(ranges). "
+		"A run killed or crashed since its last save resumes only with the same --journal");
+DEFINE_int32(checkpoint_interval, 0, "statefile: also save every this many seconds while writing, "
+		"draining IOs to do so; 0 only at mode switches");
+DEFINE_bool(verify_only, false, "Only read back and verify what is recorded in --statefile");
+DEFINE_string(journal, "", "File or device to journal writes to, the data "
+	"device is flushed before acknowledged writes are journaled");
+DEFINE_string(journal_check, "", "After a power loss, check the disk against --statefile and this journal");
+DEFINE_string(trace, "", "blktrace (blkparse -d) or fio iolog to replay instead of zipf IOs");
+DEFINE_string(trace_format, "auto", "Trace format auto/blktrace/iolog");
 
 vector<string> split(const string &str, char delim) {
 	std::vector<string> tokens;
@@ -57,6 +114,39 @@ void bytesToHumanReadable(uint64_t nbytes, uint64_t &valp, string &unitp) {
 	unitp = "TB";
 }
 
+uint64_t parseSize(const string &str) {
+	if (str.empty()) {
+		return 0;
+	}
+
+	size_t e;
+	auto n = std::stoull(str, &e);
+	if (e == str.length()) {
+		return n;
+	} else if (e + 1 != str.length()) {
+		throw std::invalid_argument("Invalid size " + str);
+	}
+
+	switch (str.back()) {
+	case 't':
+	case 'T':
+		n <<= 10;
+	case 'g': /* fall through */
+	case 'G':
+		n <<= 10;
+	case 'm': /* fall through */
+	case 'M':
+		n <<= 10;
+	case 'k': /* fall through */
+	case 'K':
+		n <<= 10;
+		break;
+	default:
+		throw std::invalid_argument("Invalid size " + str);
+	}
+	return n;
+}
+
 int main(int argc, char *argv[]) {
 	google::ParseCommandLineFlags(&argc, &argv, true);
 
@@ -66,8 +156,8 @@ int main(int argc, char *argv[]) {
 		throw std::invalid_argument("Block sizes not given.");
 	}
 
-	auto tp = 0;
-	vector<pair<uint32_t, uint8_t>> sizes;
+	auto tp = 0.0;
+	vector<pair<uint32_t, double>> sizes;
 	for (auto &t : tokens) {
 		auto e = t.find(':');
 		if (e == string::npos) {
@@ -75,8 +165,8 @@ int main(int argc, char *argv[]) {
 			continue;
 		}
 		auto bs = std::stoul(t.substr(0, e));
-		auto p  = std::stoul(t.substr(e+1));
-		if (!bs || !p || bs % 512 != 0 || p > 100) {
+		auto p  = std::stod(t.substr(e+1));
+		if (!bs || p <= 0 || bs % 512 != 0 || bs > (1ul << 20) || p > 100) {
 			cout << "Invalid block size " << t << endl;
 			continue;
 		}
@@ -87,13 +177,33 @@ int main(int argc, char *argv[]) {
 
 	if (!sizes.size()) {
 		throw std::invalid_argument("Block sizes not given.");
-	} else if (tp > 100) {
+	} else if (tp > 100 + 1e-6) {
 		throw std::invalid_argument("Invalid Blocksizes.\n");
 	}
 
+	/* complete block size distribution, including the remainder */
+	auto dist = sizes;
+	auto rp   = tp < 100 ? 100 - tp : 0.0;
+	if (FLAGS_blocksize_remainder == "uniform") {
+		const uint32_t n = (1ul << 20) >> 9;
+		for (uint32_t ns = 1; rp > 0 && ns <= n; ns++) {
+			dist.push_back(std::make_pair(ns, rp / n));
+		}
+	} else if (FLAGS_blocksize_remainder == "pow2") {
+		const uint32_t n = 12;
+		for (uint32_t i = 0; rp > 0 && i < n; i++) {
+			dist.push_back(std::make_pair(1u << i, rp / n));
+		}
+	} else if (FLAGS_blocksize_remainder != "none") {
+		throw std::invalid_argument("Invalid blocksize_remainder");
+	}
+
 	/* check IO Depth */
-	if (FLAGS_iodepth <= 0 || FLAGS_iodepth > 512) {
-		throw std::invalid_argument("iodepth > 0 and iodepth < 512");
+	if (FLAGS_iodepth <= 0 || FLAGS_iodepth > 65536) {
+		throw std::invalid_argument("iodepth > 0 and iodepth <= 65536");
+	}
+	if (FLAGS_aio_contexts < 0 || FLAGS_aio_contexts > FLAGS_iodepth) {
+		throw std::invalid_argument("aio_contexts >= 0 and aio_contexts <= iodepth");
 	}
 
 	/* check percentage */
@@ -101,6 +211,25 @@ int main(int argc, char *argv[]) {
 		throw std::invalid_argument("percent > 0 and percent < 100");
 	}
 
+	/* check access pattern */
+	pattern_config pattern;
+	pattern.name           = FLAGS_pattern;
+	pattern.zipf_theta     = FLAGS_zipf_theta;
+	pattern.pareto_h       = FLAGS_pareto_h;
+	pattern.stride         = FLAGS_stride >> 9;
+	pattern.hot_percent    = FLAGS_hot_percent;
+	pattern.hot_io_percent = FLAGS_hot_io_percent;
+	if (pattern.zipf_theta <= 0 || pattern.zipf_theta == 1.0) {
+		throw std::invalid_argument("zipf_theta > 0 and zipf_theta != 1");
+	} else if (pattern.pareto_h <= 0 || pattern.pareto_h >= 1) {
+		throw std::invalid_argument("pareto_h > 0 and pareto_h < 1");
+	} else if (FLAGS_stride <= 0 || FLAGS_stride % 512 != 0) {
+		throw std::invalid_argument("stride must be a multiple of 512");
+	} else if (pattern.hot_percent <= 0 || pattern.hot_percent >= 100 ||
+			pattern.hot_io_percent < 0 || pattern.hot_io_percent > 100) {
+		throw std::invalid_argument("Invalid hotcold percentages");
+	}
+
 	/* check runtime */
 	auto m  = 1ull;
 	auto &c = FLAGS_runtime.back();
@@ -139,19 +268,221 @@ int main(int argc, char *argv[]) {
 	runtime *= m;
 
 	/* constuct disk object */
-	disk d1(FLAGS_disk, FLAGS_percent, sizes, FLAGS_iodepth, (uint64_t)runtime);
+	disk d1(FLAGS_disk, FLAGS_percent, dist, FLAGS_iodepth, (uint64_t)runtime, pattern,
+		parseSize(FLAGS_size));
+	if (FLAGS_submit_threads < 0 || FLAGS_submit_threads > 256) {
+		throw std::invalid_argument("submit_threads >= 0 and submit_threads <= 256");
+	}
+	if (FLAGS_submit_threads && (!FLAGS_trace.empty() || !FLAGS_journal.empty() ||
+			!FLAGS_journal_check.empty() || FLAGS_verify_only || FLAGS_prefill ||
+			FLAGS_verify_threads || FLAGS_completion == "compare")) {
+		throw std::invalid_argument("submit_threads can not be used with trace, journal, "
+			"journal_check, verify_only, prefill, verify_threads or completion compare");
+	}
+	d1.setSubmitThreads(FLAGS_submit_threads);
+	auto aios = d1.getAsyncIOs();
+	for (auto aiop : aios) {
+		aiop->setRingReap(FLAGS_aio_ring);
+		if (FLAGS_aio_contexts) {
+			aiop->setContexts(FLAGS_aio_contexts);
+		}
+	}
+	if (FLAGS_submit_batch <= 0 || FLAGS_submit_batch > FLAGS_iodepth) {
+		throw std::invalid_argument("submit_batch > 0 and submit_batch <= iodepth");
+	}
+	for (auto aiop : aios) {
+		aiop->setBatch(FLAGS_submit_batch, FLAGS_submit_deadline_us);
+	}
+	if (FLAGS_verify_threads < 0 || FLAGS_verify_threads > 256) {
+		throw std::invalid_argument("verify_threads >= 0 and verify_threads <= 256");
+	}
+	if (FLAGS_numa_node < -2) {
+		throw std::invalid_argument("numa_node >= -2");
+	} else if (FLAGS_numa_node >= 0) {
+		auto nodes = numaOnlineNodes();
+		if (std::find(nodes.begin(), nodes.end(), FLAGS_numa_node) == nodes.end()) {
+			string online;
+			for (auto n : nodes) {
+				online += (online.empty() ? "" : ",") + std::to_string(n);
+			}
+			throw std::invalid_argument("numa_node " +
+				std::to_string(FLAGS_numa_node) + " is not online, online nodes " +
+				online);
+		}
+	}
+	auto numaNode = FLAGS_numa_node == -2 ? -1 : d1.setNumaNode(FLAGS_numa_node);
+	d1.setVerifyThreads(FLAGS_verify_threads);
+	if (!FLAGS_map_budget.empty()) {
+		d1.setMapBudget(parseSize(FLAGS_map_budget));
+	}
+	if (FLAGS_report_interval < 0) {
+		throw std::invalid_argument("report_interval >= 0");
+	}
+	d1.setReportInterval(FLAGS_report_interval);
+	if (FLAGS_slow_ios < 0 || FLAGS_slow_ios > 1024) {
+		throw std::invalid_argument("slow_ios >= 0 and slow_ios <= 1024");
+	}
+	for (auto aiop : aios) {
+		aiop->setSlowIOs(FLAGS_slow_ios);
+	}
+	if (FLAGS_live_stats_ms < 0) {
+		throw std::invalid_argument("live_stats_ms >= 0");
+	}
+	if (FLAGS_live_stats_ms) {
+		d1.setLiveStats(FLAGS_live_stats_ms);
+	}
+	if (FLAGS_verify_sample < 1) {
+		throw std::invalid_argument("verify_sample >= 1");
+	}
+	if (FLAGS_verify_depth == "full") {
+		d1.setVerifyDepth(VerifyDepth::FULL, FLAGS_verify_sample);
+	} else if (FLAGS_verify_depth == "edges") {
+		d1.setVerifyDepth(VerifyDepth::EDGES, FLAGS_verify_sample);
+	} else {
+		throw std::invalid_argument("Invalid verify_depth");
+	}
+	if (!FLAGS_buffer_arena.empty()) {
+		ArenaPages pages;
+		if (FLAGS_buffer_arena_pages == "1G") {
+			pages = ArenaPages::HUGE_1G;
+		} else if (FLAGS_buffer_arena_pages == "2M") {
+			pages = ArenaPages::HUGE_2M;
+		} else if (FLAGS_buffer_arena_pages == "thp") {
+			pages = ArenaPages::THP;
+		} else {
+			throw std::invalid_argument("Invalid buffer_arena_pages");
+		}
+		/*
+		 * Every buffer in use must fit, a miss falls back to posix_memalign:
+		 * IOs in flight and reads queued on verifier threads.
+		 */
+		uint64_t maxIO = io_generator::MAX_IO_SIZE;
+		if (FLAGS_trace.empty() && !FLAGS_verify_only && !FLAGS_prefill &&
+				FLAGS_journal_check.empty()) {
+			maxIO = 0;
+			for (auto &d : dist) {
+				maxIO = std::max<uint64_t>(maxIO, (uint64_t) d.first << 9);
+			}
+		}
+		uint64_t nbufs = (uint64_t) FLAGS_iodepth *
+			(std::max(FLAGS_submit_threads, 1) + FLAGS_verify_threads);
+		auto need  = nbufs * IOArena::blockBytes(maxIO);
+		auto bytes = parseSize(FLAGS_buffer_arena);
+		if (bytes < need) {
+			throw std::invalid_argument("buffer_arena " + FLAGS_buffer_arena +
+				" can not hold " + std::to_string(nbufs) + " buffers of up to " +
+				std::to_string(maxIO >> 10) + "K, at least " +
+				std::to_string((need + (1 << 20) - 1) >> 20) + "M is needed");
+		}
+		/* after NUMA pinning, so the arena is faulted in on the node */
+		IOArena::create(bytes, pages);
+	}
+	if (FLAGS_completion == "event") {
+		d1.setCompletionMode(CompletionMode::EVENT, 0, 0);
+	} else if (FLAGS_completion == "poll") {
+		d1.setCompletionMode(CompletionMode::POLL, FLAGS_poll_spin_us, FLAGS_poll_sleep_us);
+	} else if (FLAGS_completion == "compare") {
+		d1.setCompletionMode(CompletionMode::COMPARE, FLAGS_poll_spin_us, FLAGS_poll_sleep_us);
+	} else {
+		throw std::invalid_argument("Invalid completion mode");
+	}
+	if (FLAGS_test) {
+		d1.test();
+		cout << "Tests passed" << endl;
+		return 0;
+	}
+	if (FLAGS_hung_io_warn_ms < 0 || (FLAGS_hung_io_warn_ms &&
+			FLAGS_hung_io_critical_ms < FLAGS_hung_io_warn_ms)) {
+		throw std::invalid_argument("hung_io_warn_ms >= 0 and hung_io_critical_ms >= hung_io_warn_ms");
+	}
+	if (FLAGS_hung_io_warn_ms) {
+		/* not for the tests, they wait on the event base for completions */
+		d1.setHungIO(FLAGS_hung_io_warn_ms, FLAGS_hung_io_critical_ms, FLAGS_hung_io_abort);
+	}
+	if (!FLAGS_trace.empty()) {
+		if (FLAGS_verify_only) {
+			/* the sweep reads back the state file, there is nothing to replay */
+			throw std::invalid_argument("trace can not be used with verify_only");
+		}
+		d1.replayTrace(FLAGS_trace, FLAGS_trace_format);
+	}
+	if (!FLAGS_journal_check.empty()) {
+		if (!FLAGS_journal.empty() || !FLAGS_trace.empty()) {
+			throw std::invalid_argument("journal_check can not be used with journal or trace");
+		}
+		if (!FLAGS_statefile.empty()) {
+			d1.setStateFile(FLAGS_statefile, false, true);
+		}
+		d1.checkJournal(FLAGS_journal_check);
+	} else if (!FLAGS_statefile.empty()) {
+		/* a DIRTY state file is brought forward by setJournal() */
+		d1.setStateFile(FLAGS_statefile, FLAGS_verify_only, !FLAGS_journal.empty());
+	} else if (FLAGS_verify_only) {
+		throw std::invalid_argument("verify_only requires statefile");
+	}
+	if (FLAGS_checkpoint_interval < 0) {
+		throw std::invalid_argument("checkpoint_interval >= 0");
+	}
+	if (!FLAGS_statefile.empty()) {
+		d1.setCheckpointInterval(FLAGS_checkpoint_interval);
+	}
+	if (!FLAGS_journal.empty()) {
+		d1.setJournal(FLAGS_journal);
+	}
+	if (!FLAGS_corruption_report.empty()) {
+		d1.setCorruptionReport(FLAGS_corruption_report);
+	}
+	if (FLAGS_prefill) {
+		if (FLAGS_verify_only || !FLAGS_journal_check.empty()) {
+			throw std::invalid_argument("prefill can not be used with verify_only or journal_check");
+		}
+		d1.setPrefill();
+	}
 
 	/* print some information */
 	cout << "Disk " << FLAGS_disk << endl;
 	cout << "Disk size in sectors " << d1.nsectors() << endl;
 	cout << "Number of sectors for IOs " << d1.ioNSectors() << endl;
 	for (auto &s : sizes) {
-		cout << "Block Size = " << (s.first << 9) << " " << (int) s.second << "%\n";
+		cout << "Block Size = " << (s.first << 9) << " " << s.second << "%\n";
 	}
+	if (rp > 0) {
+		cout << "Block Size = " << FLAGS_blocksize_remainder << " " << rp << "%\n";
+	}
+	cout << "Access Pattern " << FLAGS_pattern << endl;
 	cout << "IODepth " << FLAGS_iodepth << endl;
+	if (FLAGS_submit_threads) {
+		cout << "Submit threads " << FLAGS_submit_threads << endl;
+	}
+	cout << "Completion " << FLAGS_completion << endl;
+	cout << "Verify threads " << FLAGS_verify_threads << endl;
+	cout << "Verify depth " << FLAGS_verify_depth << " one read in " <<
+		FLAGS_verify_sample << endl;
+	if (numaNode >= 0) {
+		cout << "NUMA node " << numaNode << " of " << numaNumNodes() <<
+			" (device node " << numaDeviceNode(FLAGS_disk) << ")" << endl;
+	} else {
+		cout << "NUMA node none" << endl;
+	}
+	cout << "Submit batch " << FLAGS_submit_batch << " deadline " <<
+		FLAGS_submit_deadline_us << "us" << endl;
 	cout << "Runtime " << runtime << " seconds\n";
+	if (!FLAGS_trace.empty()) {
+		cout << "Replaying trace " << FLAGS_trace << endl;
+	}
+	if (!FLAGS_statefile.empty()) {
+		cout << "State file " << FLAGS_statefile << " resumed with " <<
+			d1.getNRanges() << " ranges" << endl;
+	}
+	if (!FLAGS_journal.empty()) {
+		cout << "Journal " << FLAGS_journal << endl;
+	}
 
+	struct rusage ru0;
+	getrusage(RUSAGE_SELF, &ru0);
 	d1.verify();
+	struct rusage ru1;
+	getrusage(RUSAGE_SELF, &ru1);
 
 	uint64_t nr, nw, nbr, nbw;
 	d1.getStats(&nr, &nw, &nbr, &nbw);
@@ -164,7 +495,135 @@ int main(int argc, char *argv[]) {
 
 	cout << endl;
 	cout << "Total IOs " << nr + nw << endl;
-	cout << "Read (Verification) IOs " << nr << " Read (Verified) Bytes " << nbr << " (" << r << ur << ")" << endl;
+	cout << "Read (Verification) IOs " << nr << " Read Bytes " << nbr << " (" << r << ur << ")" << endl;
 	cout << "Write IOs " << nw << " Wrote Bytes " << nbw << " (" << w << uw << ")" << endl;
+	cout << "Map ranges " << d1.getNRanges() << " bytes " << d1.getMapBytes() <<
+		" merged " << d1.getNMerged() << " evicted " << d1.getNEvicted() << endl;
+	auto nbc = d1.getNBytesCompared();
+	cout << "Compared Bytes " << nbc << " (" << (nbr ? 100.0 * nbc / nbr : 0.0) <<
+		"% of read) reads not sampled " << d1.getNReadsSkipped() << endl;
+	for (size_t q = 0; q < aios.size(); q++) {
+		auto &aio    = *aios[q];
+		auto nios    = aio.getNReads() + aio.getNWrites();
+		string queue = aios.size() > 1 ? "Queue " + std::to_string(q) + " " : "";
+		cout << queue << "Syscalls " << aio.getNSyscalls() << " (" <<
+			(nios ? (double) aio.getNSyscalls() / nios : 0.0) << " per IO)";
+		if (aio.getRingReap()) {
+			cout << " Ring reaped IOs " << aio.getNRingReaped();
+		}
+		cout << endl;
+		if (aio.getNHungWarned()) {
+			cout << queue << "Hung IOs warned " << aio.getNHungWarned() <<
+				" critical " << aio.getNHungCritical() << endl;
+		}
+		cout << queue << "Submits " << aio.getNBatches() << " avg batch " <<
+			aio.getAvgBatch() << " partial " << aio.getNPartial() << " EAGAIN " <<
+			aio.getNEagain() << endl;
+		if (aio.getContexts().size() > 1) {
+			cout << queue << "AIO contexts " << aio.getContexts().size();
+			for (auto &c : aio.getContexts()) {
+				cout << " [depth " << c.depth << " submitted " << c.nsubmitted <<
+					" reaped " << c.nreaped << " max inflight " << c.maxInflight << "]";
+			}
+			cout << endl;
+		}
+	}
+	if (d1.getVerifyPool()) {
+		auto vp = d1.getVerifyPool();
+		cout << "Verifications offloaded " << vp->getNJobs() << " inline " <<
+			vp->getNInline() << endl;
+	}
+	if (d1.getCorruptionReporter()) {
+		auto cr = d1.getCorruptionReporter();
+		cout << "Corruptions " << cr->getNEvents() << " dropped " << cr->getNDropped();
+		for (int i = 0; i < (int) SectorState::MAX; i++) {
+			auto n = cr->getNSectors((SectorState) i);
+			if (n) {
+				cout << " " << sectorStateName((SectorState) i) << "=" << n;
+			}
+		}
+		cout << " (" << FLAGS_corruption_report << ")" << endl;
+	}
+	cout << "Page faults minor " << ru1.ru_minflt - ru0.ru_minflt << " major " <<
+		ru1.ru_majflt - ru0.ru_majflt << endl;
+	if (IOArena::get()) {
+		auto ap = IOArena::get();
+		cout << "Buffer arena " << (ap->getBytes() >> 20) << "M on " <<
+			arenaPagesName(ap->getPages()) << " pages" <<
+			(ap->getLocked() ? " locked" : " not locked") << ", misses " <<
+			ap->getNMisses() << endl;
+	}
+	if (numaNumNodes() > 1) {
+		cout << "NUMA IO thread on node " << numaCurrentNode();
+		if (d1.getVerifyPool()) {
+			cout << " verifiers";
+			for (auto &n : d1.getVerifyPool()->getWorkerNodes()) {
+				cout << " node" << n.first << " " << n.second;
+			}
+		}
+		cout << " buffer pages";
+		vector<void *> pages;
+		for (auto aiop : aios) {
+			auto p = aiop->getFreeBufferPages();
+			pages.insert(pages.end(), p.begin(), p.end());
+		}
+		for (auto &n : numaPageNodes(pages)) {
+			if (n.first < 0) {
+				cout << " unmapped " << n.second;
+			} else {
+				cout << " node" << n.first << " " << n.second;
+			}
+		}
+		cout << endl;
+	}
+	for (auto polling : {false, true}) {
+		for (auto read : {true, false}) {
+			/* of every submitter thread together */
+			LatencyHistogram h;
+			for (auto aiop : aios) {
+				aiop->mergeLatency(h, polling, read);
+			}
+			if (h.count() == 0) {
+				continue;
+			}
+			printf("%-5s %-5s latency(us) p50 %.1f p99 %.1f p99.9 %.1f max %.1f mean %.1f\n",
+				polling ? "poll" : "event", read ? "read" : "write",
+				h.percentile(50) / 1e3, h.percentile(99) / 1e3,
+				h.percentile(99.9) / 1e3, h.max() / 1e3, h.mean() / 1e3);
+		}
+	}
+	SlowIOs slowest;
+	slowest.setMax(FLAGS_slow_ios);
+	for (auto aiop : aios) {
+		for (auto &slow : aiop->getSlowIOs()) {
+			slowest.add(slow);
+		}
+	}
+	for (auto &slow : slowest.sorted()) {
+		cout << "Slow IO " << disk::slowIOString(slow, d1.getStartNs()) << endl;
+	}
+	if (d1.getTraceReplay()) {
+		auto tp = d1.getTraceReplay();
+		cout << "Trace IOs " << tp->getReader()->getNRecords() <<
+			" Skipped records " << tp->getReader()->getNSkipped() <<
+			" Loops " << tp->getNLoops() << endl;
+	}
+	if (d1.getJournal()) {
+		auto jp = d1.getJournal();
+		cout << "Journal records " << jp->getNRecords() << " commits " <<
+			jp->getNCommits() << " data flushes " << jp->getNDataFlushes() << endl;
+	}
+	if (!FLAGS_journal_check.empty()) {
+		auto &cs = d1.getCheckStats();
+		cout << "Checked ranges " << cs.nranges << " intact " << cs.intact <<
+			" old-data " << cs.oldData << " torn " << cs.torn <<
+			" in-flight sectors " << cs.inflight << endl;
+		cout << "Sectors";
+		for (int i = 0; i < (int) SectorState::MAX; i++) {
+			cout << " " << sectorStateName((SectorState) i) << " " << cs.sectors[i];
+		}
+		cout << endl;
+		return cs.intact == cs.nranges ? 0 : 1;
+	}
 	return 0;
 }
@@ -0,0 +1,197 @@
+#include <string>
+#include <stdexcept>
+
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "state_file.h"
+
+using std::string;
+using std::runtime_error;
+
+StateFile::StateFile(const string &path) : path_(path), fd_(-1),
+			mapp_(nullptr), mapSize_(0) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd_ < 0) {
+		throw runtime_error("Could not open state file " + path);
+	}
+}
+
+StateFile::~StateFile() {
+	unmap();
+	if (fd_ >= 0) {
+		close(fd_);
+	}
+}
+
+void StateFile::unmap() {
+	if (mapp_) {
+		munmap(mapp_, mapSize_);
+		mapp_    = nullptr;
+		mapSize_ = 0;
+	}
+}
+
+void StateFile::map(size_t size) {
+	unmap();
+	auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (p == MAP_FAILED) {
+		throw runtime_error("Could not mmap state file " + path_);
+	}
+	mapp_    = reinterpret_cast<char *>(p);
+	mapSize_ = size;
+}
+
+void StateFile::sync(void *addr, size_t size) {
+	auto rc = msync(addr, size, MS_SYNC);
+	if (rc < 0) {
+		throw runtime_error("msync failed on state file " + path_);
+	}
+}
+
+/* FNV-1a over 8 byte words */
+uint64_t StateFile::checksum(const void *p, size_t size, uint64_t csum) {
+	assert(size % sizeof(uint64_t) == 0);
+	auto wp = reinterpret_cast<const uint64_t *>(p);
+	for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+		csum ^= wp[i];
+		csum *= 0x100000001b3ull;
+	}
+	return csum;
+}
+
+state_header *StateFile::header() {
+	assert(mapp_);
+	return reinterpret_cast<state_header *>(mapp_);
+}
+
+bool StateFile::load(uint64_t diskSectors, bool allowDirty) {
+	struct stat sb;
+	auto rc = fstat(fd_, &sb);
+	if (rc < 0) {
+		throw runtime_error("Could not stat state file " + path_);
+	}
+
+	if (sb.st_size == 0) {
+		/* new state file */
+		return false;
+	} else if (sb.st_size < (off_t) HEADER_SIZE) {
+		throw runtime_error(path_ + " is not a state file.");
+	}
+
+	map(sb.st_size);
+	auto hp = header();
+	if (hp->magic != MAGIC || hp->version != VERSION) {
+		throw runtime_error(path_ + " is not a state file.");
+	}
+	if (hp->header_csum != checksum(hp, offsetof(state_header, header_csum), 0)) {
+		throw runtime_error(path_ + " header is corrupted.");
+	}
+	if (hp->state != STATE_CLEAN && !allowDirty) {
+		throw runtime_error(path_ + " was not saved cleanly, IOs were "
+			"written after the last save. Resume with the run's --journal.");
+	}
+	if (hp->disk_sectors != diskSectors) {
+		throw runtime_error(path_ + " belongs to a device of different size.");
+	}
+
+	auto size = sizeof(state_record) * hp->nrecords;
+	if (HEADER_SIZE + size > (size_t) sb.st_size) {
+		throw runtime_error(path_ + " is truncated.");
+	}
+	if (hp->records_csum != checksum(records(), size, 0)) {
+		throw runtime_error(path_ + " records are corrupted.");
+	}
+	return true;
+}
+
+const state_record *StateFile::records() {
+	return reinterpret_cast<const state_record *>(mapp_ + HEADER_SIZE);
+}
+
+uint64_t StateFile::nrecords() {
+	return header()->nrecords;
+}
+
+uint64_t StateFile::generation() {
+	return mapp_ ? header()->generation : 0;
+}
+
+bool StateFile::dirty() {
+	return mapp_ && header()->state != STATE_CLEAN;
+}
+
+uint64_t StateFile::flags() {
+	return header()->flags;
+}
+
+uint64_t StateFile::ioSectors() {
+	return header()->io_sectors;
+}
+
+void StateFile::markDirty() {
+	if (mapp_ == nullptr) {
+		/* nothing saved yet */
+		return;
+	}
+
+	auto hp = header();
+	if (hp->state == STATE_DIRTY) {
+		return;
+	}
+
+	hp->state       = STATE_DIRTY;
+	hp->header_csum = checksum(hp, offsetof(state_header, header_csum), 0);
+	sync(mapp_, HEADER_SIZE);
+}
+
+void StateFile::save(uint64_t diskSectors, uint64_t ioSectors, uint64_t nrecords,
+		uint64_t flags, std::function<void(state_record *)> fill) {
+	uint64_t generation = 0;
+	if (mapp_) {
+		generation = header()->generation;
+		markDirty();
+	}
+
+	auto size = HEADER_SIZE + sizeof(state_record) * nrecords;
+	auto rc   = ftruncate(fd_, size);
+	if (rc < 0) {
+		throw runtime_error("Could not resize state file " + path_);
+	}
+	map(size);
+
+	auto hp = header();
+	if (hp->magic != MAGIC) {
+		/* new file */
+		std::memset(hp, 0, HEADER_SIZE);
+		hp->magic       = MAGIC;
+		hp->version     = VERSION;
+		hp->state       = STATE_DIRTY;
+		hp->header_csum = checksum(hp, offsetof(state_header, header_csum), 0);
+		sync(mapp_, HEADER_SIZE);
+	}
+	assert(hp->state == STATE_DIRTY);
+
+	auto rp = reinterpret_cast<state_record *>(mapp_ + HEADER_SIZE);
+	fill(rp);
+	if (nrecords) {
+		sync(mapp_, size);
+	}
+
+	hp->disk_sectors = diskSectors;
+	hp->io_sectors   = ioSectors;
+	hp->nrecords     = nrecords;
+	hp->generation   = generation + 1;
+	hp->flags        = flags;
+	hp->records_csum = checksum(rp, size - HEADER_SIZE, 0);
+	hp->state        = STATE_CLEAN;
+	hp->header_csum  = checksum(hp, offsetof(state_header, header_csum), 0);
+	sync(mapp_, HEADER_SIZE);
+}
@@ -0,0 +1,103 @@
+#ifndef __STATE_FILE_H__
+#define __STATE_FILE_H__
+
+#include <cstdint>
+#include <string>
+#include <functional>
+
+using std::string;
+
+/*
+ * On disk form of the expected state map. A 4K header page followed by fixed
+ * size records sorted by sector. The header is marked DIRTY before records
+ * are rewritten and CLEAN (with checksums) only after they are synced, so a
+ * crash at any point leaves a file which either loads correctly or is
+ * rejected.
+ *
+ * Loading is O(records): both checksums are verified and the map is rebuilt
+ * with hinted inserts, records being sorted. Saves need no IOs in flight, so
+ * a crash loses what was written since the last mode switch or checkpoint,
+ * unless it was journaled: the journal's epoch is the generation of the save
+ * its records apply on top of, and replaying them brings a DIRTY file's
+ * records forward to the crash.
+ */
+struct state_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t state;
+	uint64_t disk_sectors; /* size of device the state belongs to */
+	uint64_t io_sectors;   /* sectors used for IOs */
+	uint64_t nrecords;
+	uint64_t generation;   /* incremented on every save */
+	uint64_t flags;
+	uint64_t records_csum;
+	uint64_t header_csum;  /* of all fields above */
+};
+
+/* a hole, which is not verified, has pattern_nsectors 0 */
+struct state_record {
+	uint64_t sector;
+	uint32_t nsectors;
+	int16_t  pattern_start;
+	uint16_t pad;
+	uint64_t pattern_sector;   /* pattern is <pattern_sector,pattern_nsectors> */
+	uint32_t pattern_nsectors;
+	uint32_t pad2;
+};
+
+class StateFile {
+public:
+	static const uint64_t MAGIC       = 0x3145544154535644ull; /* DVSTATE1 */
+	static const uint32_t VERSION     = 1;
+	static const uint32_t STATE_CLEAN = 1;
+	static const uint32_t STATE_DIRTY = 2;
+	static const size_t   HEADER_SIZE = 4096;
+
+	/* flags, FLAG_BASE: io_sectors were prefilled */
+	static const uint64_t FLAG_BASE   = 1;
+
+private:
+	string   path_;
+	int      fd_;
+	char     *mapp_;
+	size_t   mapSize_;
+
+private:
+	void unmap();
+	void map(size_t size);
+	void sync(void *addr, size_t size);
+	static uint64_t checksum(const void *p, size_t size, uint64_t csum);
+	state_header *header();
+
+public:
+	StateFile(const string &path);
+	~StateFile();
+
+	/*
+	 * Map the file and validate it against the disk. Returns false if the
+	 * file is empty (nothing saved yet), throws if it can not be used.
+	 * allowDirty accepts a file marked DIRTY whose records are intact, they
+	 * are the state as of the last save.
+	 */
+	bool load(uint64_t diskSectors, bool allowDirty = false);
+
+	const state_record *records();
+	uint64_t nrecords();
+	uint64_t generation();
+	/* loaded file was marked DIRTY, written to after its last save */
+	bool dirty();
+	uint64_t flags();
+	uint64_t ioSectors();
+
+	/* state file no longer matches the device, header is marked DIRTY */
+	void markDirty();
+
+	/*
+	 * Replace the saved state with nrecords records produced by fill, called
+	 * once with a pointer to space for all of them.
+	 */
+	void save(uint64_t diskSectors, uint64_t ioSectors, uint64_t nrecords,
+		uint64_t flags, std::function<void(state_record *)> fill);
+};
+
+#endif
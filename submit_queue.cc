@@ -0,0 +1,364 @@
+#include <cassert>
+
+#include <unistd.h>
+
+#include "submit_queue.h"
+#include "topology.h"
+
+static const uint64_t SECTOR_SHIFT = io_generator::SECTOR_SHIFT;
+
+InflightRanges::InflightRanges(uint64_t nsectors) {
+	auto max        = io_generator::MAX_SECTORS;
+	nstripes_       = std::max<uint64_t>(1, std::min<uint64_t>(4096, nsectors / max));
+	stripeSectors_  = std::max<uint64_t>(max, (nsectors + nstripes_ - 1) / nstripes_);
+	stripes_.reset(new Stripe[nstripes_]);
+}
+
+/* lock the stripes IOs overlapping r can start in */
+void InflightRanges::lock(const range &r, size_t &first, size_t &last) {
+	first = stripe(r.start_sector());
+	last  = stripe(r.end_sector());
+	first = first ? first - 1 : 0;
+	assert(last - first <= 2);
+
+	/* always in ascending order, no thread waits on one it holds up */
+	for (auto i = first; i <= last; i++) {
+		stripes_[i].lock.lock();
+	}
+}
+
+void InflightRanges::unlock(size_t first, size_t last) {
+	for (auto i = last + 1; i-- > first; ) {
+		stripes_[i].lock.unlock();
+	}
+}
+
+void InflightRanges::add(const range &r, const void *io) {
+	size_t first;
+	size_t last;
+	lock(r, first, last);
+
+	bool clean = true;
+	for (auto i = first; i <= last; i++) {
+		for (auto &it : stripes_[i].ranges) {
+			if (r < it.r || it.r < r) {
+				/* not overlapping */
+				continue;
+			}
+			clean    = false;
+			it.clean = false;
+		}
+
+		/* reads racing with this write can return either old or new data */
+		for (auto &it : stripes_[i].reads) {
+			if (r < it.r || it.r < r) {
+				continue;
+			}
+			it.clean = false;
+		}
+	}
+	stripes_[stripe(r.start_sector())].ranges.push_back({r, io, clean});
+	unlock(first, last);
+}
+
+void InflightRanges::addRead(const range &r, const void *io) {
+	size_t first;
+	size_t last;
+	lock(r, first, last);
+
+	bool clean = true;
+	for (auto i = first; i <= last && clean; i++) {
+		for (auto &it : stripes_[i].ranges) {
+			if (r < it.r || it.r < r) {
+				continue;
+			}
+			clean = false;
+			break;
+		}
+	}
+	stripes_[stripe(r.start_sector())].reads.push_back({r, io, clean});
+	unlock(first, last);
+}
+
+/* remove io's entry, swapping the last one into its place */
+pair<range, bool> InflightRanges::take(vector<Entry> &entries, const range &r,
+		const void *io) {
+	for (auto &it : entries) {
+		if (it.io == io) {
+			assert(it.r.sector == r.sector && it.r.nsectors == r.nsectors);
+			pair<range, bool> res(it.r, it.clean);
+			it = entries.back();
+			entries.pop_back();
+			return res;
+		}
+	}
+	assert(0);
+	return pair<range, bool>(r, false);
+}
+
+pair<range, bool> InflightRanges::remove(const range &r, const void *io) {
+	auto &s = stripes_[stripe(r.start_sector())];
+	std::lock_guard<std::mutex> l(s.lock);
+	return take(s.ranges, r, io);
+}
+
+pair<range, bool> InflightRanges::removeRead(const range &r, const void *io) {
+	auto &s = stripes_[stripe(r.start_sector())];
+	std::lock_guard<std::mutex> l(s.lock);
+	return take(s.reads, r, io);
+}
+
+static void queueIOCompleted(void *cbdata, ManagedBuffer bufp, size_t size,
+		uint64_t offset, ssize_t result, bool read) {
+	assert(cbdata && bufp && result == size && size >= (1u << SECTOR_SHIFT));
+	auto qp = reinterpret_cast<SubmitQueue *>(cbdata);
+	qp->ioCompleted(std::move(bufp), size, offset, read);
+}
+
+static void queueIOsCompleted(void *cbdata, uint32_t nios) {
+	auto qp = reinterpret_cast<SubmitQueue *>(cbdata);
+	qp->iosCompleted(nios);
+}
+
+SubmitQueue::SubmitQueue(disk *diskp, uint32_t id, uint32_t iodepth,
+			unique_ptr<io_generator> iogen) : diskp_(diskp), id_(id),
+			iodepth_(iodepth), fd_(diskp->disk_fd()),
+			asyncio_(iodepth, diskp->getAsyncIO().getEngine()),
+			iogen_(std::move(iogen)) {
+	if (asyncio_.getEngine() == IOEngine::RAM) {
+		/* every queue reads what the others wrote */
+		asyncio_.shareRamImage(diskp->getAsyncIO());
+	}
+}
+
+SubmitQueue::~SubmitQueue() {
+	join();
+}
+
+void SubmitQueue::setPolling(uint64_t spinNs, uint64_t sleepUs) {
+	pollSpinNs_  = spinNs;
+	pollSleepUs_ = sleepUs;
+	asyncio_.setPolling(true);
+}
+
+void SubmitQueue::start(int numaNode) {
+	thread_ = std::thread([this, numaNode] () {
+		if (numaNode >= 0) {
+			numaBindThread(numaNode);
+		}
+		run();
+	});
+}
+
+void SubmitQueue::join() {
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+}
+
+void SubmitQueue::run() {
+	/* the event base belongs to this thread from here on */
+	asyncio_.init(&base_);
+	asyncio_.registerCallback(queueIOCompleted, queueIOsCompleted, this);
+
+	submit(iodepth_);
+	publish();
+	if (asyncio_.getPolling()) {
+		pollLoop();
+	} else {
+		base_.loopForever();
+	}
+	publish();
+	diskp_->queueFinished();
+}
+
+/* as disk::pollLoop(), for this queue's AsyncIO and event base */
+void SubmitQueue::pollLoop() {
+	const uint64_t LOOP_NS = 1000000;
+
+	auto now       = monotonicNs();
+	auto idleSince = now;
+	auto lastLoop  = now;
+	while (!loopStop_) {
+		auto n = asyncio_.poll();
+		now    = monotonicNs();
+		if (n) {
+			idleSince = now;
+		} else if (pollSleepUs_ && now - idleSince >= pollSpinNs_) {
+			usleep(pollSleepUs_);
+		}
+
+		if (now - lastLoop >= LOOP_NS) {
+			base_.loopOnce(EVLOOP_NONBLOCK);
+			lastLoop = now;
+		}
+	}
+}
+
+void SubmitQueue::stop() {
+	if (loopStop_) {
+		return;
+	}
+	loopStop_ = true;
+	base_.terminateLoopSoon();
+}
+
+void SubmitQueue::ioCompleted(ManagedBuffer bufp, size_t size, uint64_t offset,
+		bool read) {
+	range r(offset >> SECTOR_SHIFT, size >> SECTOR_SHIFT);
+	if (read) {
+		reads_.push_back(r);
+		readBufs_.push_back(std::move(bufp));
+	} else {
+		writesDone_.push_back(r);
+		writeBufs_.push_back(std::move(bufp));
+	}
+}
+
+void SubmitQueue::iosCompleted(uint32_t nios) {
+	if (!writesDone_.empty()) {
+		/* the map shards of each write locked in turn */
+		diskp_->queueWritesDone(writesDone_, writeBufs_);
+		for (size_t i = 0; i < writesDone_.size(); i++) {
+			asyncio_.putIOBuffer(std::move(writeBufs_[i]),
+				(size_t) writesDone_[i].nsectors << SECTOR_SHIFT);
+		}
+		writesDone_.clear();
+		writeBufs_.clear();
+	}
+	if (!reads_.empty()) {
+		verifyReads();
+	}
+	submit(nios);
+	publish();
+}
+
+void SubmitQueue::verifyReads() {
+	auto sample = diskp_->getVerifySample();
+	auto depth  = diskp_->getVerifyDepth();
+	auto verify = asyncio_.getEngine() != IOEngine::NULLIO;
+
+	/* drop reads not sampled, the null engine has no data behind it */
+	size_t n = 0;
+	for (size_t i = 0; i < reads_.size(); i++) {
+		if (verify && nsampleReads_++ % sample == 0) {
+			reads_[n]      = reads_[i];
+			readBufs_[n++] = std::move(readBufs_[i]);
+			continue;
+		} else if (verify) {
+			nreadsSkipped_++;
+		}
+		diskp_->queueReadDone(reads_[i].sector, reads_[i].nsectors,
+			readBufs_[i].get());
+		asyncio_.putIOBuffer(std::move(readBufs_[i]),
+			(size_t) reads_[i].nsectors << SECTOR_SHIFT);
+	}
+	reads_.erase(reads_.begin() + n, reads_.end());
+	readBufs_.erase(readBufs_.begin() + n, readBufs_.end());
+
+	/* copies of the expected state under shared locks, compared without */
+	if (n) {
+		expected_.resize(n);
+		diskp_->queueSnapshots(reads_, readBufs_, expected_);
+	}
+	for (size_t i = 0; i < n; i++) {
+		auto &r = reads_[i];
+		try {
+			disk::verifyExpected(readBufs_[i].get(), r.sector, r.nsectors,
+				expected_[i], depth, &nbytesCompared_);
+		} catch (Corruption &c) {
+			diskp_->queueCorruption(c, readBufs_[i].get(), r.sector, r.nsectors,
+				expected_[i], asyncio_);
+		}
+		asyncio_.putIOBuffer(std::move(readBufs_[i]),
+			(size_t) r.nsectors << SECTOR_SHIFT);
+		expected_[i].clear();
+	}
+	reads_.clear();
+	readBufs_.clear();
+}
+
+void SubmitQueue::publish() {
+	nreads_.store(asyncio_.getNReads(), std::memory_order_relaxed);
+	nwrites_.store(asyncio_.getNWrites(), std::memory_order_relaxed);
+	nbytesRead_.store(asyncio_.getBytesRead(), std::memory_order_relaxed);
+	nbytesWrote_.store(asyncio_.getBytesWrote(), std::memory_order_relaxed);
+	nbytesComparedPub_.store(nbytesCompared_, std::memory_order_relaxed);
+	nreadsSkippedPub_.store(nreadsSkipped_, std::memory_order_relaxed);
+	pending_.store(asyncio_.getPending(), std::memory_order_relaxed);
+}
+
+void SubmitQueue::submit(uint64_t nios) {
+	if (!stopped_ && diskp_->queueStopped()) {
+		stopped_ = true;
+	}
+	if (stopped_) {
+		if (asyncio_.getPending() == 0) {
+			stop();
+		}
+		return;
+	}
+
+	if (diskp_->queueEpoch() != epoch_ && !diskp_->queueSavesState()) {
+		/* mode switch - IOs in flight of either mode are in the ranges */
+		diskp_->queueSwitch(epoch_, mode_);
+	} else if (diskp_->queueEpoch() != epoch_) {
+		/* state is saved - wait till all submitted IOs are complete */
+		if (asyncio_.getPending() != 0) {
+			return;
+		}
+		if (!diskp_->queueBarrier(epoch_, mode_)) {
+			stopped_ = true;
+			stop();
+			return;
+		}
+		nios = iodepth_;
+	}
+
+	switch (mode_) {
+	case IOMode::WRITE:
+		writesSubmit(nios);
+		break;
+	case IOMode::VERIFY:
+		readsSubmit(nios);
+		break;
+	}
+}
+
+void SubmitQueue::writesSubmit(uint64_t nwrites) {
+	io_desc descs[nwrites];
+
+	iogen_->next_ios(descs, nwrites);
+	for (uint64_t i = 0; i < nwrites; i++) {
+		auto s  = descs[i].sector;
+		auto ns = descs[i].nsectors;
+		assert(ns >= 1 && s + ns <= diskp_->nsectors());
+
+		string p;
+		disk::patternCreate(s, ns, p);
+
+		size_t sz = ns << SECTOR_SHIFT;
+		auto bufp = asyncio_.getIOBuffer(sz);
+		disk::patternFill(bufp.get(), sz, p);
+		diskp_->queueWriteSubmitted(s, ns, bufp.get());
+		asyncio_.pwriteQueue(fd_, std::move(bufp), sz, s << SECTOR_SHIFT);
+	}
+	asyncio_.submit();
+}
+
+void SubmitQueue::readsSubmit(uint64_t nreads) {
+	io_desc descs[nreads];
+
+	iogen_->next_ios(descs, nreads);
+	for (uint64_t i = 0; i < nreads; i++) {
+		auto s  = descs[i].sector;
+		auto ns = descs[i].nsectors;
+		assert(ns >= 1 && s + ns <= diskp_->nsectors());
+
+		size_t sz = ns << SECTOR_SHIFT;
+		auto bufp = asyncio_.getIOBuffer(sz);
+		diskp_->queueReadSubmitted(s, ns, bufp.get());
+		asyncio_.preadQueue(fd_, std::move(bufp), sz, s << SECTOR_SHIFT);
+	}
+	asyncio_.submit();
+}
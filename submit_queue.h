@@ -0,0 +1,189 @@
+#ifndef __SUBMIT_QUEUE_H__
+#define __SUBMIT_QUEUE_H__
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <utility>
+
+#include <folly/io/async/EventBase.h>
+
+#include "disk_io.h"
+
+using std::vector;
+using std::unique_ptr;
+using std::pair;
+
+/*
+ * IOs in flight, from the IO thread or every submitter thread. The sector
+ * space is cut into stripes, each with its own lock and the IOs starting in
+ * it. Stripes are at least the largest IO long, so IOs overlapping a range
+ * start in its first stripe, the one before or the one after - adding an IO
+ * locks those (in order), removing one only its own. Either only looks at
+ * the IOs near its range, not at everything in flight.
+ *
+ * Entries are found by their IO, the address of its buffer: the ranges of
+ * IOs in flight together may be the same.
+ */
+class InflightRanges {
+private:
+	struct Entry {
+		range      r;
+		const void *io;
+		bool       clean;
+	};
+
+	struct Stripe {
+		std::mutex    lock;
+		vector<Entry> ranges; /* writes */
+		vector<Entry> reads;  /* trace replay and submitter thread reads */
+	};
+
+	uint64_t            stripeSectors_;
+	size_t              nstripes_;
+	unique_ptr<Stripe[]> stripes_;
+
+	size_t stripe(uint64_t sector) const {
+		return std::min<size_t>(sector / stripeSectors_, nstripes_ - 1);
+	}
+
+	void lock(const range &r, size_t &first, size_t &last);
+	void unlock(size_t first, size_t last);
+	static pair<range, bool> take(vector<Entry> &entries, const range &r,
+		const void *io);
+
+public:
+	explicit InflightRanges(uint64_t nsectors);
+
+	uint64_t getStripeSectors() const {
+		return stripeSectors_;
+	}
+
+	/* io writing r and IOs in flight overlapping it are no longer clean */
+	void add(const range &r, const void *io);
+	/* io's range and whether it stayed clean */
+	pair<range, bool> remove(const range &r, const void *io);
+
+	/* a read is clean while no write overlapping it is in flight */
+	void addRead(const range &r, const void *io);
+	pair<range, bool> removeRead(const range &r, const void *io);
+};
+
+/*
+ * A submitter thread of disk::setSubmitThreads(): its own event base, AsyncIO
+ * and IO generator over the whole IO region, so every thread hits the same
+ * hot ranges. Completions are handed to the disk once per batch - writes to
+ * update the shared expected state map, reads for a snapshot of what they
+ * should hold, which is then verified on this thread.
+ *
+ * Queues follow the disk's IO mode, each switching on its own: its reads may
+ * overlap writes of others still in the old mode, or already in the new one.
+ * Reads stay in the in flight ranges till their snapshot is taken, those
+ * racing with a write are not verified. When state is saved, each drains its
+ * IOs and waits in disk::queueBarrier() for the others instead.
+ */
+class SubmitQueue {
+private:
+	disk                     *diskp_;
+	uint32_t                 id_;
+	uint32_t                 iodepth_;
+	int                      fd_;
+	folly::EventBase         base_;
+	AsyncIO                  asyncio_;
+	unique_ptr<io_generator> iogen_;
+	IOMode                   mode_     = IOMode::WRITE;
+	uint64_t                 epoch_    = 0;    /* of the disk's mode switches */
+	bool                     stopped_  = false; /* submitting, draining to exit */
+	bool                     loopStop_ = false;
+	uint64_t                 pollSpinNs_  = 0;
+	uint64_t                 pollSleepUs_ = 0;
+
+	/* completed since the last iosCompleted() */
+	vector<range>            writesDone_;
+	vector<ManagedBuffer>    writeBufs_; /* held till out of the in flight ranges */
+	vector<range>            reads_;
+	vector<ManagedBuffer>    readBufs_;
+	vector<vector<IO>>       expected_;
+
+	uint64_t                 nsampleReads_   = 0;
+	uint64_t                 nreadsSkipped_  = 0;
+	uint64_t                 nbytesCompared_ = 0;
+
+	/* copies of this thread's counters for reports from other threads */
+	std::atomic<uint64_t>    nreads_{0};
+	std::atomic<uint64_t>    nwrites_{0};
+	std::atomic<uint64_t>    nbytesRead_{0};
+	std::atomic<uint64_t>    nbytesWrote_{0};
+	std::atomic<uint64_t>    nbytesComparedPub_{0};
+	std::atomic<uint64_t>    nreadsSkippedPub_{0};
+	std::atomic<uint64_t>    pending_{0};
+
+	std::thread              thread_;
+
+private:
+	void run();
+	void pollLoop();
+	void submit(uint64_t nios);
+	void writesSubmit(uint64_t nwrites);
+	void readsSubmit(uint64_t nreads);
+	void verifyReads();
+	void publish();
+	void stop();
+
+public:
+	SubmitQueue(disk *diskp, uint32_t id, uint32_t iodepth,
+		unique_ptr<io_generator> iogen);
+	~SubmitQueue();
+
+	/* reap completions by polling, see disk::setCompletionMode() */
+	void setPolling(uint64_t spinNs, uint64_t sleepUs);
+	/* run the thread on numaNode, -1 anywhere */
+	void start(int numaNode);
+	void join();
+
+	/* AsyncIO callbacks, on the queue's thread */
+	void ioCompleted(ManagedBuffer bufp, size_t size, uint64_t offset, bool read);
+	void iosCompleted(uint32_t nios);
+
+	/* configure before start(), its counters are stable once join() returned */
+	AsyncIO &getAsyncIO() {
+		return asyncio_;
+	}
+
+	uint32_t getId() const {
+		return id_;
+	}
+
+	uint64_t getNReads() const {
+		return nreads_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getNWrites() const {
+		return nwrites_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getBytesRead() const {
+		return nbytesRead_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getBytesWrote() const {
+		return nbytesWrote_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getNBytesCompared() const {
+		return nbytesComparedPub_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getNReadsSkipped() const {
+		return nreadsSkippedPub_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getPending() const {
+		return pending_.load(std::memory_order_relaxed);
+	}
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "timer_wheel.h"
+
+TimerWheel::TimerWheel() {
+	for (auto &level : slots_) {
+		for (auto &head : level) {
+			head.prev = head.next = &head;
+		}
+	}
+}
+
+static inline void listAdd(TimerWheel::Entry *head, TimerWheel::Entry *ep) {
+	ep->prev         = head->prev;
+	ep->next         = head;
+	head->prev->next = ep;
+	head->prev       = ep;
+}
+
+/* link ep into the slot of the lowest level whose span covers its deadline */
+void TimerWheel::queue(Entry *ep) {
+	if (ep->expiry < next_) {
+		listAdd(&slots_[0][next_ & (SLOTS - 1)], ep);
+		return;
+	}
+	auto delta = ep->expiry - next_;
+	if (delta >= SPAN) {
+		delta = SPAN - 1;
+	}
+	unsigned level = 0;
+	while (delta >= (1ull << (BITS * (level + 1)))) {
+		level++;
+	}
+	auto expiry = level == LEVELS - 1 ? next_ + delta : ep->expiry;
+	listAdd(&slots_[level][(expiry >> (BITS * level)) & (SLOTS - 1)], ep);
+}
+
+/* requeue the entries of level's current slot, they now fit lower levels */
+unsigned TimerWheel::cascade(unsigned level) {
+	auto  index = (next_ >> (BITS * level)) & (SLOTS - 1);
+	auto  head  = &slots_[level][index];
+	Entry list;
+	if (head->next == head) {
+		return index;
+	}
+	list.next       = head->next;
+	list.prev       = head->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	head->prev = head->next = head;
+
+	while (list.next != &list) {
+		auto ep        = list.next;
+		list.next      = ep->next;
+		ep->next->prev = &list;
+		queue(ep);
+	}
+	return index;
+}
+
+void TimerWheel::advance(uint64_t tick, ExpireCB cb, void *cbdatap) {
+	if (nqueued_ == 0) {
+		/* nothing to run or cascade */
+		next_ = next_ > tick ? next_ : tick + 1;
+		return;
+	}
+
+	while (next_ <= tick) {
+		auto index = next_ & (SLOTS - 1);
+		for (unsigned l = 1; l < LEVELS && index == 0; l++) {
+			index = cascade(l);
+		}
+		index = next_ & (SLOTS - 1);
+		auto head = &slots_[0][index];
+		auto now  = next_++;
+
+		while (head->next != head) {
+			auto ep = head->next;
+			remove(ep);
+			if (ep->expiry > now) {
+				/* clamped to the wheel's span, not due yet */
+				insert(ep, ep->expiry);
+				continue;
+			}
+			cb(cbdatap, ep);
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <cstdint>
+
+/*
+ * Hierarchical timer wheel over intrusive entries, in the style of the
+ * classic Linux timer wheel: LEVELS wheels of SLOTS lists each, a level
+ * covering SLOTS times the span of the one below. Insert and remove are O(1)
+ * and never allocate, entries live in the objects they time. Advancing a tick
+ * runs one level 0 slot and, every SLOTS ticks, cascades a slot of the level
+ * above down.
+ *
+ * Deadlines are in ticks, the unit is up to the user. Deadlines further out
+ * than the wheel's span are clamped to it and re-queued when they come due.
+ */
+class TimerWheel {
+public:
+	static const unsigned BITS   = 6;
+	static const unsigned SLOTS  = 1u << BITS;
+	static const unsigned LEVELS = 4;
+	static const uint64_t SPAN   = 1ull << (BITS * LEVELS);
+
+	struct Entry {
+		Entry    *prev   = nullptr;
+		Entry    *next   = nullptr; /* nullptr while not queued */
+		uint64_t expiry  = 0;
+	};
+
+	typedef void (*ExpireCB)(void *cbdatap, Entry *ep);
+
+private:
+	Entry    slots_[LEVELS][SLOTS]; /* circular list heads */
+	uint64_t next_    = 0;          /* next tick to run */
+	uint64_t nqueued_ = 0;
+
+	void queue(Entry *ep);
+	unsigned cascade(unsigned level);
+
+public:
+	TimerWheel();
+	TimerWheel(const TimerWheel &) = delete;
+	TimerWheel &operator=(const TimerWheel &) = delete;
+
+	/* ep expires once tick expiry ran, a past expiry on the next tick */
+	void insert(Entry *ep, uint64_t expiry) {
+		ep->expiry = expiry;
+		queue(ep);
+		nqueued_++;
+	}
+
+	void remove(Entry *ep) {
+		if (!ep->next) {
+			return;
+		}
+		ep->prev->next = ep->next;
+		ep->next->prev = ep->prev;
+		ep->next       = nullptr;
+		nqueued_--;
+	}
+
+	/*
+	 * Run every tick up to and including tick, calling cb with each entry
+	 * expiring. Entries are removed before cb, which may insert them again.
+	 */
+	void advance(uint64_t tick, ExpireCB cb, void *cbdatap);
+
+	uint64_t getNQueued() const {
+		return nqueued_;
+	}
+};
+
+#endif
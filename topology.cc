@@ -0,0 +1,158 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <cstdlib>
+#include <climits>
+
+#include <unistd.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+
+#include "topology.h"
+
+static const char *NODE_DIR = "/sys/devices/system/node";
+
+/* set_mempolicy(2) mode, numaif.h is part of libnuma */
+static const int NUMA_MPOL_PREFERRED = 1;
+
+static bool readLine(const string &path, string &line) {
+	std::ifstream ifs(path);
+	if (!ifs.is_open()) {
+		return false;
+	}
+	return (bool) std::getline(ifs, line);
+}
+
+/* parse a cpu or node list like 0-3,8,10-11 */
+static vector<int> parseList(const string &list) {
+	vector<int> result;
+	std::stringstream ss(list);
+	string item;
+	while (std::getline(ss, item, ',')) {
+		if (item.empty()) {
+			continue;
+		}
+		auto d = item.find('-');
+		auto s = std::stoi(item.substr(0, d));
+		auto e = d == string::npos ? s : std::stoi(item.substr(d + 1));
+		for (auto i = s; i <= e; i++) {
+			result.push_back(i);
+		}
+	}
+	return result;
+}
+
+int numaDeviceNode(const string &path) {
+	struct stat sb;
+	if (stat(path.c_str(), &sb) < 0) {
+		return -1;
+	}
+
+	auto dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+	auto sys = "/sys/dev/block/" + std::to_string(major(dev)) + ":" +
+		std::to_string(minor(dev));
+
+	char rp[PATH_MAX];
+	if (realpath(sys.c_str(), rp) == nullptr) {
+		return -1;
+	}
+
+	/* walk up from the disk (or partition) to the first device with a node */
+	string dir(rp);
+	while (dir.length() > 1) {
+		string line;
+		if (readLine(dir + "/device/numa_node", line) ||
+				readLine(dir + "/numa_node", line)) {
+			auto node = std::atoi(line.c_str());
+			if (node >= 0) {
+				return node;
+			}
+		}
+		dir = dir.substr(0, dir.rfind('/'));
+	}
+	return -1;
+}
+
+vector<int> numaOnlineNodes() {
+	string line;
+	if (!readLine(string(NODE_DIR) + "/online", line)) {
+		return {0};
+	}
+	auto nodes = parseList(line);
+	if (nodes.empty()) {
+		return {0};
+	}
+	return nodes;
+}
+
+int numaNumNodes() {
+	return numaOnlineNodes().size();
+}
+
+vector<int> numaNodeCpus(int node) {
+	string line;
+	if (node < 0 || !readLine(string(NODE_DIR) + "/node" +
+			std::to_string(node) + "/cpulist", line)) {
+		return {};
+	}
+	return parseList(line);
+}
+
+bool numaBindThread(int node) {
+	auto cpus = numaNodeCpus(node);
+	if (cpus.empty()) {
+		return false;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto c : cpus) {
+		CPU_SET(c, &set);
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		return false;
+	}
+
+	unsigned long mask[16] = {};
+	const unsigned long BITS = sizeof(mask[0]) * 8;
+	if ((unsigned) node >= sizeof(mask) * 8) {
+		return true;
+	}
+	mask[node / BITS] |= 1ul << (node % BITS);
+	syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, sizeof(mask) * 8);
+	return true;
+}
+
+int numaCurrentNode() {
+	unsigned cpu;
+	unsigned node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0) {
+		return -1;
+	}
+	return node;
+}
+
+std::map<int, uint64_t> numaPageNodes(const vector<void *> &pages) {
+	std::map<int, uint64_t> nodes;
+	if (pages.empty()) {
+		return nodes;
+	}
+
+	/* move_pages(2) without target nodes reports where pages are */
+	vector<int> status(pages.size(), -1);
+	auto rc = syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr,
+			status.data(), 0);
+	if (rc < 0) {
+		return nodes;
+	}
+	for (auto s : status) {
+		nodes[s >= 0 ? s : -1]++;
+	}
+	return nodes;
+}
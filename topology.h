@@ -0,0 +1,41 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+using std::string;
+using std::vector;
+
+/*
+ * NUMA topology from sysfs, without libnuma. Node numbers are as in
+ * /sys/devices/system/node, -1 means unknown or not NUMA.
+ */
+
+/* NUMA node of a block device, or of the device backing a regular file */
+int numaDeviceNode(const string &path);
+
+/* online nodes, which need not be numbered 0 to count - 1; node 0 without NUMA */
+vector<int> numaOnlineNodes();
+
+/* number of online nodes, 1 on machines without NUMA */
+int numaNumNodes();
+
+/* cpus of a node */
+vector<int> numaNodeCpus(int node);
+
+/*
+ * Run the calling thread on the cpus of node and prefer the node for its
+ * memory allocations. Buffers the thread touches first land on the node.
+ */
+bool numaBindThread(int node);
+
+/* node the calling thread runs on now */
+int numaCurrentNode();
+
+/* number of pages on every node, for page aligned addresses */
+std::map<int, uint64_t> numaPageNodes(const vector<void *> &pages);
+
+#endif
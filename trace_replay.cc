@@ -0,0 +1,274 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+#include <cstdint>
+#include <cassert>
+
+#include "trace_replay.h"
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using std::cout;
+using std::endl;
+using std::runtime_error;
+
+/* blktrace on-disk record, see blktrace_api.h */
+struct blk_io_trace {
+	uint32_t magic;
+	uint32_t sequence;
+	uint64_t time;
+	uint64_t sector;
+	uint32_t bytes;
+	uint32_t action;
+	uint32_t pid;
+	uint32_t device;
+	uint32_t cpu;
+	uint16_t error;
+	uint16_t pdu_len;
+};
+
+static const uint32_t BLK_IO_TRACE_MAGIC = 0x65617400;
+static const uint32_t BLK_TC_SHIFT       = 16;
+static const uint32_t BLK_TC_READ        = 1u << 0;
+static const uint32_t BLK_TC_WRITE       = 1u << 1;
+static const uint32_t BLK_TC_NOTIFY      = 1u << 10;
+static const uint32_t BLK_TC_DISCARD     = 1u << 13;
+static const uint32_t BLK_TA_MASK        = 0xffff;
+static const uint32_t __BLK_TA_QUEUE     = 1;
+
+static const string FIO_IOLOG_V2 = "fio version 2 iolog";
+static const string FIO_IOLOG_V3 = "fio version 3 iolog";
+
+TraceReader::TraceReader(const string &path) : path_(path),
+			is_(path, std::ios::in | std::ios::binary),
+			nrecords_(0), nskipped_(0) {
+	if (!is_.is_open()) {
+		throw runtime_error("Could not open trace " + path);
+	}
+}
+
+void TraceReader::rewind() {
+	is_.clear();
+	is_.seekg(0, is_.beg);
+}
+
+BlkparseReader::BlkparseReader(const string &path) : TraceReader(path),
+			swap_(false), probed_(false) {
+	if (!probe()) {
+		throw runtime_error(path + " is not a blktrace/blkparse binary trace.");
+	}
+}
+
+bool BlkparseReader::probe() {
+	uint32_t magic;
+
+	is_.read((char *) &magic, sizeof(magic));
+	if (!is_) {
+		return false;
+	}
+	TraceReader::rewind();
+
+	if ((magic & 0xffffff00) == BLK_IO_TRACE_MAGIC) {
+		swap_ = false;
+	} else if ((__builtin_bswap32(magic) & 0xffffff00) == BLK_IO_TRACE_MAGIC) {
+		swap_ = true;
+	} else {
+		return false;
+	}
+	probed_ = true;
+	return true;
+}
+
+bool BlkparseReader::next(trace_io &tio) {
+	assert(probed_);
+
+	while (1) {
+		blk_io_trace t;
+		is_.read((char *) &t, sizeof(t));
+		if (!is_) {
+			return false;
+		}
+
+		if (swap_) {
+			t.magic   = __builtin_bswap32(t.magic);
+			t.sector  = __builtin_bswap64(t.sector);
+			t.bytes   = __builtin_bswap32(t.bytes);
+			t.action  = __builtin_bswap32(t.action);
+			t.pdu_len = __builtin_bswap16(t.pdu_len);
+		}
+
+		if ((t.magic & 0xffffff00) != BLK_IO_TRACE_MAGIC) {
+			cout << "Corrupted blktrace record in " << path_ << endl;
+			return false;
+		}
+
+		if (t.pdu_len) {
+			is_.ignore(t.pdu_len);
+		}
+
+		auto category = t.action >> BLK_TC_SHIFT;
+		if ((t.action & BLK_TA_MASK) != __BLK_TA_QUEUE ||
+				(category & (BLK_TC_NOTIFY | BLK_TC_DISCARD)) ||
+				!(category & (BLK_TC_READ | BLK_TC_WRITE)) ||
+				t.bytes < 512) {
+			nskipped_++;
+			continue;
+		}
+
+		tio.sector_   = t.sector;
+		tio.nsectors_ = t.bytes >> 9;
+		tio.read_     = !(category & BLK_TC_WRITE);
+		nrecords_++;
+		return true;
+	}
+}
+
+FioIologReader::FioIologReader(const string &path) : TraceReader(path),
+			version_(0) {
+	readHeader();
+}
+
+void FioIologReader::readHeader() {
+	string line;
+	if (!std::getline(is_, line)) {
+		throw runtime_error(path_ + " is empty.");
+	}
+
+	if (!line.empty() && line.back() == '\r') {
+		line.pop_back();
+	}
+
+	if (line == FIO_IOLOG_V2) {
+		version_ = 2;
+	} else if (line == FIO_IOLOG_V3) {
+		version_ = 3;
+	} else {
+		throw runtime_error(path_ + " is not a fio v2/v3 iolog.");
+	}
+}
+
+void FioIologReader::rewind() {
+	TraceReader::rewind();
+	readHeader();
+}
+
+bool FioIologReader::next(trace_io &tio) {
+	string line;
+
+	while (std::getline(is_, line)) {
+		vector<string> l;
+		std::istringstream ss(line);
+		string item;
+		while (ss >> item) {
+			l.emplace_back(item);
+		}
+
+		/* v3 lines are prefixed by a timestamp */
+		size_t a = version_ == 3 ? 2 : 1;
+		if (l.size() < a + 1) {
+			cout << "Unable to parse iolog line " << line << endl;
+			nskipped_++;
+			continue;
+		}
+
+		auto &action = l[a];
+		if (action != "read" && action != "write") {
+			/* add, open, close, sync, datasync, trim and wait */
+			nskipped_++;
+			continue;
+		}
+
+		if (l.size() != a + 3) {
+			cout << "Unable to parse iolog line " << line << endl;
+			nskipped_++;
+			continue;
+		}
+
+		uint64_t offset;
+		uint64_t length;
+		try {
+			offset = std::stoull(l[a + 1]);
+			length = std::stoull(l[a + 2]);
+		} catch (std::exception &e) {
+			cout << "Unable to parse iolog line " << line << endl;
+			nskipped_++;
+			continue;
+		}
+
+		/* widen unaligned I/Os to whole sectors */
+		auto s = offset >> 9;
+		auto e = (offset + length + 511) >> 9;
+		if (e <= s) {
+			nskipped_++;
+			continue;
+		}
+
+		tio.sector_   = s;
+		tio.nsectors_ = e - s;
+		tio.read_     = action == "read";
+		nrecords_++;
+		return true;
+	}
+	return false;
+}
+
+unique_ptr<TraceReader> openTrace(const string &path, const string &format) {
+	if (format == "blktrace") {
+		return std::make_unique<BlkparseReader>(path);
+	} else if (format == "iolog") {
+		return std::make_unique<FioIologReader>(path);
+	} else if (format != "auto") {
+		throw std::invalid_argument("Unknown trace format " + format);
+	}
+
+	std::ifstream is(path);
+	if (!is.is_open()) {
+		throw runtime_error("Could not open trace " + path);
+	}
+
+	string line;
+	std::getline(is, line);
+	if (line.compare(0, 12, "fio version ") == 0) {
+		return std::make_unique<FioIologReader>(path);
+	}
+	return std::make_unique<BlkparseReader>(path);
+}
+
+TraceReplay::TraceReplay(unique_ptr<TraceReader> reader, uint64_t sector,
+			uint64_t nsectors, uint64_t maxSectors) :
+				reader_(std::move(reader)), sector_(sector),
+				nsectors_(nsectors), maxSectors_(maxSectors), nloops_(0) {
+	assert(reader_ && nsectors_ > maxSectors_ && maxSectors_ > 0);
+}
+
+void TraceReplay::next_io(uint64_t *sectorp, uint64_t *nsectorsp, bool *readp) {
+	trace_io tio;
+
+	if (!reader_->next(tio)) {
+		reader_->rewind();
+		nloops_++;
+		if (!reader_->next(tio)) {
+			throw runtime_error("trace has no replayable reads or writes");
+		}
+	}
+
+	auto ns = tio.nsectors_;
+	if (ns > maxSectors_) {
+		ns = maxSectors_;
+	}
+
+	/* fold the trace's LBA space into the IO region */
+	auto s = tio.sector_ % nsectors_;
+	if (s + ns > nsectors_) {
+		s = nsectors_ - ns;
+	}
+
+	*sectorp   = sector_ + s;
+	*nsectorsp = ns;
+	*readp     = tio.read_;
+}
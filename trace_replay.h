@@ -0,0 +1,111 @@
+#ifndef __TRACE_REPLAY_H__
+#define __TRACE_REPLAY_H__
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <fstream>
+
+using std::string;
+using std::unique_ptr;
+
+/* one I/O parsed from an external trace, in 512 byte sectors */
+struct trace_io {
+	uint64_t sector_;
+	uint64_t nsectors_;
+	bool     read_;
+};
+
+/*
+ * Streaming reader of an external I/O trace. next() returns false at the end
+ * of the trace, rewind() starts reading from the first record again.
+ */
+class TraceReader {
+protected:
+	string        path_;
+	std::ifstream is_;
+	uint64_t      nrecords_;
+	uint64_t      nskipped_;
+
+public:
+	TraceReader(const string &path);
+	virtual ~TraceReader() {}
+
+	virtual bool next(trace_io &tio) = 0;
+	virtual void rewind();
+
+	uint64_t getNRecords() const {
+		return nrecords_;
+	}
+
+	uint64_t getNSkipped() const {
+		return nskipped_;
+	}
+};
+
+/*
+ * blkparse binary output (blkparse -d) or raw per-cpu blktrace files. Only
+ * queue (Q) events of reads and writes are replayed.
+ */
+class BlkparseReader : public TraceReader {
+private:
+	bool swap_;
+	bool probed_;
+
+private:
+	bool probe();
+
+public:
+	BlkparseReader(const string &path);
+	bool next(trace_io &tio) override;
+};
+
+/* fio write_iolog output, version 2 and version 3 */
+class FioIologReader : public TraceReader {
+private:
+	int version_;
+
+private:
+	void readHeader();
+
+public:
+	FioIologReader(const string &path);
+	bool next(trace_io &tio) override;
+	void rewind() override;
+
+	int getVersion() const {
+		return version_;
+	}
+};
+
+/*
+ * Replays a trace in a loop, remapping every I/O into the region
+ * [sector, sector + nsectors) used for IOs.
+ */
+class TraceReplay {
+private:
+	unique_ptr<TraceReader> reader_;
+	uint64_t                sector_;
+	uint64_t                nsectors_;
+	uint64_t                maxSectors_;
+	uint64_t                nloops_;
+
+public:
+	TraceReplay(unique_ptr<TraceReader> reader, uint64_t sector,
+		uint64_t nsectors, uint64_t maxSectors);
+
+	void next_io(uint64_t *sectorp, uint64_t *nsectorsp, bool *readp);
+
+	uint64_t getNLoops() const {
+		return nloops_;
+	}
+
+	const TraceReader *getReader() const {
+		return reader_.get();
+	}
+};
+
+/* format is one of "auto", "blktrace" or "iolog" */
+unique_ptr<TraceReader> openTrace(const string &path, const string &format);
+
+#endif
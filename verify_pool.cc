@@ -0,0 +1,123 @@
+#include <chrono>
+
+#include <cassert>
+
+#include "verify_pool.h"
+#include "topology.h"
+
+VerifyPool::VerifyPool(uint32_t nthreads, uint32_t depth, int numaNode) :
+			depth_(depth), numaNode_(numaNode), stop_(false) {
+	assert(nthreads > 0 && depth > 0);
+	for (uint32_t i = 0; i < nthreads; i++) {
+		/* a queue of n holds n - 1 entries */
+		auto wp    = std::make_unique<Worker>(depth + 1);
+		auto p     = wp.get();
+		wp->thread = std::thread([this, p] () {
+			workerLoop(p);
+		});
+		workers_.push_back(std::move(wp));
+	}
+}
+
+VerifyPool::~VerifyPool() {
+	stop_ = true;
+	for (auto &wp : workers_) {
+		wp->thread.join();
+	}
+}
+
+void VerifyPool::workerLoop(Worker *wp) {
+	if (numaNode_ >= 0) {
+		numaBindThread(numaNode_);
+	}
+	wp->node = numaCurrentNode();
+
+	uint32_t idle = 0;
+	while (!stop_.load(std::memory_order_relaxed)) {
+		auto jp = wp->jobs.frontPtr();
+		if (jp == nullptr) {
+			/* spin a little, then back off */
+			if (++idle > 1024) {
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+				wp->node = numaCurrentNode();
+			}
+			continue;
+		}
+		idle = 0;
+
+		unique_ptr<Corruption> cp;
+		uint64_t               compared = 0;
+		try {
+			disk::verifyExpected(jp->bufp.get(), jp->sector, jp->nsectors,
+				jp->expected, jp->depth, &compared);
+		} catch (Corruption &c) {
+			cp = std::make_unique<Corruption>(c);
+		}
+
+		/*
+		 * Free the job's slot before the result is visible: once collected,
+		 * the IO thread may queue another job in it.
+		 */
+		auto bufp   = std::move(jp->bufp);
+		auto sector = jp->sector;
+		auto size   = (size_t) jp->nsectors << io_generator::SECTOR_SHIFT;
+		vector<IO> expected;
+		if (cp) {
+			/* the corruption is classified against what was compared */
+			expected = std::move(jp->expected);
+		}
+		wp->jobs.popFront();
+
+		/* never full - at most depth jobs are outstanding */
+		auto rc = wp->results.write(std::move(bufp), size, sector, compared,
+			std::move(cp), std::move(expected));
+		assert(rc);
+	}
+}
+
+bool VerifyPool::submit(VerifyJob &job) {
+	for (size_t i = 0; i < workers_.size(); i++) {
+		auto &wp = workers_[next_];
+		next_    = (next_ + 1) % workers_.size();
+		if (wp->outstanding >= depth_) {
+			continue;
+		}
+
+		auto rc = wp->jobs.write(std::move(job));
+		assert(rc);
+		wp->outstanding++;
+		njobs_++;
+		return true;
+	}
+	return false;
+}
+
+size_t VerifyPool::collect(std::function<void(VerifyResult &)> fn) {
+	size_t n = 0;
+	for (auto &wp : workers_) {
+		VerifyResult *rp;
+		while ((rp = wp->results.frontPtr()) != nullptr) {
+			fn(*rp);
+			wp->results.popFront();
+			wp->outstanding--;
+			n++;
+		}
+	}
+	return n;
+}
+
+uint64_t VerifyPool::outstanding() const {
+	uint64_t n = 0;
+	for (auto &wp : workers_) {
+		n += wp->outstanding;
+	}
+	return n;
+}
+
+std::map<int, uint32_t> VerifyPool::getWorkerNodes() const {
+	std::map<int, uint32_t> nodes;
+	for (auto &wp : workers_) {
+		nodes[wp->node.load()]++;
+	}
+	return nodes;
+}
@@ -0,0 +1,112 @@
+#ifndef __VERIFY_POOL_H__
+#define __VERIFY_POOL_H__
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <map>
+
+#include <folly/ProducerConsumerQueue.h>
+
+#include "disk_io.h"
+
+using std::vector;
+using std::unique_ptr;
+
+/* a completed read and a copy of the expected ranges it overlaps */
+struct VerifyJob {
+	ManagedBuffer bufp;
+	uint64_t      sector;
+	uint16_t      nsectors;
+	vector<IO>    expected;
+	VerifyDepth   depth;
+};
+
+struct VerifyResult {
+	ManagedBuffer          bufp;
+	size_t                 size;
+	uint64_t               sector;     /* of the read */
+	uint64_t               compared;   /* bytes */
+	unique_ptr<Corruption> corruption; /* null if data verified */
+	vector<IO>             expected;   /* the job's, if corrupt */
+
+	VerifyResult(ManagedBuffer b, size_t sz, uint64_t s, uint64_t n,
+			unique_ptr<Corruption> c, vector<IO> &&e) : bufp(std::move(b)),
+			size(sz), sector(s), compared(n), corruption(std::move(c)),
+			expected(std::move(e)) {
+	}
+};
+
+/*
+ * Verifier threads, each fed by the IO thread through its own lock free
+ * single producer single consumer queue and returning buffers (and any
+ * corruption found) through another. Jobs carry a snapshot of the expected
+ * state, workers never look at the disk's map.
+ *
+ * All methods except the workers' loop are called from the IO thread only.
+ */
+class VerifyPool {
+private:
+	struct Worker {
+		folly::ProducerConsumerQueue<VerifyJob>    jobs;
+		folly::ProducerConsumerQueue<VerifyResult> results;
+		uint32_t    outstanding = 0; /* jobs given and not collected */
+		std::atomic<int> node;       /* NUMA node the worker last ran on */
+		std::thread thread;
+
+		Worker(uint32_t depth) : jobs(depth), results(depth), node(-1) {
+		}
+	};
+
+	uint32_t                   depth_;
+	int                        numaNode_;
+	vector<unique_ptr<Worker>> workers_;
+	size_t                     next_ = 0;
+	std::atomic<bool>          stop_;
+
+	uint64_t                   njobs_    = 0;
+	uint64_t                   ninline_  = 0;
+
+private:
+	void workerLoop(Worker *wp);
+
+public:
+	/*
+	 * depth jobs per worker may be outstanding, workers run on numaNode
+	 * unless it is -1
+	 */
+	VerifyPool(uint32_t nthreads, uint32_t depth, int numaNode = -1);
+	~VerifyPool();
+
+	/* hand job to a worker, false (and job untouched) if all are busy */
+	bool submit(VerifyJob &job);
+
+	/* call fn for every finished job, returns number collected */
+	size_t collect(std::function<void(VerifyResult &)> fn);
+
+	uint64_t outstanding() const;
+
+	void verifiedInline() {
+		ninline_++;
+	}
+
+	uint64_t getNJobs() const {
+		return njobs_;
+	}
+
+	uint64_t getNInline() const {
+		return ninline_;
+	}
+
+	size_t getNThreads() const {
+		return workers_.size();
+	}
+
+	/* number of workers on every NUMA node */
+	std::map<int, uint32_t> getWorkerNodes() const;
+};
+
+#endif
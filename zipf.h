@@ -6,8 +6,13 @@
  * */
 
 #include <random>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <utility>
 #include <cstdint>
 #include <cmath>
+#include <cassert>
 
 class frand {
 private:
@@ -47,65 +52,169 @@ public:
 
 };
 
+/*
+ * Counter based generator (splitmix64 finalizer over key + counter). The i'th
+ * number is a pure function of (key, i), so batches are generated in a loop
+ * without any dependency between elements which the compiler can vectorize.
+ */
+class crand {
+private:
+	static const uint64_t GOLDEN = 0x9e3779b97f4a7c15ULL;
+	uint64_t key;
+	uint64_t counter;
+
+public:
+	static inline uint64_t mix(uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	/* map a random 64 bit value onto [0, range) without division */
+	static inline uint64_t bound(uint64_t r, uint64_t range) {
+		return (uint64_t) (((unsigned __int128) r * range) >> 64);
+	}
+
+	/* map a random 64 bit value onto [0, 1) */
+	static inline double unit(uint64_t r) {
+		return (r >> 11) * (1.0 / (double) (1ull << 53));
+	}
+
+	crand(uint64_t seed) : key(mix(seed) | 1), counter(0) {}
+
+	uint64_t next() {
+		return mix(key + (counter++) * GOLDEN);
+	}
+
+	void fill(uint64_t *out, size_t n) {
+		const uint64_t base = key + counter * GOLDEN;
+		for (size_t i = 0; i < n; i++) {
+			out[i] = mix(base + i * GOLDEN);
+		}
+		counter += n;
+	}
+};
+
 class zipf {
 private:
-	const uint64_t MAX_GEN     = 10000000ul;
+	/* below this many items zeta(n) is summed exactly */
+	static const uint64_t ZETA_EXACT = 4096;
 	const uint64_t GR_PRIME_64 = 0x9e37fffffffc0001ULL;
 	frand    rand;
+	crand    crand_;
 	double   theta;
 	uint64_t nitems; /* number of items to choose from */
 	double   zetan;  /* precalculated ZetaN, based on nitems */
 	double   zeta2;  /* precalculated Zeta2, based on theta */
+	double   alpha;  /* precalculated, based on theta */
+	double   eta;    /* precalculated, based on theta and nitems */
+	double   half;   /* precalculated 0.5^theta */
 	uint64_t rand_off;
 	uint32_t seed;
 
 private:
-	/* aux function to calculate zeta */
-	double zetan_calculate(void) {
-		auto MIN = [] (uint64_t a, uint64_t b) {
-			return (a < b ? a : b);
-		};
-
+	static double zeta_exact(uint64_t n, double theta) {
 		double ans = 0.0;
-
-		auto n = MIN(this->nitems, MAX_GEN);
 		for (uint64_t i = 1; i <= n; i++)
 			ans += pow(1.0 / (double)i, theta);
 		return ans;
 	}
 
+	/*
+	 * Euler-Maclaurin: exact sum of the first ZETA_EXACT - 1 terms, the tail
+	 * i^-theta for i in [a, n] is its integral plus end point corrections.
+	 * Relative error is well below 1e-12 for theta in (0, 2].
+	 */
+	static double zeta_approx(uint64_t n, double theta) {
+		const double a = ZETA_EXACT;
+		const double b = n;
+
+		auto f  = [theta] (double x) {
+			return pow(x, -theta);
+		};
+		auto f1 = [theta] (double x) {
+			return -theta * pow(x, -theta - 1);
+		};
+		auto f3 = [theta] (double x) {
+			return -theta * (theta + 1) * (theta + 2) * pow(x, -theta - 3);
+		};
+
+		double integral;
+		if (theta == 1.0) {
+			integral = log(b / a);
+		} else {
+			integral = (pow(b, 1.0 - theta) - pow(a, 1.0 - theta)) / (1.0 - theta);
+		}
+
+		double tail = integral + (f(a) + f(b)) / 2 +
+			(f1(b) - f1(a)) / 12 - (f3(b) - f3(a)) / 720;
+		return zeta_exact(ZETA_EXACT - 1, theta) + tail;
+	}
+
 public:
-	zipf(double theta, double nitems, uint32_t seed) : rand(seed) {
+	/* zeta(n) = sum of i^-theta for i in [1, n], cached on (theta, n) */
+	static double zetan_calculate(double theta, uint64_t n) {
+		static std::mutex lock;
+		static std::map<std::pair<double, uint64_t>, double> cache;
+
+		std::lock_guard<std::mutex> g(lock);
+		auto key = std::make_pair(theta, n);
+		auto it  = cache.find(key);
+		if (it != cache.end()) {
+			return it->second;
+		}
+
+		double zeta;
+		if (n <= ZETA_EXACT) {
+			zeta = zeta_exact(n, theta);
+		} else {
+			zeta = zeta_approx(n, theta);
+		}
+		cache.emplace(key, zeta);
+		return zeta;
+	}
+
+	zipf(double theta, uint64_t nitems, uint32_t seed) : rand(seed), crand_(seed) {
+		assert(theta > 0.0 && theta != 1.0 && nitems > 2);
 		this->theta  = theta;
 		this->nitems = nitems;
 		this->seed   = seed;
-		zetan        = zetan_calculate();
+		zetan        = zetan_calculate(theta, nitems);
 		zeta2        = pow(1.0, theta) + pow(0.5, theta);
+		half         = pow(0.5, theta);
+		alpha        = 1.0 / (1.0 - theta);
+		eta          = (1.0 - pow(2.0 / nitems, 1.0 - theta)) / (1.0 - zeta2 / zetan);
 		rand_off     = rand.rand();
 	}
 
-	uint64_t next() {
-		auto hash_u64 = [=] (uint64_t v) {
-			return v * GR_PRIME_64;
-		};
-		double   alpha, eta, rand_uni, rand_z;
+	/* map a uniform value in [0, 1] onto the distribution */
+	inline uint64_t transform(double rand_uni) const {
+		double   rand_z;
 		uint64_t n = nitems;
 		uint64_t val;
 
-		alpha = 1.0 / (1.0 - theta);
-		eta   = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
-		rand_uni = (double) rand.rand() / (double) frand::FRAND_MAX;
-		rand_z   = rand_uni * zetan;
-
+		rand_z = rand_uni * zetan;
 		if (rand_z < 1.0) {
 			val = 1;
-		} else if (rand_z < (1.0 + pow(0.5, theta))) {
+		} else if (rand_z < (1.0 + half)) {
 			val = 2;
 		} else {
 			val = 1 + (uint64_t)(n * pow(eta*rand_uni - eta + 1.0, alpha));
 		}
 
-		return (hash_u64(val - 1) + rand_off) % nitems;
+		return ((val - 1) * GR_PRIME_64 + rand_off) % nitems;
+	}
+
+	uint64_t next() {
+		return transform((double) rand.rand() / (double) frand::FRAND_MAX);
+	}
+
+	/* fill n values using the counter based generator */
+	void fill(uint64_t *out, size_t n) {
+		crand_.fill(out, n);
+		for (size_t i = 0; i < n; i++) {
+			out[i] = transform(crand::unit(out[i]));
+		}
 	}
 
 	uint32_t get_seed() {
@@ -117,6 +226,8 @@ public:
 class uniform {
 private:
 	std::mt19937 eng{std::random_device{}()};
+	std::uniform_int_distribution<uint64_t> dist;
+	crand        crand_{0};
 	uint64_t     min;
 	uint64_t     max;
 	uint32_t     seed;
@@ -124,7 +235,7 @@ private:
 public:
 	uniform() = default;
 	uniform(uint32_t seed, uint64_t min = 1, uint64_t max = 100000000ull) :
-		eng(seed)
+		eng(seed), dist(min, max), crand_(seed)
 	{
 		this->min  = min;
 		this->max  = max;
@@ -132,11 +243,109 @@ public:
 	}
 
 	uint64_t next() {
-		return std::uniform_int_distribution<uint64_t>{min, max}(eng);
+		return dist(eng);
+	}
+
+	/* fill n values using the counter based generator */
+	void fill(uint64_t *out, size_t n) {
+		const uint64_t range = max - min + 1;
+		crand_.fill(out, n);
+		for (size_t i = 0; i < n; i++) {
+			out[i] = min + crand::bound(out[i], range);
+		}
 	}
 
 	uint64_t get_min() { return min; }
 	uint64_t get_max() { return max; }
 	uint64_t get_seed() { return seed; }
 };
+/*
+ * Walker/Vose alias method: draws index i with probability
+ * weights[i] / sum(weights) at constant cost regardless of the number of
+ * weights. One 64 bit random number gives both the column (upper half) and
+ * the coin flip (lower half).
+ */
+class alias {
+private:
+	std::vector<uint64_t> threshold; /* coin threshold scaled to 2^32 */
+	std::vector<uint32_t> other;     /* alias of each column */
+	crand                 crand_;
+
+public:
+	alias(const std::vector<double> &weights, uint32_t seed) : crand_(seed) {
+		const auto n = weights.size();
+		assert(n > 0 && n < (1ull << 32));
+
+		double total = 0;
+		for (auto w : weights) {
+			assert(w >= 0);
+			total += w;
+		}
+		assert(total > 0);
+
+		std::vector<double>   p(n);
+		std::vector<uint32_t> small;
+		std::vector<uint32_t> large;
+		for (uint32_t i = 0; i < n; i++) {
+			p[i] = weights[i] * n / total;
+			if (p[i] < 1.0) {
+				small.push_back(i);
+			} else {
+				large.push_back(i);
+			}
+		}
+
+		threshold.resize(n);
+		other.resize(n);
+		while (!small.empty() && !large.empty()) {
+			auto s = small.back();
+			auto l = large.back();
+			small.pop_back();
+
+			threshold[s] = (uint64_t) (p[s] * (1ull << 32));
+			other[s]     = l;
+			p[l]         = (p[l] + p[s]) - 1.0;
+			if (p[l] < 1.0) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+
+		/* left overs are 1.0 up to rounding */
+		for (auto i : large) {
+			threshold[i] = 1ull << 32;
+			other[i]     = i;
+		}
+		for (auto i : small) {
+			threshold[i] = 1ull << 32;
+			other[i]     = i;
+		}
+	}
+
+	inline uint32_t pick(uint64_t r) const {
+		uint32_t i = ((r >> 32) * threshold.size()) >> 32;
+		return (r & 0xffffffffull) < threshold[i] ? i : other[i];
+	}
+
+	uint32_t next() {
+		return pick(crand_.next());
+	}
+
+	void fill(uint32_t *out, size_t n) {
+		uint64_t r[64];
+		while (n) {
+			auto c = n < 64 ? n : 64;
+			crand_.fill(r, c);
+			for (size_t i = 0; i < c; i++) {
+				out[i] = pick(r[i]);
+			}
+			out += c;
+			n   -= c;
+		}
+	}
+
+	size_t size() const {
+		return threshold.size();
+	}
+};
 #endif